@@ -0,0 +1,340 @@
+#include "corpus.hpp"
+#include "exception.hpp"
+#include "hash.hpp"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageWriter>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+
+namespace myriad {
+
+    namespace {
+
+        struct format_spec {
+            const char* format;
+            const char* extension;
+        };
+
+        constexpr auto formats = std::array<format_spec, 4>{{
+            {"jpeg", "jpg"}, {"png", "png"}, {"gif", "gif"}, {"bmp", "bmp"}}};
+
+        constexpr auto sizes = std::array<std::array<int, 2>, 3>{{
+            {{320, 240}}, {{1280, 960}}, {{2560, 1920}}}};
+
+        constexpr auto original_quality = 90;
+        constexpr auto recompressed_quality = 40;
+
+        ///
+        /// Generates an image of the given size whose contents are determined by \p seed: a
+        /// diagonal gradient between two colours, overlaid with soft horizontal and vertical
+        /// waves and a handful of solid rectangles. This gives the perceptual hash enough
+        /// low-frequency structure to distinguish images from each other while still allowing
+        /// the lossy formats to compress realistically.
+        ///
+
+        QImage generate_image(const int width, const int height, const std::uint64_t seed) {
+
+            auto rng = std::mt19937_64{seed};
+            auto channel = std::uniform_int_distribution<int>{0, 255};
+            auto unit = std::uniform_real_distribution<double>{0.0, 1.0};
+
+            const auto from = std::array<int, 3>{{channel(rng), channel(rng), channel(rng)}};
+            const auto to = std::array<int, 3>{{channel(rng), channel(rng), channel(rng)}};
+
+            const auto x_freq = 2.0 + 6.0 * unit(rng);
+            const auto y_freq = 2.0 + 6.0 * unit(rng);
+            const auto phase = 6.283 * unit(rng);
+
+            struct rectangle {
+                int left, top, right, bottom;
+                QRgb colour;
+            };
+
+            auto rectangles = std::vector<rectangle>{};
+            for (auto i = 0; i < 6; ++i) {
+                const auto left = gsl::narrow_cast<int>(unit(rng) * width);
+                const auto top = gsl::narrow_cast<int>(unit(rng) * height);
+                const auto right = left + gsl::narrow_cast<int>(unit(rng) * width / 3);
+                const auto bottom = top + gsl::narrow_cast<int>(unit(rng) * height / 3);
+                rectangles.push_back({left, top, right, bottom,
+                    qRgb(channel(rng), channel(rng), channel(rng))});
+            }
+
+            auto result = QImage{width, height, QImage::Format_RGB32};
+            for (auto y = 0; y < height; ++y) {
+
+                const auto line = reinterpret_cast<QRgb*>(result.scanLine(y));
+                const auto v = static_cast<double>(y) / height;
+                const auto y_wave = std::sin(y_freq * 6.283 * v);
+
+                for (auto x = 0; x < width; ++x) {
+
+                    const auto u = static_cast<double>(x) / width;
+                    const auto t = 0.5 * (u + v);
+                    const auto wave = 24.0 * (std::sin(x_freq * 6.283 * u + phase) + y_wave);
+
+                    auto rgb = std::array<int, 3>{};
+                    for (auto c = 0; c < 3; ++c) {
+                        const auto value = (1 - t) * from[c] + t * to[c] + wave;
+                        rgb[c] = std::clamp(gsl::narrow_cast<int>(value), 0, 255);
+                    }
+
+                    line[x] = qRgb(rgb[0], rgb[1], rgb[2]);
+                    for (const auto& rect : rectangles) {
+                        if (x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom) {
+                            line[x] = rect.colour;
+                        }
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        ///
+        /// Packs variable-width LZW codes into GIF data sub-blocks, least significant bit first.
+        ///
+
+        class gif_code_writer {
+        public:
+
+            explicit gif_code_writer(QByteArray& output)
+              : m_output{output} {
+            }
+
+            void write(const unsigned code, const int width) {
+
+                m_bits |= static_cast<std::uint64_t>(code) << m_bit_count;
+                m_bit_count += width;
+
+                while (m_bit_count >= 8) {
+                    push(static_cast<char>(m_bits & 0xff));
+                    m_bits >>= 8;
+                    m_bit_count -= 8;
+                }
+            }
+
+            void finish() {
+
+                if (m_bit_count > 0) {
+                    push(static_cast<char>(m_bits & 0xff));
+                }
+
+                flush();
+                m_output.append('\0');
+            }
+
+        private:
+
+            void push(const char byte) {
+                m_block.append(byte);
+                if (m_block.size() == 255) {
+                    flush();
+                }
+            }
+
+            void flush() {
+                if (!m_block.isEmpty()) {
+                    m_output.append(static_cast<char>(m_block.size()));
+                    m_output.append(m_block);
+                    m_block.clear();
+                }
+            }
+
+            QByteArray& m_output;
+            QByteArray m_block;
+            std::uint64_t m_bits = 0;
+            int m_bit_count = 0;
+        };
+
+        void append_le16(QByteArray& output, const int value) {
+            output.append(static_cast<char>(value & 0xff));
+            output.append(static_cast<char>((value >> 8) & 0xff));
+        }
+
+        ///
+        /// Encodes \p image as a GIF with a fixed 3-3-2 bit colour palette. Rather than actually
+        /// compressing the pixels, the encoder writes each as a literal 9-bit code and resets the
+        /// decoder's string table before it would grow past 9 bits, which is valid LZW that every
+        /// decoder accepts. The files are larger than a real encoder would produce, but decoding
+        /// them exercises the same code paths.
+        ///
+
+        QByteArray encode_gif(const QImage& image) {
+
+            constexpr auto clear_code = 256u;
+            constexpr auto end_code = 257u;
+            constexpr auto code_width = 9;
+            constexpr auto codes_per_clear = 250;
+
+            auto result = QByteArray{"GIF89a"};
+            append_le16(result, image.width());
+            append_le16(result, image.height());
+            result.append(static_cast<char>(0xf7));
+            result.append('\0');
+            result.append('\0');
+
+            for (auto index = 0; index < 256; ++index) {
+                result.append(static_cast<char>((index >> 5) * 255 / 7));
+                result.append(static_cast<char>(((index >> 2) & 0x7) * 255 / 7));
+                result.append(static_cast<char>((index & 0x3) * 255 / 3));
+            }
+
+            result.append(',');
+            append_le16(result, 0);
+            append_le16(result, 0);
+            append_le16(result, image.width());
+            append_le16(result, image.height());
+            result.append('\0');
+            result.append('\x08');
+
+            const auto rgb_image = image.convertToFormat(QImage::Format_RGB32);
+            auto writer = gif_code_writer{result};
+            auto codes_since_clear = codes_per_clear;
+
+            for (auto y = 0; y < rgb_image.height(); ++y) {
+
+                const auto line = reinterpret_cast<const QRgb*>(rgb_image.constScanLine(y));
+                for (auto x = 0; x < rgb_image.width(); ++x) {
+
+                    if (codes_since_clear == codes_per_clear) {
+                        writer.write(clear_code, code_width);
+                        codes_since_clear = 0;
+                    }
+
+                    const auto pixel = line[x];
+                    const auto index = static_cast<unsigned>(
+                        (qRed(pixel) >> 5) << 5 | (qGreen(pixel) >> 5) << 2 | qBlue(pixel) >> 6);
+
+                    writer.write(index, code_width);
+                    ++codes_since_clear;
+                }
+            }
+
+            writer.write(end_code, code_width);
+            writer.finish();
+            result.append(';');
+            return result;
+        }
+
+        void write_image(
+            const QString& path, const QImage& image, const QByteArray& format,
+            const int quality) {
+
+            if (format == "gif") {
+                auto file = QFile{path};
+                if (!file.open(QIODevice::WriteOnly) || file.write(encode_gif(image)) < 0) {
+                    throw file_io_error{path};
+                }
+
+                return;
+            }
+
+            auto writer = QImageWriter{path, format};
+            writer.setQuality(quality);
+            if (!writer.write(image)) {
+                throw file_io_error{path};
+            }
+        }
+    }
+
+    std::vector<corpus_file> write_corpus(const QString& dir_path, const int group_count) {
+
+        const auto dir = QDir{dir_path};
+        auto result = std::vector<corpus_file>{};
+        auto group = 0;
+
+        for (const auto& spec : formats) {
+            for (const auto& size : sizes) {
+                for (auto index = 0; index < group_count; ++index, ++group) {
+
+                    const auto [width, height] = size;
+                    const auto original = generate_image(width, height, std::uint64_t(group));
+                    const auto crop_x = width / 25;
+                    const auto crop_y = height / 25;
+
+                    const auto add = [&dir, &result, group, spec, width, height](
+                        const QImage& image, const QByteArray& format, const char* extension,
+                        const char* variant, const int quality) {
+
+                        const auto name = QStringLiteral("%1-%2x%3-%4-%5.%6")
+                            .arg(QString::fromLatin1(spec.format)).arg(width).arg(height)
+                            .arg(group).arg(QString::fromLatin1(variant))
+                            .arg(QString::fromLatin1(extension));
+
+                        const auto path = dir.absoluteFilePath(name);
+                        write_image(path, image, format, quality);
+                        result.push_back({path, format, group, variant});
+                    };
+
+                    const auto format = QByteArray{spec.format};
+                    add(original, format, spec.extension, "original", original_quality);
+
+                    add(original.scaled(width / 2, height / 2, Qt::IgnoreAspectRatio,
+                        Qt::SmoothTransformation), format, spec.extension, "rescaled",
+                        original_quality);
+
+                    add(original.copy(crop_x, crop_y, width - 2 * crop_x, height - 2 * crop_y),
+                        format, spec.extension, "cropped", original_quality);
+
+                    add(original, "jpeg", "jpg", "recompressed", recompressed_quality);
+                }
+            }
+        }
+
+        return result;
+    }
+
+    std::vector<std::uint64_t> synthetic_hashes(
+        const int count, const int group_size, const std::uint64_t seed) {
+
+        auto rng = std::mt19937_64{seed};
+        auto bit = std::uniform_int_distribution<int>{0, 63};
+
+        auto result = std::vector<std::uint64_t>{};
+        result.reserve(gsl::narrow_cast<std::size_t>(count));
+
+        auto base = std::uint64_t{0};
+        for (auto index = 0; index < count; ++index) {
+
+            if (index % group_size == 0) {
+                base = rng();
+            }
+
+            auto hash = base;
+            for (auto flip = 0; flip < 3; ++flip) {
+                hash ^= std::uint64_t{1} << bit(rng);
+            }
+
+            result.push_back(hash);
+        }
+
+        return result;
+    }
+
+    image_set synthetic_images(const std::vector<std::uint64_t>& hashes, const QString& prefix) {
+
+        auto result = image_set{};
+        for (auto index = std::size_t{0}; index < hashes.size(); ++index) {
+            const auto path = prefix + QString::number(index) + ".jpg";
+            result.insert(synthetic_image(path, hashes[index]));
+        }
+
+        return result;
+    }
+
+    image_info synthetic_image(const QString& path, const std::uint64_t hash) {
+        return image_info{
+            path, 0, QDateTime{}, 640, 480, image_format::jpeg, stable_hash(path), hash};
+    }
+}
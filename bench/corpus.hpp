@@ -0,0 +1,65 @@
+#ifndef MYRIAD_BENCH_CORPUS_HPP
+#define MYRIAD_BENCH_CORPUS_HPP
+
+#include "image_info.hpp"
+#include "image_set.hpp"
+
+#include <QByteArray>
+#include <QString>
+
+#include <cstdint>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// Describes a file written by write_corpus(). Files with the same \c group are derived from
+    /// the same generated image, and so should all be considered duplicates of each other;
+    /// \c variant names the transformation applied to produce this particular file.
+    ///
+
+    struct corpus_file {
+        QString path;
+        QByteArray format;
+        int group;
+        const char* variant;
+    };
+
+    ///
+    /// Writes a synthetic image corpus into the directory \p dir_path, which must already exist,
+    /// and returns a description of each file written. For each of the JPEG, PNG, GIF and BMP
+    /// formats and each of a range of image sizes, \p group_count original images are generated,
+    /// each accompanied by three near-duplicates: a copy rescaled to half size, a copy with a
+    /// narrow border cropped away, and a copy recompressed as a low-quality JPEG. The contents of
+    /// the corpus depend only on \p group_count, so runs against corpora written separately are
+    /// comparable. GIF files are written by a minimal encoder of our own, since \c QImageWriter
+    /// can't usually write them.
+    ///
+
+    std::vector<corpus_file> write_corpus(const QString& dir_path, int group_count);
+
+    ///
+    /// Generates \p count perceptual hashes in groups of \p group_size, where the hashes within
+    /// each group are a few bits from a common random hash and so fall within the default
+    /// distance threshold of each other. The hashes depend only on the arguments.
+    ///
+
+    std::vector<std::uint64_t> synthetic_hashes(int count, int group_size, std::uint64_t seed);
+
+    ///
+    /// Creates an \ref image_set with an image for each hash in \p hashes, under made-up paths
+    /// beginning with \p prefix, without touching the filesystem.
+    ///
+
+    image_set synthetic_images(const std::vector<std::uint64_t>& hashes, const QString& prefix);
+
+    ///
+    /// Creates an \ref image_info object with the perceptual hash \p hash for the made-up path
+    /// \p path, without touching the filesystem. Images with different paths have different
+    /// checksums.
+    ///
+
+    image_info synthetic_image(const QString& path, std::uint64_t hash);
+}
+
+#endif
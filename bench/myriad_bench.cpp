@@ -0,0 +1,298 @@
+#include "corpus.hpp"
+#include "directory_scanner.hpp"
+#include "exception.hpp"
+#include "file_type.hpp"
+#include "image_info.hpp"
+#include "image_set.hpp"
+#include "pairer.hpp"
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QString>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+// Benchmarks each phase of a merge in isolation: scanning a directory tree, constructing
+// image_info objects (and so decoding and hashing images) for each supported format and hash
+// variant, and finding and pairing candidates with each pairer at several collection sizes. The
+// scan and hashing benchmarks run against a synthetic corpus written by write_corpus(); the pairer
+// benchmarks use synthetic hashes, so that collection sizes far beyond that of the corpus can be
+// measured.
+//
+// Each benchmark reports its throughput, from the best of several runs, along with the peak
+// resident set size of the process at its end. Since the peak only ever grows, a benchmark that
+// raises it is the one responsible for the increase.
+
+using namespace myriad;
+
+namespace {
+
+    using std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+    constexpr auto distance_threshold = 8;
+    constexpr auto pair_group_size = 4;
+    constexpr auto pair_set_sizes = std::array<int, 3>{{1000, 10000, 100000}};
+
+    struct hash_variant_name {
+        const char* name;
+        phash_variant variant;
+    };
+
+    constexpr auto hash_variants = std::array<hash_variant_name, 3>{{
+        {"hash", phash_variant::compatible}, {"hash-area", phash_variant::area},
+        {"hash-diff", phash_variant::difference}}};
+
+    double peak_rss_mib() {
+        auto usage = rusage{};
+        ::getrusage(RUSAGE_SELF, &usage);
+        return static_cast<double>(usage.ru_maxrss) / 1024.0;
+    }
+
+    void report(const char* name, const QString& detail, const double count, const char* unit,
+        const seconds elapsed) {
+
+        std::printf("%-12s %-22s %10.3f ms %12.1f %s/s   peak RSS %7.1f MiB\n", name,
+            qPrintable(detail), 1000.0 * elapsed.count(), count / elapsed.count(), unit,
+            peak_rss_mib());
+    }
+
+    ///
+    /// Calls \p func \p run_count times, returning the shortest time taken by any of the calls.
+    ///
+
+    template <typename Func>
+    seconds best_of(const int run_count, Func&& func) {
+
+        auto best = seconds::max();
+        for (auto run = 0; run < run_count; ++run) {
+            const auto start = steady_clock::now();
+            func();
+            best = std::min<seconds>(best, steady_clock::now() - start);
+        }
+
+        return best;
+    }
+
+    const auto compare_none = [](const image_info&, const image_info&) {
+        return discard_choice::none;
+    };
+
+    // Every group is decided at once, keeping all of its images, so wait is never called.
+
+    const auto keep_all = [](const std::vector<image_info>&, std::size_t) {
+        return std::optional<keep_choice>{keep_choice{}};
+    };
+
+    const auto wait_none = [](bool) {
+        return std::vector<std::pair<std::size_t, keep_choice>>{};
+    };
+
+    void bench_scan(const QString& dir_path, const int run_count, const int worker_count) {
+
+        const auto filter = [](const QString& path) {
+            return may_be_supported(path);
+        };
+
+        const auto scanner = directory_scanner{filter, worker_count};
+        auto found_count = 0;
+
+        const auto elapsed = best_of(run_count, [&scanner, &dir_path, &found_count] {
+            found_count = 0;
+            scanner.scan(dir_path, [&found_count](const QString&) {
+                ++found_count;
+                return true;
+            }, [](int, int) {});
+        });
+
+        report("scan", QStringLiteral("%1 files").arg(found_count), found_count, "files",
+            elapsed);
+    }
+
+    void bench_hash(const std::vector<corpus_file>& corpus, const int run_count) {
+
+        auto paths_by_format = std::map<QByteArray, std::vector<QString>>{};
+        for (const auto& file : corpus) {
+            paths_by_format[file.format].push_back(file.path);
+        }
+
+        for (const auto& [format, paths] : paths_by_format) {
+
+            auto byte_count = qint64{0};
+            for (const auto& path : paths) {
+                byte_count += QFileInfo{path}.size();
+            }
+
+            const auto detail = QStringLiteral("%1 %2 files, %3 MiB")
+                .arg(static_cast<int>(paths.size())).arg(QString::fromLatin1(format))
+                .arg(static_cast<double>(byte_count) / (1024.0 * 1024.0), 0, 'f', 1);
+
+            for (const auto& [name, variant] : hash_variants) {
+
+                auto failed_count = 0;
+                const auto elapsed = best_of(run_count, [&paths = paths, &failed_count, variant] {
+                    failed_count = 0;
+                    for (const auto& path : paths) {
+                        try {
+                            static_cast<void>(image_info{QFileInfo{path}, variant});
+                        } catch (const file_io_error&) {
+                            ++failed_count;
+                        }
+                    }
+                });
+
+                report(name, detail, static_cast<double>(paths.size()), "images", elapsed);
+                if (failed_count > 0) {
+                    std::printf("             (%d files could not be read)\n", failed_count);
+                }
+            }
+        }
+    }
+
+    void bench_pairers(const int run_count, const int worker_count) {
+
+        for (const auto size : pair_set_sizes) {
+
+            const auto hashes = synthetic_hashes(size, pair_group_size, std::uint64_t(size));
+
+            // For merges, every tenth image is taken as an input; the rest form the collection,
+            // so that most inputs have near-duplicates within it.
+
+            auto src_hashes = std::vector<std::uint64_t>{};
+            auto dst_hashes = std::vector<std::uint64_t>{};
+            for (auto index = std::size_t{0}; index < hashes.size(); ++index) {
+                (index % 10 == 0 ? src_hashes : dst_hashes).push_back(hashes[index]);
+            }
+
+            auto set = synthetic_images(hashes, "/bench/cluster/");
+            auto src_set = synthetic_images(src_hashes, "/bench/src/");
+            auto dst_set = synthetic_images(dst_hashes, "/bench/dst/");
+            const auto label = QStringLiteral("%1 images").arg(size);
+
+            // Deduplicating a collection is measured by merging nothing into it, so that every
+            // group is a cluster.
+
+            auto empty_set = image_set{};
+            auto group_count = 0;
+            const auto cluster_elapsed =
+                best_of(run_count, [&empty_set, &set, &group_count, worker_count] {
+                    auto pairer = deferred_merge_pairer{
+                        empty_set, set, distance_threshold, worker_count};
+                    group_count = pairer.count();
+                    pairer.pair(keep_all, wait_none);
+                });
+
+            report("cluster", label, group_count, "groups", cluster_elapsed);
+
+            const auto merge_elapsed =
+                best_of(run_count, [&src_set, &dst_set, &group_count, worker_count] {
+                    auto pairer = deferred_merge_pairer{
+                        src_set, dst_set, distance_threshold, worker_count};
+                    group_count = pairer.count();
+                    pairer.pair(keep_all, wait_none);
+                });
+
+            report("merge", label, group_count, "groups", merge_elapsed);
+
+            auto pair_count = 0;
+            auto stream_items = std::vector<image_info>{};
+            for (auto index = std::size_t{0}; index < dst_hashes.size(); ++index) {
+                const auto path = QStringLiteral("/bench/stream/") + QString::number(index);
+                stream_items.push_back(synthetic_image(path, dst_hashes[index]));
+            }
+
+            const auto stream_elapsed = best_of(run_count, [&src_set, &stream_items, &pair_count] {
+                auto collection = image_set{};
+                auto pairer = stream_pairer{src_set, collection, distance_threshold};
+                pair_count = 0;
+                for (const auto& item : stream_items) {
+                    pair_count += pairer.add(item, compare_none);
+                }
+            });
+
+            report("stream", label, pair_count, "pairs", stream_elapsed);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+
+    QCoreApplication app{argc, argv};
+
+    auto parser = QCommandLineParser{};
+    parser.setApplicationDescription(QStringLiteral("Benchmarks the phases of a Myriad merge."));
+    parser.addHelpOption();
+
+    const auto dir_option = QCommandLineOption{QStringLiteral("corpus-dir"),
+        QStringLiteral("Write the corpus to <dir> and keep it, instead of a temporary directory."),
+        QStringLiteral("dir")};
+
+    const auto groups_option = QCommandLineOption{QStringLiteral("groups"),
+        QStringLiteral("Generate <n> groups of near-duplicates per format and size."),
+        QStringLiteral("n"), QStringLiteral("2")};
+
+    const auto runs_option = QCommandLineOption{QStringLiteral("runs"),
+        QStringLiteral("Report the best of <n> runs of each benchmark."),
+        QStringLiteral("n"), QStringLiteral("3")};
+
+    const auto threads_option = QCommandLineOption{QStringLiteral("threads"),
+        QStringLiteral("Use <n> worker threads where a phase supports them."),
+        QStringLiteral("n"), QString::number(std::max(QThread::idealThreadCount(), 1))};
+
+    parser.addOptions({dir_option, groups_option, runs_option, threads_option});
+    parser.process(app);
+
+    const auto group_count = std::max(parser.value(groups_option).toInt(), 1);
+    const auto run_count = std::max(parser.value(runs_option).toInt(), 1);
+    const auto worker_count = std::max(parser.value(threads_option).toInt(), 1);
+
+    auto temp_dir = QTemporaryDir{};
+    auto dir_path = parser.value(dir_option);
+
+    if (dir_path.isEmpty()) {
+        if (!temp_dir.isValid()) {
+            std::fprintf(stderr, "Could not create a temporary directory\n");
+            return 1;
+        }
+
+        dir_path = temp_dir.path();
+    } else if (!QDir{}.mkpath(dir_path)) {
+        std::fprintf(stderr, "Could not create %s\n", qPrintable(dir_path));
+        return 1;
+    }
+
+    const auto corpus_start = steady_clock::now();
+    auto corpus = std::vector<corpus_file>{};
+
+    try {
+        corpus = write_corpus(dir_path, group_count);
+    } catch (const file_io_error& error) {
+        std::fprintf(stderr, "Could not write %s\n", error.what());
+        return 1;
+    }
+
+    std::printf("Wrote %zu corpus files to %s in %.1f s, using %d threads\n\n", corpus.size(),
+        qPrintable(dir_path), seconds{steady_clock::now() - corpus_start}.count(), worker_count);
+
+    bench_scan(dir_path, run_count, worker_count);
+    bench_hash(corpus, run_count);
+    bench_pairers(run_count, worker_count);
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "corpus.hpp"
+#include "image_info.hpp"
+#include "image_set.hpp"
+#include "pairer.hpp"
+#include "ksr/function_view.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Measures the cost of each group offered by a deferred_merge_pairer, as used by every merge
+// made by engine::compare_images(), over a synthetic set of a million images arranged in groups
+// of four near-identical perceptual hashes. One image of each group is taken as an input and the
+// rest form the collection, so that pair() has a cluster in the collection and three merge pairs
+// to work through for each group. Three request callables are timed:
+//
+// - "floor" does nothing at all, and gives the cost of the pairing loop itself (including the
+//   construction of a vector of image_info objects for each group);
+// - "virtual" reproduces an earlier arrangement, in which the request went through a
+//   ksr::function_view (as called by a virtual pair()) and recalculated the progress percentage
+//   for every group;
+// - "inline" is the arrangement used by engine::compare_images(), with the callable passed
+//   directly to pair() and the percentage only recalculated when it can have changed.
+//
+// The callables keep every image, deciding at once, so the same pairer is reused for every run.
+
+using namespace myriad;
+
+namespace {
+
+    constexpr auto image_count = 1'000'000;
+    constexpr auto group_size = 4;
+    constexpr auto threshold = 8;
+    constexpr auto run_count = 5;
+
+    using request_sig = std::optional<keep_choice>(const std::vector<image_info>&, std::size_t);
+
+    int int_percentage(const int num, const int denom) {
+        const auto ratio = static_cast<float>(num) / static_cast<float>(denom);
+        return static_cast<int>(std::lround(100.0f * ratio));
+    }
+
+    int next_percentage_count(const int percent, const int denom) {
+        const auto num = std::int64_t{2 * percent + 1} * denom;
+        return static_cast<int>((num + 199) / 200);
+    }
+
+    // Stands in for engine::appraise(), which is defined in another translation unit and so
+    // can't be inlined into the request in either arrangement.
+
+    [[gnu::noinline]] std::optional<keep_choice> appraise(
+        const std::vector<image_info>&, std::size_t) {
+
+        return keep_choice{};
+    }
+
+    const auto wait_none = [](bool) {
+        return std::vector<std::pair<std::size_t, keep_choice>>{};
+    };
+
+    template <typename Func>
+    double time_per_group(deferred_merge_pairer& pairer, Func&& run) {
+
+        auto best = std::chrono::duration<double, std::nano>::max();
+        for (auto i = 0; i < run_count; ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            run(pairer);
+            best = std::min<decltype(best)>(best, std::chrono::steady_clock::now() - start);
+        }
+
+        return best.count() / pairer.count();
+    }
+}
+
+int main() {
+
+    const auto hashes = synthetic_hashes(image_count, group_size, 42);
+
+    auto src_hashes = std::vector<std::uint64_t>{};
+    auto dst_hashes = std::vector<std::uint64_t>{};
+    for (auto index = std::size_t{0}; index < hashes.size(); ++index) {
+        (index % group_size == 0 ? src_hashes : dst_hashes).push_back(hashes[index]);
+    }
+
+    auto inputs = synthetic_images(src_hashes, "/bench/src/");
+    auto collection = synthetic_images(dst_hashes, "/bench/dst/");
+    auto pairer = deferred_merge_pairer{
+        inputs, collection, threshold, static_cast<int>(std::thread::hardware_concurrency())};
+
+    const auto total_count = pairer.count();
+    std::printf("%d images, %d groups\n", image_count, total_count);
+
+    auto reported = 0;
+
+    const auto floor = time_per_group(pairer, [](deferred_merge_pairer& p) {
+        p.pair([](const std::vector<image_info>&, std::size_t) {
+            return std::optional<keep_choice>{keep_choice{}};
+        }, wait_none);
+    });
+
+    const auto indirect =
+        time_per_group(pairer, [&reported, total_count](deferred_merge_pairer& p) {
+
+            auto count = 0;
+            auto last_percent_complete = 0;
+
+            const auto callback = [&reported, &count, &last_percent_complete, total_count](
+                const std::vector<image_info>& group, const std::size_t tag) {
+
+                const auto percent_complete = int_percentage(count, total_count);
+                if (percent_complete > last_percent_complete) {
+                    ++reported;
+                    last_percent_complete = percent_complete;
+                }
+
+                ++count;
+                return appraise(group, tag);
+            };
+
+            p.pair(ksr::function_view<request_sig>{callback}, wait_none);
+        });
+
+    const auto inlined =
+        time_per_group(pairer, [&reported, total_count](deferred_merge_pairer& p) {
+
+            auto count = 0;
+            auto last_percent_complete = 0;
+            auto next_report_count = next_percentage_count(0, total_count);
+
+            p.pair([&reported, &count, &last_percent_complete, &next_report_count, total_count](
+                const std::vector<image_info>& group, const std::size_t tag) {
+
+                if (count >= next_report_count) {
+                    const auto percent_complete = int_percentage(count, total_count);
+                    if (percent_complete > last_percent_complete) {
+                        ++reported;
+                        last_percent_complete = percent_complete;
+                    }
+
+                    next_report_count = std::max(
+                        next_percentage_count(last_percent_complete, total_count), count + 1);
+                }
+
+                ++count;
+                return appraise(group, tag);
+            }, wait_none);
+        });
+
+    std::printf("floor:   %7.2f ns/group\n", floor);
+    std::printf("virtual: %7.2f ns/group (%+.2f)\n", indirect, indirect - floor);
+    std::printf("inline:  %7.2f ns/group (%+.2f)\n", inlined, inlined - floor);
+    std::printf("(%d progress reports)\n", reported);
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include "batch.hpp"
+#include "command_line.hpp"
+#include "engine.hpp"
+#include "exception.hpp"
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+namespace myriad {
+
+    namespace {
+
+        ///
+        /// Records the images discarded by an \ref engine over the course of a merge, and
+        /// describes them as groups of duplicates, each represented by the image kept from it.
+        ///
+
+        class discard_log {
+        public:
+
+            void add(const QString& path, const QString& kept_path) {
+                m_kept_paths.emplace(path, kept_path);
+                m_order.push_back(path);
+            }
+
+            std::size_t size() const {
+                return m_order.size();
+            }
+
+            ///
+            /// Determines the image ultimately kept in place of the image at \p path. An image
+            /// that was kept over one duplicate may later be discarded in favour of another, so
+            /// this follows the chain of decisions to its end; no image is ever compared again
+            /// once discarded, so the chain cannot loop.
+            ///
+
+            QString kept_path(QString path) const {
+                for (auto iter = m_kept_paths.find(path); iter != std::cend(m_kept_paths);
+                     iter = m_kept_paths.find(path)) {
+                    path = iter->second;
+                }
+
+                return path;
+            }
+
+            QJsonArray groups() const {
+
+                auto members = std::map<QString, QStringList>{};
+                for (const auto& path : m_order) {
+                    members[kept_path(path)].push_back(path);
+                }
+
+                auto result = QJsonArray{};
+                for (auto& [kept, discarded] : members) {
+                    discarded.sort();
+                    result.append(QJsonObject{
+                        {QStringLiteral("kept"), kept},
+                        {QStringLiteral("discarded"), QJsonArray::fromStringList(discarded)}});
+                }
+
+                return result;
+            }
+
+            QJsonArray actions(const QSet<QString>& input_paths) const {
+
+                auto result = QJsonArray{};
+                for (const auto& path : m_order) {
+                    result.append(QJsonObject{
+                        {QStringLiteral("action"), QStringLiteral("discard")},
+                        {QStringLiteral("path"), path},
+                        {QStringLiteral("input"), input_paths.contains(path)},
+                        {QStringLiteral("duplicate_of"), m_kept_paths.at(path)},
+                        {QStringLiteral("kept"), kept_path(path)}});
+                }
+
+                return result;
+            }
+
+        private:
+            std::map<QString, QString> m_kept_paths;
+            std::vector<QString> m_order;
+        };
+
+        ///
+        /// Writes \p report as indented JSON to the file at the filesystem path \p path, or to
+        /// the standard output if \p path is "-".
+        /// \throws file_io_error if the report could not be written.
+        ///
+
+        void write_report(const QJsonObject& report, const QString& path) {
+
+            const auto data = QJsonDocument{report}.toJson(QJsonDocument::Indented);
+
+            if (path == QStringLiteral("-")) {
+                QFile file;
+                if (!file.open(stdout, QIODevice::WriteOnly) || file.write(data) != data.size()) {
+                    throw file_io_error{path};
+                }
+
+                return;
+            }
+
+            QSaveFile file{path};
+            if (!file.open(QIODevice::WriteOnly)) {
+                throw file_io_error{path};
+            }
+
+            file.write(data);
+            if (!file.commit()) {
+                throw file_io_error{path};
+            }
+        }
+    }
+
+    int run_batch(int argc, char** argv) {
+
+        QCoreApplication app{argc, argv};
+
+        auto parser = QCommandLineParser{};
+        parser.setApplicationDescription(QStringLiteral(
+            "Merges images into a collection without user interaction, writing a JSON report of "
+            "the duplicates found and which of each were discarded. No files are modified."));
+        parser.addHelpOption();
+
+        const auto batch_option = QCommandLineOption{QStringLiteral("batch"),
+            QStringLiteral("Run without a user interface.")};
+
+        const auto report_option = QCommandLineOption{QStringLiteral("report"),
+            QStringLiteral("Write the report to <file>, or to the standard output if '-'."),
+            QStringLiteral("file"), QStringLiteral("-")};
+
+        const auto pipelined_option = QCommandLineOption{QStringLiteral("pipelined"),
+            QStringLiteral("Overlap the scanning, hashing and comparison of the collection.")};
+
+        const auto metrics_option = QCommandLineOption{QStringLiteral("metrics"),
+            QStringLiteral("Include counters and timings for the merge in the report.")};
+
+        const auto memory_option = QCommandLineOption{QStringLiteral("memory-limit"),
+            QStringLiteral("Keep the memory used to roughly <MiB> by holding the collection in a "
+                "temporary file, for collections too large to fit in memory."),
+            QStringLiteral("MiB")};
+
+        const auto shards_option = QCommandLineOption{QStringLiteral("shards"),
+            QStringLiteral("Divide the collection into <count> shards, each hashed and searched "
+                "for duplicates by a separate worker process."),
+            QStringLiteral("count"), QStringLiteral("1")};
+
+        const auto prefilter_option = QCommandLineOption{QStringLiteral("prefilter"),
+            QStringLiteral("Hash images in full only if a cheap hash of their thumbnail is within "
+                "<distance> of another's."),
+            QStringLiteral("distance")};
+
+        const auto read_ahead_option = QCommandLineOption{QStringLiteral("read-ahead"),
+            QStringLiteral("Read up to <MiB> of images ahead of decoding them, for collections "
+                "on slow storage."),
+            QStringLiteral("MiB")};
+
+        auto options = merge_options{};
+        options.add_to(parser);
+        parser.addOptions({batch_option, report_option, pipelined_option, metrics_option,
+            memory_option, shards_option, prefilter_option, read_ahead_option});
+        parser.addPositionalArgument(QStringLiteral("inputs"),
+            QStringLiteral("Image files, or directories of them, to merge into the collection."),
+            QStringLiteral("[inputs...]"));
+        parser.process(app);
+
+        if (!options.read(parser)) {
+            return 2;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+
+        auto missing_paths = QStringList{};
+        const auto input_paths =
+            find_images(parser.positionalArguments(), options.worker_count, missing_paths);
+
+        // The engine is driven directly on this thread, so its signals are delivered as soon as
+        // they are emitted, and no event loop is needed.
+
+        auto worker = engine{};
+        options.apply_to(worker);
+        worker.set_metrics_enabled(parser.isSet(metrics_option));
+        worker.set_pipelined(parser.isSet(pipelined_option));
+        worker.set_memory_limit(parser.value(memory_option).toLongLong() * 1024 * 1024);
+        worker.set_shard_count(parser.value(shards_option).toInt());
+        worker.set_prefilter_threshold(parser.value(prefilter_option).toInt());
+        worker.set_read_ahead(parser.value(read_ahead_option).toLongLong() * 1024 * 1024);
+
+        auto discarded = discard_log{};
+        auto unreadable_paths = QStringList{};
+        auto metrics = QJsonObject{};
+        auto image_count = 0;
+        auto failed_path = QString{};
+
+        QObject::connect(&worker, &engine::image_discarded,
+            [&discarded](const QString& path, const QString& kept_path) {
+                discarded.add(path, kept_path);
+            });
+
+        QObject::connect(&worker, &engine::images_unreadable,
+            [&unreadable_paths](const QStringList& paths) {
+                unreadable_paths.append(paths);
+            });
+
+        QObject::connect(&worker, &engine::input_count_changed,
+            [&image_count](const int file_count, int) {
+                image_count = file_count;
+            });
+
+        QObject::connect(&worker, &engine::metrics_reported,
+            [&metrics](const QJsonObject& reported) {
+                metrics = reported;
+            });
+
+        QObject::connect(&worker, &engine::merge_failed, [&failed_path](const QString& path) {
+            failed_path = path;
+        });
+
+        worker.merge(input_paths, options.collection_path);
+
+        if (!failed_path.isEmpty()) {
+            std::fprintf(stderr, "Could not use the temporary file %s\n", qPrintable(failed_path));
+            return 1;
+        }
+
+        auto absolute_inputs = QSet<QString>{};
+        for (const auto& path : input_paths) {
+            absolute_inputs.insert(QFileInfo{path}.absoluteFilePath());
+        }
+
+        const auto elapsed =
+            std::chrono::duration<double, std::milli>{std::chrono::steady_clock::now() - start};
+
+        const auto summary = QJsonObject{
+            {QStringLiteral("inputs"), input_paths.size()},
+            {QStringLiteral("collection_images"), image_count},
+            {QStringLiteral("discarded"), static_cast<double>(discarded.size())},
+            {QStringLiteral("unreadable"), unreadable_paths.size()},
+            {QStringLiteral("elapsed_ms"), elapsed.count()}};
+
+        auto report = QJsonObject{
+            {QStringLiteral("collection"), options.collection_path},
+            {QStringLiteral("keep"), options.policy_name},
+            {QStringLiteral("summary"), summary},
+            {QStringLiteral("groups"), discarded.groups()},
+            {QStringLiteral("actions"), discarded.actions(absolute_inputs)},
+            {QStringLiteral("unreadable"), QJsonArray::fromStringList(unreadable_paths)},
+            {QStringLiteral("missing"), QJsonArray::fromStringList(missing_paths)}};
+
+        if (!metrics.isEmpty()) {
+            report.insert(QStringLiteral("metrics"), metrics);
+        }
+
+        try {
+            write_report(report, parser.value(report_option));
+        } catch (const file_io_error& error) {
+            std::fprintf(stderr, "Could not write the report to %s\n", error.what());
+            return 1;
+        }
+
+        return 0;
+    }
+}
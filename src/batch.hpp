@@ -0,0 +1,19 @@
+#ifndef MYRIAD_BATCH_HPP
+#define MYRIAD_BATCH_HPP
+
+namespace myriad {
+
+    ///
+    /// Runs a single merge without any user interface, as described by the command line given by
+    /// \p argc and \p argv, and returns the process exit status. Only a \c QCoreApplication is
+    /// constructed, so that no windowing system need be available and none of the cost of
+    /// initialising widgets is paid. Duplicates are decided between by a \ref engine::keep_policy
+    /// chosen on the command line, and the outcome is written as a JSON report describing each
+    /// group of duplicates and the images discarded from it. Files are never modified; acting on
+    /// the report is left to the caller.
+    ///
+
+    int run_batch(int argc, char** argv);
+}
+
+#endif
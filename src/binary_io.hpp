@@ -0,0 +1,74 @@
+#ifndef MYRIAD_BINARY_IO_HPP
+#define MYRIAD_BINARY_IO_HPP
+
+#include "exception.hpp"
+
+#include <QFileDevice>
+#include <QString>
+
+#include "gsl/gsl"
+
+#include <cstdint>
+#include <type_traits>
+
+namespace myriad {
+
+    ///
+    /// Writes the bytes of \p value to \p file, in native byte order.
+    /// \throws file_io_error if they could not all be written.
+    ///
+
+    template <typename T>
+    void write_value(QFileDevice& file, const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (file.write(reinterpret_cast<const char*>(&value), sizeof(T)) != sizeof(T)) {
+            throw file_io_error{file.fileName()};
+        }
+    }
+
+    ///
+    /// Reads a value written by write_value() from \p file.
+    /// \throws file_io_error if the file ended first or could not be read.
+    ///
+
+    template <typename T>
+    T read_value(QFileDevice& file) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto result = T{};
+        if (file.read(reinterpret_cast<char*>(&result), sizeof(T)) != sizeof(T)) {
+            throw file_io_error{file.fileName()};
+        }
+
+        return result;
+    }
+
+    ///
+    /// Writes the UTF-16 text of \p value to \p file, without its length, which must be recorded
+    /// separately.
+    /// \throws file_io_error if it could not all be written.
+    ///
+
+    inline void write_utf16(QFileDevice& file, const QString& value) {
+        const auto size = gsl::narrow_cast<qint64>(value.size() * sizeof(char16_t));
+        if (file.write(reinterpret_cast<const char*>(value.utf16()), size) != size) {
+            throw file_io_error{file.fileName()};
+        }
+    }
+
+    ///
+    /// Reads \p length characters of UTF-16 text written by write_utf16() from \p file.
+    /// \throws file_io_error if the file ended first or could not be read.
+    ///
+
+    inline QString read_utf16(QFileDevice& file, const std::uint32_t length) {
+        auto result = QString{gsl::narrow_cast<int>(length), Qt::Uninitialized};
+        const auto size = gsl::narrow_cast<qint64>(length * sizeof(char16_t));
+        if (file.read(reinterpret_cast<char*>(result.data()), size) != size) {
+            throw file_io_error{file.fileName()};
+        }
+
+        return result;
+    }
+}
+
+#endif
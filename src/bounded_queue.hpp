@@ -0,0 +1,99 @@
+#ifndef MYRIAD_BOUNDED_QUEUE_HPP
+#define MYRIAD_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace myriad {
+
+    ///
+    /// A first-in, first-out queue of fixed capacity that may be shared between threads, used to
+    /// pass work between the stages of a processing pipeline without allowing a fast producer to
+    /// run arbitrarily far ahead of a slow consumer. Once the queue has been closed, producers are
+    /// refused and consumers drain the values that remain before being told the queue is empty.
+    ///
+
+    template <typename T>
+    class bounded_queue {
+    public:
+
+        explicit bounded_queue(const std::size_t capacity)
+          : m_capacity{capacity > 0 ? capacity : 1} {
+        }
+
+        ///
+        /// Closes the queue, waking all threads blocked in calls to push() or pop().
+        ///
+
+        void close() {
+
+            {
+                const auto lock = std::lock_guard<std::mutex>{m_mutex};
+                m_closed = true;
+            }
+
+            m_not_empty.notify_all();
+            m_not_full.notify_all();
+        }
+
+        ///
+        /// Removes and returns the value at the front of the queue, blocking until one is
+        /// available. Returns an empty \c std::optional if the queue has been closed and no values
+        /// remain in it.
+        ///
+
+        std::optional<T> pop() {
+
+            auto lock = std::unique_lock<std::mutex>{m_mutex};
+            m_not_empty.wait(lock, [this] { return m_closed || !m_values.empty(); });
+
+            if (m_values.empty()) {
+                return std::nullopt;
+            }
+
+            auto result = std::optional<T>{std::move(m_values.front())};
+            m_values.pop_front();
+
+            lock.unlock();
+            m_not_full.notify_one();
+            return result;
+        }
+
+        ///
+        /// Appends \p value to the back of the queue, blocking until there is room to do so.
+        /// Returns \c false (and discards \p value) if the queue has been closed.
+        ///
+
+        bool push(T value) {
+
+            auto lock = std::unique_lock<std::mutex>{m_mutex};
+            m_not_full.wait(lock, [this] { return m_closed || m_values.size() < m_capacity; });
+
+            if (m_closed) {
+                return false;
+            }
+
+            m_values.push_back(std::move(value));
+
+            lock.unlock();
+            m_not_empty.notify_one();
+            return true;
+        }
+
+    private:
+
+        std::mutex m_mutex;
+        std::condition_variable m_not_empty;
+        std::condition_variable m_not_full;
+
+        std::deque<T> m_values;
+        std::size_t m_capacity;
+        bool m_closed = false;
+    };
+}
+
+#endif
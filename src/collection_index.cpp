@@ -0,0 +1,96 @@
+#include "collection_index.hpp"
+
+#include <QString>
+
+#include <algorithm>
+
+namespace myriad {
+
+    collection_index::collection_index(const int threshold)
+      : m_threshold{threshold},
+        m_index{threshold} {}
+
+    void collection_index::insert(const image_info& item) {
+
+        if (const auto existing = m_set.find(item.path())) {
+            erase(*existing);
+        }
+
+        const auto handle = m_set.insert(item).first;
+
+        const auto id = m_handles.size();
+        m_handles.push_back(handle);
+        m_removed.push_back(false);
+
+        if (m_ids.size() <= handle) {
+            m_ids.resize(handle + std::size_t{1});
+        }
+
+        m_ids[handle] = id;
+        m_index.insert(item.phash(), id);
+        compact();
+    }
+
+    bool collection_index::erase(const QString& path) {
+
+        const auto item = m_set.find(path);
+        if (!item) {
+            return false;
+        }
+
+        erase(*item);
+        compact();
+        return true;
+    }
+
+    void collection_index::erase_within(const QString& dir_path) {
+
+        auto prefix = dir_path;
+        if (!prefix.endsWith(QChar{'/'})) {
+            prefix.append(QChar{'/'});
+        }
+
+        for (const auto item : m_set.handles()) {
+            if (m_set.path(item).startsWith(prefix)) {
+                erase(item);
+            }
+        }
+
+        compact();
+    }
+
+    void collection_index::erase(const image_set::handle item) {
+
+        m_removed[m_ids[item]] = true;
+        m_set.erase(item);
+        ++m_removed_count;
+    }
+
+    void collection_index::compact() {
+
+        // Rebuilding allocates a new phash_index, which is large even when empty, so small
+        // numbers of removals are tolerated regardless of the size of the set.
+
+        constexpr auto min_removed_count = std::size_t{4096};
+        if (m_removed_count <= std::max(m_set.size(), min_removed_count)) {
+            return;
+        }
+
+        auto infos = std::vector<image_info>{};
+        infos.reserve(m_set.size());
+        for (const auto item : m_set.handles()) {
+            infos.push_back(m_set.info(item));
+        }
+
+        m_set = image_set{};
+        m_index = phash_index{m_threshold};
+        m_handles.clear();
+        m_removed.clear();
+        m_ids.clear();
+        m_removed_count = 0;
+
+        for (const auto& info : infos) {
+            insert(info);
+        }
+    }
+}
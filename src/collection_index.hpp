@@ -0,0 +1,105 @@
+#ifndef MYRIAD_COLLECTION_INDEX_HPP
+#define MYRIAD_COLLECTION_INDEX_HPP
+
+#include "image_info.hpp"
+#include "image_set.hpp"
+#include "phash_index.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class QString;
+
+namespace myriad {
+
+    ///
+    /// A set of images together with an index over their perceptual hashes, kept up to date as
+    /// images are added, replaced and removed one at a time, so that the duplicates of any image
+    /// may be found without a pass over the whole set. This is what allows a collection to be
+    /// held in memory and merged with new images repeatedly, rather than being scanned and paired
+    /// from scratch for each merge.
+    ///
+    /// A \ref phash_index can only grow, so the entries of removed images are left in place and
+    /// skipped when found. Once these outnumber the live entries (and are more than a few), the set
+    /// and the index are both rebuilt from the images that remain, which also reclaims the paths
+    /// of removed images.
+    ///
+
+    class collection_index {
+    public:
+
+        explicit collection_index(int threshold);
+
+        ///
+        /// Adds the image described by \p item, replacing any image with the same path.
+        ///
+
+        void insert(const image_info& item);
+
+        ///
+        /// Removes the image with the filesystem path \p path, returning \c false if there was no
+        /// such image.
+        ///
+
+        bool erase(const QString& path);
+
+        ///
+        /// Removes every image that is a descendant of the directory at the filesystem path
+        /// \p dir_path. This examines the path of every image in the index.
+        ///
+
+        void erase_within(const QString& dir_path);
+
+        ///
+        /// Calls \p callback with the handle of every image in the index whose perceptual hash is
+        /// within the index's threshold of \p hash, exactly once each and in an unspecified order.
+        /// The handles refer to images(), and remain valid until the index is next modified.
+        ///
+
+        template <typename Callback>
+        void find(std::uint64_t hash, Callback&& callback) const;
+
+        const image_set& images() const {
+            return m_set;
+        }
+
+        std::size_t size() const {
+            return m_set.size();
+        }
+
+    private:
+
+        void erase(image_set::handle item);
+
+        ///
+        /// Rebuilds the set and the index from the remaining images if the entries of removed
+        /// images have come to outnumber them, invalidating every handle.
+        ///
+
+        void compact();
+
+        int m_threshold;
+        image_set m_set;
+        phash_index m_index;
+
+        // Each image is indexed under an identifier that is never reused, since the handles of
+        // removed images are: m_handles maps identifiers to handles, and m_ids the reverse.
+
+        std::vector<image_set::handle> m_handles;
+        std::vector<bool> m_removed;
+        std::vector<std::size_t> m_ids;
+        std::size_t m_removed_count = 0;
+    };
+
+    template <typename Callback>
+    void collection_index::find(const std::uint64_t hash, Callback&& callback) const {
+        m_index.find(hash, [this, &callback](const std::size_t id) {
+            if (!m_removed[id]) {
+                callback(m_handles[id]);
+            }
+        });
+    }
+}
+
+#endif
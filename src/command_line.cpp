@@ -0,0 +1,127 @@
+#include "command_line.hpp"
+#include "directory_scanner.hpp"
+#include "file_type.hpp"
+
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QThread>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+
+namespace myriad {
+
+    namespace {
+
+        struct policy_name {
+            const char* name;
+            engine::keep_policy policy;
+        };
+
+        constexpr auto policy_names = std::array<policy_name, 2>{{
+            {"resolution", engine::keep_policy::larger_resolution},
+            {"size", engine::keep_policy::larger_file}}};
+
+        std::optional<engine::keep_policy> policy_from_name(const QString& name) {
+
+            for (const auto& item : policy_names) {
+                if (name == QString::fromLatin1(item.name)) {
+                    return item.policy;
+                }
+            }
+
+            return std::nullopt;
+        }
+    }
+
+    bool option_given(const int argc, char** const argv, const char* const option) {
+        return std::any_of(argv + 1, argv + argc, [option](const char* arg) {
+            return std::strcmp(arg, option) == 0;
+        });
+    }
+
+    QStringList find_images(
+        const QStringList& paths, const int worker_count, QStringList& missing_paths) {
+
+        const auto filter = [](const QString& path) {
+            return may_be_supported(path);
+        };
+
+        const auto scanner = directory_scanner{filter, worker_count};
+        auto result = QStringList{};
+
+        for (const auto& path : paths) {
+
+            if (!QFileInfo::exists(path)) {
+                missing_paths.push_back(path);
+                continue;
+            }
+
+            scanner.scan(path, [&result](const QString& found_path) {
+                result.push_back(found_path);
+                return true;
+            }, [](int, int) {});
+        }
+
+        return result;
+    }
+
+    merge_options::merge_options()
+      : m_collection_option{QStringLiteral("collection"),
+            QStringLiteral("Merge into the collection rooted at <dir>."), QStringLiteral("dir")},
+        m_policy_option{QStringLiteral("keep"),
+            QStringLiteral("Of two duplicates, keep the one with the larger <policy>: "
+                "'resolution' or 'size' (of the file)."),
+            QStringLiteral("policy"), QStringLiteral("resolution")},
+        m_threshold_option{QStringLiteral("threshold"),
+            QStringLiteral("Treat images whose hashes differ by at most <n> bits as duplicates."),
+            QStringLiteral("n"), QStringLiteral("8")},
+        m_threads_option{QStringLiteral("threads"),
+            QStringLiteral("Use <n> worker threads."),
+            QStringLiteral("n"), QString::number(std::max(QThread::idealThreadCount(), 1))},
+        m_fast_hash_option{QStringLiteral("fast-hash"),
+            QStringLiteral("Hash images from reduced-resolution decodes, which is much faster for "
+                "large images than the default hash, for which every image is decoded in full. "
+                "These hashes differ from the default ones, so cached hashes are recomputed.")} {}
+
+    void merge_options::add_to(QCommandLineParser& parser) const {
+        parser.addOptions({m_collection_option, m_policy_option, m_threshold_option,
+            m_threads_option, m_fast_hash_option});
+    }
+
+    bool merge_options::read(const QCommandLineParser& parser) {
+
+        collection_path = parser.value(m_collection_option);
+        if (collection_path.isEmpty() || !QFileInfo{collection_path}.isDir()) {
+            std::fprintf(stderr, "A collection directory must be given with --collection\n");
+            return false;
+        }
+
+        collection_path = QFileInfo{collection_path}.absoluteFilePath();
+
+        policy_name = parser.value(m_policy_option);
+        if (const auto named_policy = policy_from_name(policy_name)) {
+            policy = *named_policy;
+        } else {
+            std::fprintf(stderr, "Unknown keep policy: %s\n", qPrintable(policy_name));
+            return false;
+        }
+
+        variant = parser.isSet(m_fast_hash_option)
+            ? phash_variant::area
+            : phash_variant::compatible;
+        threshold = std::max(parser.value(m_threshold_option).toInt(), 0);
+        worker_count = std::max(parser.value(m_threads_option).toInt(), 1);
+        return true;
+    }
+
+    void merge_options::apply_to(engine& worker) const {
+        worker.set_distance_threshold(threshold);
+        worker.set_hash_variant(variant);
+        worker.set_keep_policy(policy);
+        worker.set_worker_count(worker_count);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef MYRIAD_COMMAND_LINE_HPP
+#define MYRIAD_COMMAND_LINE_HPP
+
+#include "engine.hpp"
+#include "phash.hpp"
+
+#include <QCommandLineOption>
+#include <QString>
+#include <QStringList>
+
+class QCommandLineParser;
+
+namespace myriad {
+
+    ///
+    /// Determines whether the command line given by \p argc and \p argv includes the argument
+    /// \p option exactly. This is used to choose a mode of operation before any application
+    /// object is constructed, so the arguments are examined directly.
+    ///
+
+    bool option_given(int argc, char** argv, const char* option);
+
+    ///
+    /// Finds the supported image files among \p paths, each of which may be the path to a file or
+    /// to a directory whose descendants are searched on \p worker_count threads. The paths found
+    /// are absolute. Paths that do not exist are appended to \p missing_paths.
+    ///
+
+    QStringList find_images(const QStringList& paths, int worker_count, QStringList& missing_paths);
+
+    ///
+    /// The command-line options shared by the modes that merge images without a user interface,
+    /// and the settings read from them: the collection to merge into, how duplicates are found and
+    /// decided between, and how many threads do the work.
+    ///
+
+    class merge_options {
+    public:
+
+        explicit merge_options();
+
+        void add_to(QCommandLineParser& parser) const;
+
+        ///
+        /// Reads the settings from \p parser, which must have processed the command line. If any
+        /// of them is missing or invalid, an explanation is written to the standard error stream
+        /// and \c false is returned.
+        ///
+
+        bool read(const QCommandLineParser& parser);
+
+        ///
+        /// Configures \p worker to merge images as these settings describe.
+        ///
+
+        void apply_to(engine& worker) const;
+
+        QString collection_path;
+        QString policy_name;
+        engine::keep_policy policy = engine::keep_policy::larger_resolution;
+        phash_variant variant = phash_variant::compatible;
+        int threshold = 8;
+        int worker_count = 1;
+
+    private:
+        QCommandLineOption m_collection_option;
+        QCommandLineOption m_policy_option;
+        QCommandLineOption m_threshold_option;
+        QCommandLineOption m_threads_option;
+        QCommandLineOption m_fast_hash_option;
+    };
+}
+
+#endif
@@ -0,0 +1,532 @@
+#include "daemon.hpp"
+#include "collection_index.hpp"
+#include "command_line.hpp"
+#include "directory_watcher.hpp"
+#include "engine.hpp"
+#include "exception.hpp"
+#include "file_type.hpp"
+#include "hash_cache.hpp"
+#include "image_info.hpp"
+#include "parallel.hpp"
+#include "phash.hpp"
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <optional>
+#include <vector>
+
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+using namespace std::literals::chrono_literals;
+
+namespace myriad {
+
+    namespace {
+
+        ///
+        /// How long changes are collected before being processed together, so that a burst of
+        /// events (such as a directory being copied in) is hashed in parallel.
+        ///
+
+        constexpr auto change_delay = 250ms;
+
+        ///
+        /// How long after the index last changed its hashes are saved to the cache.
+        ///
+
+        constexpr auto snapshot_delay = 30s;
+
+        ///
+        /// Writes \p event to the standard output as a single line of compact JSON, flushing it so
+        /// that a process reading the output sees each event as soon as it happens.
+        ///
+
+        void report(const QJsonObject& event) {
+            const auto line = QJsonDocument{event}.toJson(QJsonDocument::Compact);
+            std::fwrite(line.constData(), 1, gsl::narrow_cast<std::size_t>(line.size()), stdout);
+            std::fputc('\n', stdout);
+            std::fflush(stdout);
+        }
+
+        void report_unreadable(const QString& path) {
+            report(QJsonObject{
+                {QStringLiteral("event"), QStringLiteral("unreadable")},
+                {QStringLiteral("path"), path}});
+        }
+
+        struct hashed_image {
+            std::optional<image_info> info;
+            bool cached = false;
+        };
+
+        ///
+        /// Holds a collection in a \ref collection_index, updating it as the watched collection
+        /// changes and merging images from the watched inbox with it as they arrive.
+        ///
+
+        class collection_daemon {
+        public:
+
+            explicit collection_daemon(const merge_options& options, const QString& inbox_path);
+
+            ///
+            /// Starts watching the collection and inbox, then brings the index up to date with
+            /// the collection, reading only the images that have no valid entries in the cache.
+            /// Returns \c false if either directory could not be watched.
+            ///
+
+            bool start();
+
+            ///
+            /// Saves the hashes of the images hashed since the last snapshot to the cache, if
+            /// there are any. Entries for images removed from the collection are only dropped by
+            /// the first snapshot after the collection has been rescanned, since only then has
+            /// every image still present been looked up in the cache.
+            ///
+
+            void save_snapshot();
+
+        private:
+
+            std::vector<hashed_image> hash(const QStringList& paths);
+            void index(const QStringList& paths);
+            void rescan();
+            void process_changes();
+            void merge_inputs();
+            void mark_changed();
+
+            merge_options m_options;
+            QString m_inbox_path;
+            hash_cache m_cache;
+            collection_index m_index;
+            directory_watcher m_collection_watcher;
+            directory_watcher m_inbox_watcher;
+            QSet<QString> m_changed_paths;
+            QSet<QString> m_input_paths;
+            QTimer m_change_timer;
+            QTimer m_snapshot_timer;
+            bool m_changed = false;
+            bool m_rescanned = false;
+        };
+
+        collection_daemon::collection_daemon(
+            const merge_options& options, const QString& inbox_path)
+          : m_options{options},
+            m_inbox_path{QFileInfo{inbox_path}.absoluteFilePath()},
+            m_cache{collection_cache_path(options.collection_path), options.variant},
+            m_index{options.threshold} {
+
+            m_change_timer.setSingleShot(true);
+            m_change_timer.setInterval(change_delay);
+            m_snapshot_timer.setSingleShot(true);
+            m_snapshot_timer.setInterval(snapshot_delay);
+
+            QObject::connect(&m_change_timer, &QTimer::timeout, [this] {
+                process_changes();
+                merge_inputs();
+            });
+
+            QObject::connect(&m_snapshot_timer, &QTimer::timeout, [this] {
+                save_snapshot();
+            });
+
+            // A file that is removed is dropped from the index at once, whereas a file that is
+            // written waits to be hashed along with any others written around the same time.
+            // Written files are filtered just as find_images() filters scanned ones, so that other
+            // files (such as sidecars) aren't reported as unreadable images.
+
+            const auto changed = [this](const QString& path) {
+                m_changed_paths.insert(path);
+                m_change_timer.start();
+            };
+
+            QObject::connect(&m_collection_watcher, &directory_watcher::file_written,
+                [changed](const QString& path) {
+                    if (may_be_supported(path)) {
+                        changed(path);
+                    }
+                });
+
+            QObject::connect(&m_collection_watcher, &directory_watcher::file_removed,
+                [this](const QString& path) {
+                    m_changed_paths.remove(path);
+                    if (m_index.erase(path)) {
+                        mark_changed();
+                    }
+                });
+
+            QObject::connect(&m_collection_watcher, &directory_watcher::directory_added,
+                [this, changed](const QString& path) {
+                    auto missing_paths = QStringList{};
+                    for (const auto& found_path :
+                         find_images({path}, m_options.worker_count, missing_paths)) {
+                        changed(found_path);
+                    }
+                });
+
+            QObject::connect(&m_collection_watcher, &directory_watcher::directory_removed,
+                [this](const QString& path) {
+                    m_index.erase_within(path);
+                    mark_changed();
+                });
+
+            QObject::connect(&m_collection_watcher, &directory_watcher::events_lost,
+                [this] { rescan(); });
+
+            QObject::connect(&m_inbox_watcher, &directory_watcher::file_written,
+                [this](const QString& path) {
+                    if (may_be_supported(path)) {
+                        m_input_paths.insert(path);
+                        m_change_timer.start();
+                    }
+                });
+
+            QObject::connect(&m_inbox_watcher, &directory_watcher::file_removed,
+                [this](const QString& path) { m_input_paths.remove(path); });
+
+            QObject::connect(&m_inbox_watcher, &directory_watcher::events_lost, [this] {
+                auto missing_paths = QStringList{};
+                for (const auto& path :
+                     find_images({m_inbox_path}, m_options.worker_count, missing_paths)) {
+                    m_input_paths.insert(path);
+                }
+
+                m_change_timer.start();
+            });
+        }
+
+        bool collection_daemon::start() {
+
+            const auto start_time = std::chrono::steady_clock::now();
+
+            // Watches are set up before the collection is scanned, so that nothing changed during
+            // the scan is missed; anything reported twice as a result is simply indexed again.
+
+            if (!m_collection_watcher.watch(m_options.collection_path)) {
+                std::fprintf(stderr, "Could not watch %s\n", qPrintable(m_options.collection_path));
+                return false;
+            }
+
+            if (!m_inbox_watcher.watch(m_inbox_path)) {
+                std::fprintf(stderr, "Could not watch %s\n", qPrintable(m_inbox_path));
+                return false;
+            }
+
+            rescan();
+            save_snapshot();
+
+            const auto elapsed = std::chrono::duration<double, std::milli>{
+                std::chrono::steady_clock::now() - start_time};
+
+            report(QJsonObject{
+                {QStringLiteral("event"), QStringLiteral("ready")},
+                {QStringLiteral("collection"), m_options.collection_path},
+                {QStringLiteral("images"), static_cast<double>(m_index.size())},
+                {QStringLiteral("elapsed_ms"), elapsed.count()}});
+
+            // Anything already waiting in the inbox is merged as though it had just arrived.
+
+            auto missing_paths = QStringList{};
+            for (const auto& path :
+                 find_images({m_inbox_path}, m_options.worker_count, missing_paths)) {
+                m_input_paths.insert(path);
+            }
+
+            if (!m_input_paths.isEmpty()) {
+                m_change_timer.start();
+            }
+
+            return true;
+        }
+
+        void collection_daemon::save_snapshot() {
+
+            if (!m_changed) {
+                return;
+            }
+
+            // The images hashed since the last snapshot were given to the cache by index(), with
+            // the metadata found before they were read; the rest are either already in it or
+            // have been removed. Entries are only written for the former, since metadata found
+            // now might belong to a version of a file written since it was hashed.
+
+            try {
+                m_cache.save(m_rescanned);
+            } catch (const file_io_error& error) {
+                std::fprintf(stderr, "Could not write %s\n", error.what());
+            }
+
+            m_changed = false;
+            m_rescanned = false;
+            m_snapshot_timer.stop();
+        }
+
+        std::vector<hashed_image> collection_daemon::hash(const QStringList& paths) {
+
+            const auto count = gsl::narrow_cast<std::size_t>(paths.size());
+            auto result = std::vector<hashed_image>(count);
+
+            parallel_for(count, m_options.worker_count, [this, &paths, &result](const auto index) {
+
+                const auto& path = paths[gsl::narrow_cast<int>(index)];
+                auto& item = result[index];
+
+                const auto file_info = QFileInfo{path};
+                item.info = m_cache.find(file_info);
+                item.cached = item.info.has_value();
+                if (!item.cached) {
+                    try {
+                        item.info.emplace(file_info, m_options.variant);
+                    } catch (const file_io_error&) {
+                    }
+                }
+            });
+
+            return result;
+        }
+
+        void collection_daemon::index(const QStringList& paths) {
+
+            auto results = hash(paths);
+            for (auto index = 0; index < paths.size(); ++index) {
+
+                auto& item = results[gsl::narrow_cast<std::size_t>(index)];
+                if (item.info) {
+                    m_index.insert(*item.info);
+                    if (!item.cached) {
+                        m_cache.insert(*item.info);
+                        mark_changed();
+                    }
+                } else {
+                    const auto path = QFileInfo{paths[index]}.absoluteFilePath();
+                    if (m_index.erase(path)) {
+                        mark_changed();
+                    }
+
+                    if (QFileInfo::exists(path)) {
+                        report_unreadable(path);
+                    }
+                }
+            }
+        }
+
+        void collection_daemon::rescan() {
+
+            auto missing_paths = QStringList{};
+            const auto paths =
+                find_images({m_options.collection_path}, m_options.worker_count, missing_paths);
+
+            index(paths);
+            m_rescanned = true;
+
+            // Whatever the index holds that the scan didn't find has been removed from disk.
+
+            auto found_paths = QSet<QString>{};
+            for (const auto& path : paths) {
+                found_paths.insert(path);
+            }
+
+            auto removed_paths = QStringList{};
+            const auto& images = m_index.images();
+            for (const auto item : images.handles()) {
+                if (!found_paths.contains(images.path(item))) {
+                    removed_paths.push_back(images.path(item));
+                }
+            }
+
+            for (const auto& path : removed_paths) {
+                m_index.erase(path);
+                mark_changed();
+            }
+        }
+
+        void collection_daemon::process_changes() {
+
+            if (m_changed_paths.isEmpty()) {
+                return;
+            }
+
+            auto paths = QStringList{};
+            for (const auto& path : m_changed_paths) {
+                paths.push_back(path);
+            }
+
+            m_changed_paths.clear();
+            index(paths);
+        }
+
+        void collection_daemon::merge_inputs() {
+
+            if (m_input_paths.isEmpty()) {
+                return;
+            }
+
+            auto paths = QStringList{};
+            for (const auto& path : m_input_paths) {
+                paths.push_back(path);
+            }
+
+            m_input_paths.clear();
+            paths.sort();
+
+            // Each input is compared with its duplicates in the collection one pair at a time,
+            // stopping once the input itself is discarded. Since no files are modified,
+            // the index is left as it is either way.
+
+            const auto results = hash(paths);
+            const auto& images = m_index.images();
+
+            for (auto index = 0; index < paths.size(); ++index) {
+
+                const auto& input = results[gsl::narrow_cast<std::size_t>(index)].info;
+                if (!input) {
+                    report_unreadable(paths[index]);
+                    continue;
+                }
+
+                auto matches = std::vector<image_set::handle>{};
+                m_index.find(input->phash(), [&matches](const image_set::handle item) {
+                    matches.push_back(item);
+                });
+
+                std::sort(std::begin(matches), std::end(matches),
+                    [&images, hash = input->phash()](const auto lhs, const auto rhs) {
+                        return hamming_distance(images.phash(lhs), hash)
+                            < hamming_distance(images.phash(rhs), hash);
+                    });
+
+                auto replaced_paths = QStringList{};
+                auto duplicate_of = QString{};
+
+                for (const auto item : matches) {
+
+                    const auto existing = images.info(item);
+                    const auto choice = engine::decide(m_options.policy, *input, existing);
+
+                    if (choice == discard_choice::lhs) {
+                        duplicate_of = existing.path();
+                        break;
+                    }
+
+                    if (choice == discard_choice::rhs) {
+                        replaced_paths.push_back(existing.path());
+                    }
+                }
+
+                report(QJsonObject{
+                    {QStringLiteral("event"), QStringLiteral("input")},
+                    {QStringLiteral("path"), input->path()},
+                    {QStringLiteral("discarded"), !duplicate_of.isEmpty()},
+                    {QStringLiteral("duplicate_of"), duplicate_of},
+                    {QStringLiteral("replaces"), QJsonArray::fromStringList(replaced_paths)}});
+            }
+        }
+
+        void collection_daemon::mark_changed() {
+            m_changed = true;
+            if (!m_snapshot_timer.isActive()) {
+                m_snapshot_timer.start();
+            }
+        }
+
+        ///
+        /// Blocks \c SIGINT and \c SIGTERM for the whole process and returns a descriptor from
+        /// which they may instead be read, so that they can be handled by the event loop. This
+        /// must be called before any other threads are started, so that they inherit the mask.
+        ///
+
+        int block_stop_signals() {
+
+            auto signals = sigset_t{};
+            ::sigemptyset(&signals);
+            ::sigaddset(&signals, SIGINT);
+            ::sigaddset(&signals, SIGTERM);
+
+            if (::pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) {
+                return -1;
+            }
+
+            return ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        }
+    }
+
+    int run_daemon(int argc, char** argv) {
+
+        const auto signal_fd = block_stop_signals();
+        if (signal_fd < 0) {
+            std::fprintf(stderr, "Could not handle stop signals\n");
+            return 1;
+        }
+
+        const auto close_signal_fd = gsl::finally([signal_fd] { ::close(signal_fd); });
+
+        QCoreApplication app{argc, argv};
+
+        auto parser = QCommandLineParser{};
+        parser.setApplicationDescription(QStringLiteral(
+            "Keeps a collection indexed in memory, and merges each image placed in the inbox "
+            "directory with it, writing one line of JSON per event. No files are modified."));
+        parser.addHelpOption();
+
+        const auto daemon_option = QCommandLineOption{QStringLiteral("daemon"),
+            QStringLiteral("Run as a daemon.")};
+
+        const auto inbox_option = QCommandLineOption{QStringLiteral("inbox"),
+            QStringLiteral("Merge images as they arrive in <dir>, which must not be within the "
+                "collection."), QStringLiteral("dir")};
+
+        auto options = merge_options{};
+        options.add_to(parser);
+        parser.addOptions({daemon_option, inbox_option});
+        parser.process(app);
+
+        if (!options.read(parser)) {
+            return 2;
+        }
+
+        const auto inbox_path =
+            QDir::cleanPath(QFileInfo{parser.value(inbox_option)}.absoluteFilePath());
+
+        if (!parser.isSet(inbox_option) || !QFileInfo{inbox_path}.isDir()) {
+            std::fprintf(stderr, "An inbox directory must be given with --inbox\n");
+            return 2;
+        }
+
+        const auto collection_path = QDir::cleanPath(options.collection_path);
+        if (inbox_path == collection_path || inbox_path.startsWith(collection_path + '/')) {
+            std::fprintf(stderr, "The inbox must not be within the collection\n");
+            return 2;
+        }
+
+        QSocketNotifier stop_notifier{signal_fd, QSocketNotifier::Read};
+        QObject::connect(&stop_notifier, SIGNAL(activated(int)), &app, SLOT(quit()));
+
+        auto daemon = collection_daemon{options, inbox_path};
+        if (!daemon.start()) {
+            return 1;
+        }
+
+        app.exec();
+        daemon.save_snapshot();
+        return 0;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef MYRIAD_DAEMON_HPP
+#define MYRIAD_DAEMON_HPP
+
+namespace myriad {
+
+    ///
+    /// Runs Myriad as a long-lived process, as described by the command line given by \p argc and
+    /// \p argv, and returns the process exit status once it is stopped by \c SIGINT or \c SIGTERM.
+    /// The collection is indexed in memory and kept up to date as its files change, so that each
+    /// image that arrives in the inbox directory is merged with it in time proportional to the
+    /// number of its duplicates, rather than to the size of the collection. Hashes are saved to
+    /// the collection's \ref hash_cache (shortly after changes, and before exiting), and only
+    /// images that have changed since are read again when the daemon is restarted.
+    ///
+    /// Each event (the daemon becoming ready, an input being merged, an image proving unreadable)
+    /// is written to the standard output as a single line of JSON. As in batch mode, files are
+    /// never modified.
+    ///
+
+    int run_daemon(int argc, char** argv);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include "decision_queue.hpp"
+#include "parallel.hpp"
+
+#include "gsl/gsl"
+
+#include <chrono>
+#include <utility>
+
+using namespace std::literals::chrono_literals;
+
+namespace myriad {
+
+    std::uint64_t decision_queue::post(const std::size_t tag, const QStringList& paths) {
+
+        const auto lock = std::lock_guard<std::mutex>{m_mutex};
+        const auto ticket = m_next_ticket++;
+        m_pending.emplace(ticket, decision{ticket, tag, paths, std::nullopt});
+        return ticket;
+    }
+
+    bool decision_queue::make(const std::uint64_t ticket, const keep_choice choice) {
+
+        {
+            const auto lock = std::lock_guard<std::mutex>{m_mutex};
+
+            const auto iter = m_pending.find(ticket);
+            if (iter == std::end(m_pending)) {
+                return false;
+            }
+
+            const auto group_size = gsl::narrow_cast<std::size_t>(iter->second.paths.size());
+            if (choice && *choice >= group_size) {
+                return false;
+            }
+
+            iter->second.choice = choice;
+            m_decisions.push_back(std::move(iter->second));
+            m_pending.erase(iter);
+        }
+
+        m_made.notify_all();
+        return true;
+    }
+
+    std::vector<decision> decision_queue::take(const bool block) {
+
+        auto lock = std::unique_lock<std::mutex>{m_mutex};
+
+        // Interruption can't be signalled through the condition variable, so it is polled for;
+        // the interval only bounds how long an interrupted merge takes to notice.
+
+        while (block && m_decisions.empty() && !thread_interrupted()) {
+            m_made.wait_for(lock, 50ms);
+        }
+
+        return std::exchange(m_decisions, {});
+    }
+
+    void decision_queue::clear() {
+        const auto lock = std::lock_guard<std::mutex>{m_mutex};
+        m_pending.clear();
+        m_decisions.clear();
+    }
+}
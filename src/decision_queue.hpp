@@ -0,0 +1,82 @@
+#ifndef MYRIAD_DECISION_QUEUE_HPP
+#define MYRIAD_DECISION_QUEUE_HPP
+
+#include "pairer.hpp"
+
+#include <QStringList>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// A decision between a group of duplicate images that has been made: the ticket under which
+    /// it was posted, the tag given to it by the poster, the paths of the images in the group,
+    /// and the image to keep.
+    ///
+
+    struct decision {
+        std::uint64_t ticket;
+        std::size_t tag;
+        QStringList paths;
+        keep_choice choice;
+    };
+
+    ///
+    /// Carries decisions between groups of duplicate images from the thread comparing them to
+    /// whichever thread (usually the user interface's) is deciding, and back. Decisions are posted
+    /// one at a time and may be made in any order; the thread that posted them collects those
+    /// that have been made in batches, so that it can go on comparing the images unaffected by
+    /// the decisions still pending instead of waiting for each one in turn.
+    ///
+
+    class decision_queue {
+    public:
+
+        ///
+        /// Posts a decision between the images at the filesystem paths \p paths, returning a
+        /// ticket by which it can be made. Tickets are never reused by a queue, so a decision
+        /// made against a ticket from an earlier operation is simply ignored.
+        ///
+
+        std::uint64_t post(std::size_t tag, const QStringList& paths);
+
+        ///
+        /// Makes the pending decision with the ticket \p ticket. Returns \c false, leaving the
+        /// decision pending, if there is no such decision pending or \p choice is not the index of
+        /// one of the images it was posted with. May be called from any thread.
+        ///
+
+        bool make(std::uint64_t ticket, keep_choice choice);
+
+        ///
+        /// Removes and returns the decisions that have been made since this was last called. If
+        /// \p block is \c true and none have, this waits until one is made or an interruption is
+        /// requested on the calling thread.
+        ///
+
+        std::vector<decision> take(bool block);
+
+        ///
+        /// Forgets every decision, whether pending or made, so that any later attempt to make one
+        /// of them is ignored.
+        ///
+
+        void clear();
+
+    private:
+
+        std::mutex m_mutex;
+        std::condition_variable m_made;
+        std::unordered_map<std::uint64_t, decision> m_pending;
+        std::vector<decision> m_decisions;
+        std::uint64_t m_next_ticket = 1;
+    };
+}
+
+#endif
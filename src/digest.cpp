@@ -0,0 +1,161 @@
+#include "digest.hpp"
+#include "exception.hpp"
+
+#include <QFileDevice>
+#include <QtEndian>
+
+#include <cstring>
+#include <vector>
+
+namespace myriad {
+
+    namespace {
+
+        constexpr auto prime_1 = std::uint64_t{0x9E3779B185EBCA87};
+        constexpr auto prime_2 = std::uint64_t{0xC2B2AE3D27D4EB4F};
+        constexpr auto prime_3 = std::uint64_t{0x165667B19E3779F9};
+        constexpr auto prime_4 = std::uint64_t{0x85EBCA77C2B2AE63};
+        constexpr auto prime_5 = std::uint64_t{0x27D4EB2F165667C5};
+
+        constexpr std::uint64_t rotate_left(const std::uint64_t value, const int count) {
+            return (value << count) | (value >> (64 - count));
+        }
+
+        std::uint64_t read_64(const unsigned char* const data) {
+            return qFromLittleEndian<std::uint64_t>(data);
+        }
+
+        std::uint32_t read_32(const unsigned char* const data) {
+            return qFromLittleEndian<std::uint32_t>(data);
+        }
+
+        std::uint64_t round(std::uint64_t lane, const std::uint64_t input) {
+            lane += input * prime_2;
+            lane = rotate_left(lane, 31);
+            return lane * prime_1;
+        }
+
+        std::uint64_t merge_round(std::uint64_t hash, const std::uint64_t lane) {
+            hash ^= round(0, lane);
+            return hash * prime_1 + prime_4;
+        }
+
+        ///
+        /// Consumes as many whole 32-byte stripes as possible from the \p size bytes starting at
+        /// \p data, returning the number of bytes consumed.
+        ///
+
+        std::size_t consume_stripes(
+            std::array<std::uint64_t, 4>& lanes, const unsigned char* const data,
+            const std::size_t size) {
+
+            auto offset = std::size_t{0};
+            for (; size - offset >= 32; offset += 32) {
+                for (auto i = 0; i < 4; ++i) {
+                    lanes[i] = round(lanes[i], read_64(data + offset + 8 * i));
+                }
+            }
+
+            return offset;
+        }
+    }
+
+    digest::digest(const std::uint64_t seed)
+      : m_seed{seed},
+        m_lanes{{seed + prime_1 + prime_2, seed + prime_2, seed, seed - prime_1}} {
+    }
+
+    void digest::update(const void* const data, const std::size_t size) {
+
+        auto input = static_cast<const unsigned char*>(data);
+        auto remaining = size;
+        m_total_size += size;
+
+        if (m_buffered_size + remaining < stripe_size) {
+            std::memcpy(m_buffer.data() + m_buffered_size, input, remaining);
+            m_buffered_size += remaining;
+            return;
+        }
+
+        if (m_buffered_size > 0) {
+            const auto fill_size = stripe_size - m_buffered_size;
+            std::memcpy(m_buffer.data() + m_buffered_size, input, fill_size);
+            consume_stripes(m_lanes, m_buffer.data(), stripe_size);
+
+            input += fill_size;
+            remaining -= fill_size;
+            m_buffered_size = 0;
+        }
+
+        const auto consumed = consume_stripes(m_lanes, input, remaining);
+        std::memcpy(m_buffer.data(), input + consumed, remaining - consumed);
+        m_buffered_size = remaining - consumed;
+    }
+
+    std::uint64_t digest::value() const {
+
+        auto result = std::uint64_t{};
+        if (m_total_size >= stripe_size) {
+            result = rotate_left(m_lanes[0], 1) + rotate_left(m_lanes[1], 7)
+                + rotate_left(m_lanes[2], 12) + rotate_left(m_lanes[3], 18);
+
+            for (const auto lane : m_lanes) {
+                result = merge_round(result, lane);
+            }
+        } else {
+            result = m_seed + prime_5;
+        }
+
+        result += m_total_size;
+
+        auto offset = std::size_t{0};
+        for (; m_buffered_size - offset >= 8; offset += 8) {
+            result ^= round(0, read_64(m_buffer.data() + offset));
+            result = rotate_left(result, 27) * prime_1 + prime_4;
+        }
+
+        if (m_buffered_size - offset >= 4) {
+            result ^= read_32(m_buffer.data() + offset) * prime_1;
+            result = rotate_left(result, 23) * prime_2 + prime_3;
+            offset += 4;
+        }
+
+        for (; offset < m_buffered_size; ++offset) {
+            result ^= m_buffer[offset] * prime_5;
+            result = rotate_left(result, 11) * prime_1;
+        }
+
+        result ^= result >> 33;
+        result *= prime_2;
+        result ^= result >> 29;
+        result *= prime_3;
+        result ^= result >> 32;
+        return result;
+    }
+
+    std::uint64_t digest_of(const void* const data, const std::size_t size) {
+        auto result = digest{};
+        result.update(data, size);
+        return result.value();
+    }
+
+    std::uint64_t digest_of(QFileDevice& file) {
+
+        constexpr auto chunk_size = qint64{1} << 20;
+        auto chunk = std::vector<char>(chunk_size);
+        auto result = digest{};
+
+        for (;;) {
+            const auto size = file.read(chunk.data(), chunk_size);
+            if (size < 0) {
+                throw file_io_error{file.fileName()};
+            }
+
+            if (size == 0) {
+                return result.value();
+            }
+
+            result.update(chunk.data(), static_cast<std::size_t>(size));
+        }
+    }
+}
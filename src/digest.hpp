@@ -0,0 +1,64 @@
+#ifndef MYRIAD_DIGEST_HPP
+#define MYRIAD_DIGEST_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class QFileDevice;
+
+namespace myriad {
+
+    ///
+    /// Computes the 64-bit xxHash (XXH64) digest of a sequence of bytes supplied in pieces of any
+    /// size, so that the contents of a file can be digested without ever being held in memory in
+    /// their entirety. XXH64 is not cryptographic, but its collisions are rare enough in practice
+    /// (unlike those of the 16-bit CRC previously used by Myriad) that files with equal digests
+    /// can be taken to be byte-for-byte identical, and it runs at close to memory bandwidth.
+    ///
+
+    class digest {
+    public:
+
+        explicit digest(std::uint64_t seed = 0);
+
+        ///
+        /// Appends the \p size bytes starting at \p data to the sequence being digested.
+        ///
+
+        void update(const void* data, std::size_t size);
+
+        ///
+        /// Calculates the digest of the bytes supplied so far. More bytes may still be supplied
+        /// afterwards.
+        ///
+
+        std::uint64_t value() const;
+
+    private:
+
+        static constexpr auto stripe_size = std::size_t{32};
+
+        std::uint64_t m_seed;
+        std::uint64_t m_total_size = 0;
+        std::array<std::uint64_t, 4> m_lanes;
+        std::array<unsigned char, stripe_size> m_buffer;
+        std::size_t m_buffered_size = 0;
+    };
+
+    ///
+    /// Computes the digest of the \p size bytes starting at \p data in a single call.
+    ///
+
+    std::uint64_t digest_of(const void* data, std::size_t size);
+
+    ///
+    /// Computes the digest of everything that remains to be read from \p file, reading it in
+    /// chunks of fixed size.
+    /// \throws file_io_error if \p file could not be read.
+    ///
+
+    std::uint64_t digest_of(QFileDevice& file);
+}
+
+#endif
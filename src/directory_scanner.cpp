@@ -0,0 +1,323 @@
+#include "directory_scanner.hpp"
+#include "parallel.hpp"
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std::literals::chrono_literals;
+
+namespace myriad {
+
+    namespace {
+
+        ///
+        /// The layout of the records returned by the \c getdents64 system call, which glibc only
+        /// began to declare (and wrap) in version 2.30.
+        ///
+
+        struct dirent64_record {
+            std::uint64_t d_ino;
+            std::int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[1];
+        };
+
+        ///
+        /// Owns a POSIX file descriptor, closing it on destruction.
+        ///
+
+        class file_descriptor {
+        public:
+
+            explicit file_descriptor(const int fd)
+              : m_fd{fd} {
+            }
+
+            file_descriptor(const file_descriptor&) = delete;
+            file_descriptor& operator=(const file_descriptor&) = delete;
+
+            ~file_descriptor() {
+                if (m_fd >= 0) {
+                    ::close(m_fd);
+                }
+            }
+
+            int get() const {
+                return m_fd;
+            }
+
+        private:
+            int m_fd;
+        };
+
+        enum class entry_kind { other, file, directory };
+
+        ///
+        /// Determines whether the entry \p name of the open directory \p dir_fd is a file or a
+        /// directory, from \p d_type where the filesystem reports it and by following the entry
+        /// with \c fstatat otherwise.
+        ///
+
+        entry_kind kind_of(const int dir_fd, const char* const name, const unsigned char d_type) {
+
+            switch (d_type) {
+                case DT_REG:
+                    return entry_kind::file;
+
+                case DT_DIR:
+                    return entry_kind::directory;
+
+                case DT_LNK:
+                case DT_UNKNOWN:
+                    break;
+
+                default:
+                    return entry_kind::other;
+            }
+
+            struct stat status;
+            if (::fstatat(dir_fd, name, &status, 0) != 0) {
+                return entry_kind::other;
+            }
+
+            if (S_ISREG(status.st_mode)) {
+                return entry_kind::file;
+            }
+
+            return S_ISDIR(status.st_mode) ? entry_kind::directory : entry_kind::other;
+        }
+
+        QByteArray child_path(const QByteArray& dir_path, const char* const name) {
+
+            auto result = dir_path;
+            if (!result.endsWith('/')) {
+                result.append('/');
+            }
+
+            result.append(name);
+            return result;
+        }
+    }
+
+    directory_scanner::directory_scanner(
+        const ksr::function_view<filter_sig> filter, const int thread_count)
+      : m_filter{filter},
+        m_thread_count{std::max(thread_count, 1)} {
+    }
+
+    bool directory_scanner::scan(
+        const QString& base_path, const ksr::function_view<found_sig> found,
+        const ksr::function_view<progress_sig> progress) const {
+
+        const auto base_info = QFileInfo{base_path};
+        if (base_info.isFile()) {
+
+            const auto path = base_info.absoluteFilePath();
+            if (!m_filter(path)) {
+                return true;
+            }
+
+            progress(1, 0);
+            return found(path);
+        }
+
+        if (!base_info.isDir()) {
+            return true;
+        }
+
+        // Workers take directories from the top of a shared stack, so that the tree is walked
+        // roughly depth-first and the stack stays small, and hand back the paths of the files
+        // they accept in batches for the calling thread to pass on. The scan is complete once the
+        // stack is empty and no worker is still reading a directory that might add to it.
+
+        auto mutex = std::mutex{};
+        auto work_changed = std::condition_variable{};
+        auto results_changed = std::condition_variable{};
+
+        const auto base_dir = QFile::encodeName(base_info.absoluteFilePath());
+
+        auto pending_dirs = std::vector<QByteArray>{base_dir};
+        auto visited_dirs = std::set<std::pair<dev_t, ino_t>>{};
+        auto busy_count = 0;
+        auto stopped = false;
+
+        auto found_paths = std::vector<QString>{};
+        auto file_count = 0;
+        auto folder_count = 0;
+
+        const auto finished = [&pending_dirs, &busy_count] {
+            return pending_dirs.empty() && busy_count == 0;
+        };
+
+        const auto read_dir = [this, &mutex, &visited_dirs](
+            const QByteArray& dir_path, std::vector<char>& buffer,
+            std::vector<QByteArray>& subdirs, std::vector<QString>& files) {
+
+            const auto dir = file_descriptor{
+                ::open(dir_path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+
+            struct stat status;
+            if (dir.get() < 0 || ::fstat(dir.get(), &status) != 0) {
+                return false;
+            }
+
+            {
+                const auto lock = std::lock_guard<std::mutex>{mutex};
+                if (!visited_dirs.emplace(status.st_dev, status.st_ino).second) {
+                    return false;
+                }
+            }
+
+            for (;;) {
+
+                const auto size =
+                    ::syscall(SYS_getdents64, dir.get(), buffer.data(), buffer.size());
+                if (size <= 0) {
+                    break;
+                }
+
+                for (auto offset = long{0}; offset < size;) {
+
+                    const auto record = reinterpret_cast<const dirent64_record*>(&buffer[offset]);
+                    offset += record->d_reclen;
+
+                    const auto name = static_cast<const char*>(record->d_name);
+                    if (name[0] == '.') {
+                        continue;
+                    }
+
+                    switch (kind_of(dir.get(), name, record->d_type)) {
+                        case entry_kind::file: {
+                            auto path = QFile::decodeName(child_path(dir_path, name));
+                            if (m_filter(path)) {
+                                files.push_back(std::move(path));
+                            }
+                            break;
+                        }
+
+                        case entry_kind::directory:
+                            subdirs.push_back(child_path(dir_path, name));
+                            break;
+
+                        case entry_kind::other:
+                            break;
+                    }
+                }
+            }
+
+            return true;
+        };
+
+        const auto work = [&] {
+
+            constexpr auto buffer_size = std::size_t{64} * 1024;
+            auto buffer = std::vector<char>(buffer_size);
+            auto subdirs = std::vector<QByteArray>{};
+            auto files = std::vector<QString>{};
+
+            auto lock = std::unique_lock<std::mutex>{mutex};
+            for (;;) {
+
+                work_changed.wait(lock, [&] {
+                    return stopped || !pending_dirs.empty() || finished();
+                });
+
+                if (stopped || finished()) {
+                    return;
+                }
+
+                const auto dir_path = std::move(pending_dirs.back());
+                pending_dirs.pop_back();
+                ++busy_count;
+
+                lock.unlock();
+                const auto scanned = read_dir(dir_path, buffer, subdirs, files);
+                lock.lock();
+
+                --busy_count;
+                folder_count += scanned ? 1 : 0;
+                file_count += gsl::narrow_cast<int>(files.size());
+
+                std::move(std::begin(subdirs), std::end(subdirs), std::back_inserter(pending_dirs));
+                std::move(std::begin(files), std::end(files), std::back_inserter(found_paths));
+                subdirs.clear();
+                files.clear();
+
+                work_changed.notify_all();
+                results_changed.notify_one();
+            }
+        };
+
+        auto workers = std::vector<std::thread>{};
+        for (auto i = 0; i < m_thread_count; ++i) {
+            workers.emplace_back(work);
+        }
+
+        // The calling thread wakes whenever a worker finishes a directory, and otherwise at
+        // regular intervals, so that interruptions are noticed even while a slow directory is
+        // being read.
+
+        auto batch = std::vector<QString>{};
+        auto complete = false;
+
+        while (!complete && !stopped) {
+
+            auto batch_file_count = 0;
+            auto batch_folder_count = 0;
+            {
+                auto lock = std::unique_lock<std::mutex>{mutex};
+                results_changed.wait_for(lock, 20ms, [&] {
+                    return !found_paths.empty() || finished();
+                });
+
+                batch.swap(found_paths);
+                batch_file_count = file_count;
+                batch_folder_count = folder_count;
+                complete = finished();
+            }
+
+            auto keep_going = !thread_interrupted();
+            for (auto iter = std::begin(batch); keep_going && iter != std::end(batch); ++iter) {
+                keep_going = found(*iter);
+            }
+
+            batch.clear();
+            progress(batch_file_count, batch_folder_count);
+
+            if (!keep_going) {
+                const auto lock = std::lock_guard<std::mutex>{mutex};
+                stopped = true;
+                work_changed.notify_all();
+            }
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        return !stopped;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef MYRIAD_DIRECTORY_SCANNER_HPP
+#define MYRIAD_DIRECTORY_SCANNER_HPP
+
+#include "ksr/function_view.hpp"
+
+class QString;
+
+namespace myriad {
+
+    ///
+    /// Finds the files within a directory tree that satisfy a filter, reading directories on
+    /// several threads at once. This matters most for network filesystems, where the latency of
+    /// each directory listing dominates the time taken by the scan.
+    ///
+    /// Directories are read with \c getdents64 rather than through \c QDir, and the entry types
+    /// reported by the filesystem are used to tell files from directories, so no entry is
+    /// examined with \c stat unless it is a symbolic link or its filesystem does not report entry
+    /// types. Directories still waiting to be read are kept on a shared stack rather than the
+    /// call stack, so trees of any depth may be scanned. Like \c QDir with its default filters,
+    /// the scan skips hidden entries and follows symbolic links; each directory is only read once,
+    /// so links that form cycles are harmless.
+    ///
+
+    class directory_scanner {
+    public:
+
+        using filter_sig = bool(const QString& path);
+        using found_sig = bool(const QString& path);
+        using progress_sig = void(int file_count, int folder_count);
+
+        ///
+        /// Creates a scanner that reads directories on \p thread_count threads and passes the
+        /// path of each file it finds to \p filter. \p filter is called concurrently from all of
+        /// those threads, and must remain valid for as long as the scanner does.
+        ///
+
+        explicit directory_scanner(ksr::function_view<filter_sig> filter, int thread_count);
+
+        ///
+        /// Scans the tree rooted at the filesystem path \p base_path (which may also be the path
+        /// of a single file), calling \p found with the absolute path of each file accepted by the
+        /// filter, in an unspecified order. \p progress is periodically called with the number of
+        /// accepted files and scanned directories so far. Both callbacks are only ever called from
+        /// the calling thread. The scan stops early if \p found returns \c false or an
+        /// interruption is requested on the calling thread, in which case \c false is returned;
+        /// otherwise, \c true is returned.
+        ///
+
+        bool scan(
+            const QString& base_path, ksr::function_view<found_sig> found,
+            ksr::function_view<progress_sig> progress) const;
+
+    private:
+        ksr::function_view<filter_sig> m_filter;
+        int m_thread_count;
+    };
+}
+
+#endif
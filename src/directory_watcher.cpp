@@ -0,0 +1,160 @@
+#include "directory_watcher.hpp"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace myriad {
+
+    namespace {
+
+        constexpr auto watch_mask = std::uint32_t{
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR};
+
+        bool hidden(const QString& name) {
+            return name.startsWith(QChar{'.'});
+        }
+    }
+
+    directory_watcher::directory_watcher(QObject* const parent)
+      : QObject{parent},
+        m_fd{::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)} {
+
+        if (m_fd >= 0) {
+            m_notifier = new QSocketNotifier{m_fd, QSocketNotifier::Read, this};
+            connect(m_notifier, SIGNAL(activated(int)), this, SLOT(read_events()));
+        }
+    }
+
+    directory_watcher::~directory_watcher() {
+
+        // The notifier must stop watching the descriptor before it is closed.
+
+        delete m_notifier;
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    bool directory_watcher::watch(const QString& dir_path) {
+
+        const auto path = QDir::cleanPath(dir_path);
+        if (m_fd < 0 || !add_watch(path)) {
+            return false;
+        }
+
+        add_watches(path);
+        return true;
+    }
+
+    bool directory_watcher::add_watch(const QString& dir_path) {
+
+        const auto wd = ::inotify_add_watch(
+            m_fd, QFile::encodeName(dir_path).constData(), watch_mask);
+
+        if (wd < 0) {
+            return false;
+        }
+
+        m_paths.insert(wd, dir_path);
+        m_watches.insert(dir_path, wd);
+        return true;
+    }
+
+    void directory_watcher::add_watches(const QString& dir_path) {
+
+        // Directories created within dir_path before it was watched produced no events, but are
+        // found here, and their contents scanned along with the rest of dir_path by the recipient
+        // of directory_added().
+
+        auto iter = QDirIterator{dir_path, QDir::Dirs | QDir::NoDotAndDotDot,
+            QDirIterator::Subdirectories | QDirIterator::FollowSymlinks};
+
+        while (iter.hasNext()) {
+            add_watch(iter.next());
+        }
+    }
+
+    void directory_watcher::remove_watches(const QString& dir_path) {
+
+        const auto prefix = dir_path + QChar{'/'};
+
+        // Directories that were deleted have already lost their watches, in which case this
+        // fails harmlessly; directories that were moved elsewhere still need theirs removed.
+
+        for (auto iter = m_watches.begin(); iter != m_watches.end();) {
+            if (iter.key() == dir_path || iter.key().startsWith(prefix)) {
+                ::inotify_rm_watch(m_fd, iter.value());
+                m_paths.remove(iter.value());
+                iter = m_watches.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+
+    void directory_watcher::read_events() {
+
+        alignas(inotify_event) auto buffer = std::array<char, 64 * 1024>{};
+
+        for (auto length = ::read(m_fd, buffer.data(), buffer.size()); length > 0;
+             length = ::read(m_fd, buffer.data(), buffer.size())) {
+
+            for (auto offset = std::size_t{0}; offset < static_cast<std::size_t>(length);) {
+
+                const auto event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                if ((event->mask & IN_Q_OVERFLOW) != 0) {
+                    Q_EMIT events_lost();
+                    continue;
+                }
+
+                if ((event->mask & IN_IGNORED) != 0) {
+                    m_watches.remove(m_paths.value(event->wd));
+                    m_paths.remove(event->wd);
+                    continue;
+                }
+
+                const auto dir_path = m_paths.value(event->wd);
+                if (dir_path.isEmpty() || event->len == 0) {
+                    continue;
+                }
+
+                const auto name = QFile::decodeName(event->name);
+                if (hidden(name)) {
+                    continue;
+                }
+
+                const auto path = dir_path + QChar{'/'} + name;
+                const auto added = (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+                const auto removed = (event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+
+                if ((event->mask & IN_ISDIR) != 0) {
+                    if (added) {
+                        if (add_watch(path)) {
+                            add_watches(path);
+                        }
+
+                        Q_EMIT directory_added(path);
+                    } else if (removed) {
+                        remove_watches(path);
+                        Q_EMIT directory_removed(path);
+                    }
+                } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0) {
+                    Q_EMIT file_written(path);
+                } else if (removed) {
+                    Q_EMIT file_removed(path);
+                }
+            }
+        }
+    }
+}
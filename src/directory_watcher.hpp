@@ -0,0 +1,83 @@
+#ifndef MYRIAD_DIRECTORY_WATCHER_HPP
+#define MYRIAD_DIRECTORY_WATCHER_HPP
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+
+class QSocketNotifier;
+
+namespace myriad {
+
+    ///
+    /// Reports changes to the files within a directory tree as they happen, using Linux's inotify
+    /// interface. Each directory in the tree is watched individually; directories created within
+    /// the tree (or moved into it) are watched as soon as they are reported, and those removed
+    /// from it are forgotten. Like a \ref directory_scanner, the watcher ignores hidden entries.
+    ///
+    /// Files are reported once they have been closed after writing or moved into the tree, rather
+    /// than as soon as they appear, so that files still being written are not reported early. A
+    /// file created without being written (as a hard link is) therefore goes unnoticed. Events
+    /// are read from the event loop of the thread that owns the watcher, and signals are emitted
+    /// from that thread.
+    ///
+
+    class directory_watcher : public QObject {
+        Q_OBJECT
+
+    public:
+
+        explicit directory_watcher(QObject* parent = nullptr);
+        ~directory_watcher() override;
+
+        ///
+        /// Starts watching the tree rooted at the directory at the filesystem path \p dir_path,
+        /// which must be absolute. Returns \c false if inotify is unavailable or the directory
+        /// itself could not be watched; directories within it that cannot be watched are skipped.
+        ///
+
+        bool watch(const QString& dir_path);
+
+    Q_SIGNALS:
+
+        ///
+        /// Emitted when the file at \p path has been written or moved into the tree.
+        ///
+
+        void file_written(const QString& path) const;
+        void file_removed(const QString& path) const;
+
+        ///
+        /// Emitted when the directory at \p path has been created or moved into the tree, once it
+        /// and its descendants are being watched. Files already within it are not reported
+        /// individually, so the directory should be scanned in response.
+        ///
+
+        void directory_added(const QString& path) const;
+        void directory_removed(const QString& path) const;
+
+        ///
+        /// Emitted when the kernel's queue of events overflowed, so that changes may have been
+        /// missed; the whole tree should then be scanned again.
+        ///
+
+        void events_lost() const;
+
+    private Q_SLOTS:
+
+        void read_events();
+
+    private:
+
+        bool add_watch(const QString& dir_path);
+        void add_watches(const QString& dir_path);
+        void remove_watches(const QString& dir_path);
+
+        int m_fd = -1;
+        QSocketNotifier* m_notifier = nullptr;
+        QHash<int, QString> m_paths;
+        QHash<QString, int> m_watches;
+    };
+}
+
+#endif
@@ -1,24 +1,41 @@
 #include "engine.hpp"
+#include "bounded_queue.hpp"
+#include "directory_scanner.hpp"
+#include "exception.hpp"
+#include "file_type.hpp"
+#include "hash_cache.hpp"
+#include "identical_files.hpp"
+#include "parallel.hpp"
+#include "read_ahead.hpp"
+#include "shard_file.hpp"
+#include "shard_worker.hpp"
+#include "spill_file.hpp"
 
-#include "ksr/algorithm.hpp"
-
-#include <QByteArray>
+#include <QCoreApplication>
+#include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
-#include <QImageReader>
-#include <QList>
-#include <QMimeDatabase>
+#include <QProcess>
 #include <QString>
+#include <QTemporaryDir>
 #include <QThread>
 #include <QTimer>
 
 #include "gsl/gsl"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <cmath>
+#include <cstdint>
 #include <iterator>
+#include <memory>
 #include <numeric>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace std::literals::chrono_literals;
 
@@ -26,21 +43,86 @@ namespace myriad {
 
     namespace {
 
-        const QList<QByteArray>& supported_mime_types();
+        struct hash_result {
+            QString path;
+            std::optional<image_info> info;
+            bool cached;
+            int index = 0;
+        };
+
+        ///
+        /// Looks up the image at the filesystem path \p path in \p cache, or reads the image and
+        /// computes the \p variant of its hash if it has no valid entry there, recording the work
+        /// in \p metrics if that is not null. May be called concurrently from multiple threads.
+        ///
+
+        hash_result hash_path(
+            const QString& path, hash_cache& cache, const phash_variant variant,
+            merge_metrics* const metrics) {
+
+            const auto file_info = QFileInfo{path};
+            auto result = hash_result{file_info.filePath(), cache.find(file_info), true};
+
+            if (!result.info) {
+                result.cached = false;
+                try {
+                    result.info.emplace(file_info, variant, metrics);
+                } catch (const file_io_error&) {
+                }
+            }
+
+            return result;
+        }
+
+        ///
+        /// Constructs an \ref image_info object for a file that is byte-for-byte identical to the
+        /// one described by \p original, without reading it, given the file's modification time
+        /// \p last_modified as found before it was compared with \p original.
+        ///
+
+        image_info copy_of(
+            const image_info& original, const QString& path, const QDateTime& last_modified) {
+
+            return image_info{
+                QFileInfo{path}.absoluteFilePath(), original.file_size(), last_modified,
+                original.width(), original.height(), original.format(), original.checksum(),
+                original.phash()};
+        }
 
         ///
-        /// Determines whether the file at the filesystem path \p path is an image file able to be
-        /// processed by Myriad. May only be called after the \c QApplication instance has been
-        /// created.
+        /// Determines whether the filesystem path \p path is \p base_path itself or one of its
+        /// descendants. Only the absolute forms of the paths are compared, so that this may be
+        /// decided without waiting for \p base_path to be scanned.
         ///
 
-        bool file_supported(const QString& path) {
+        bool path_within(const QString& path, const QString& base_path) {
+
+            auto base = QDir::cleanPath(QFileInfo{base_path}.absoluteFilePath());
+            const auto target = QDir::cleanPath(QFileInfo{path}.absoluteFilePath());
 
-            const QMimeDatabase mime_db;
-            const auto mime_name = mime_db.mimeTypeForFile(path).name();
+            if (target == base) {
+                return true;
+            }
+
+            if (!base.endsWith(QChar{'/'})) {
+                base.append(QChar{'/'});
+            }
 
-            const auto& supported = supported_mime_types();
-            return supported.contains(mime_name.toLatin1());
+            return target.startsWith(base);
+        }
+
+        ///
+        /// Ranks \p info by the criteria of \p policy, such that of two images, the one with the
+        /// greater rank should be kept.
+        ///
+
+        std::pair<std::uint64_t, std::uint64_t> keep_rank(
+            const engine::keep_policy policy, const image_info& info) {
+
+            const auto area = std::uint64_t(info.width()) * std::uint64_t(info.height());
+            return (policy == engine::keep_policy::larger_file)
+                ? std::pair{info.file_size(), area}
+                : std::pair{area, info.file_size()};
         }
 
         int int_percentage(const int num, const int denom) {
@@ -49,67 +131,518 @@ namespace myriad {
         }
 
         ///
-        /// Gets a list of all image MIME types that Myriad is able to process. May only be called
-        /// after the \c QApplication instance has been created.
+        /// Calculates the smallest count out of \p denom for which int_percentage() would give
+        /// more than \p percent, give or take the rounding of the floating-point calculation.
+        ///
+
+        int next_percentage_count(const int percent, const int denom) {
+            const auto num = std::int64_t{2 * percent + 1} * denom;
+            return gsl::narrow_cast<int>((num + 199) / 200);
+        }
+
+        ///
+        /// Estimates how many collection images may be hashed, or read back from an
+        /// \ref image_spill, at once without a merge exceeding \p memory_limit bytes, when each
+        /// of \p image_count images in the collection keeps its hash and offset resident (and
+        /// needs as much again while the comparison is planned). Allowing a kilobyte for each
+        /// image in a chunk covers its record and path in an \ref image_set, its pending hash
+        /// result and the cache entry it may add, with a margin for the rest of the process.
         ///
 
-        const QList<QByteArray>& supported_mime_types() {
-            static auto result = QImageReader::supportedMimeTypes();
+        int external_chunk_size(const qint64 memory_limit, const int image_count) {
+
+            constexpr auto resident_bytes = qint64{48};
+            constexpr auto chunk_image_bytes = qint64{1024};
+            constexpr auto min_chunk_size = qint64{1024};
+
+            const auto available = memory_limit - resident_bytes * image_count;
+            return gsl::narrow_cast<int>(std::clamp(
+                available / chunk_image_bytes, min_chunk_size, qint64{INT_MAX}));
+        }
+
+        ///
+        /// A task for a worker process of a sharded merge: the arguments to run this executable
+        /// with, and the file to which the worker writes its result.
+        ///
+
+        struct worker_job {
+            QStringList arguments;
+            QString output_path;
+        };
+
+        ///
+        /// Runs a worker process for each of \p jobs, up to \p max_running at once, calling
+        /// \p finished with the index of each job as it succeeds. A worker that fails to start,
+        /// crashes or exits with a non-zero status is run once more before giving up. Returns
+        /// \c false if an interruption is requested on the calling thread, and \c true once
+        /// every job has succeeded; any workers still running when this returns are killed.
+        /// \throws file_io_error with the output path of a job that failed twice.
+        ///
+
+        bool run_workers(
+            const std::vector<worker_job>& jobs, const std::size_t max_running,
+            const ksr::function_view<void(std::size_t)> finished) {
+
+            constexpr auto max_attempts = 2;
+            constexpr auto poll_interval_ms = 50;
+
+            struct running_job {
+                std::unique_ptr<QProcess> process;
+                std::size_t index;
+                int attempt;
+                bool started;
+            };
+
+            const auto program = QCoreApplication::applicationFilePath();
+            // Workers only write to the standard error stream, to explain a failure, so that
+            // is passed through; their standard output is never read.
+
+            const auto start = [&program, &jobs](const std::size_t index, const int attempt) {
+                auto process = std::make_unique<QProcess>();
+                process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+                process->start(program, jobs[index].arguments);
+                const auto started = process->waitForStarted();
+                return running_job{std::move(process), index, attempt, started};
+            };
+
+            auto running = std::vector<running_job>{};
+            const auto kill_running = gsl::finally([&running] {
+                for (auto& job : running) {
+                    job.process->kill();
+                    job.process->waitForFinished();
+                }
+            });
+
+            auto next_index = std::size_t{0};
+            while (next_index < jobs.size() || !running.empty()) {
+
+                if (thread_interrupted()) {
+                    return false;
+                }
+
+                while (running.size() < max_running && next_index < jobs.size()) {
+                    running.push_back(start(next_index++, 1));
+                }
+
+                // Waiting on the oldest worker keeps this from spinning while all of them run;
+                // the others are checked whenever it returns, without waiting.
+
+                running.front().process->waitForFinished(poll_interval_ms);
+
+                for (auto iter = std::begin(running); iter != std::end(running);) {
+
+                    auto& job = *iter;
+                    if (job.started && job.process->state() != QProcess::NotRunning) {
+                        ++iter;
+                        continue;
+                    }
+
+                    const auto succeeded = job.started
+                        && job.process->exitStatus() == QProcess::NormalExit
+                        && job.process->exitCode() == 0;
+
+                    if (succeeded) {
+                        finished(job.index);
+                        iter = running.erase(iter);
+                    } else if (job.attempt < max_attempts) {
+                        job = start(job.index, job.attempt + 1);
+                        ++iter;
+                    } else {
+                        throw file_io_error{jobs[job.index].output_path};
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        QStringList paths_of(const std::vector<image_info>& group) {
+
+            auto result = QStringList{};
+            for (const auto& item : group) {
+                result.push_back(item.path());
+            }
+
             return result;
         }
+
     }
 
     engine::engine()
       : m_input_signaller{20ms, [this](const int file_count, const int folder_count) {
             Q_EMIT input_count_changed(file_count, folder_count);
-        }} {}
+        }},
+        m_worker_count{std::max(QThread::idealThreadCount(), 1)} {}
+
+    discard_choice engine::appraise(const image_info& lhs, const image_info& rhs) const {
+
+        if (m_keep_policy == keep_policy::ask) {
+
+            // The collection's image is put first, as it is kept on a tie.
+
+            const auto choice = appraise(std::vector<image_info>{rhs, lhs});
+            if (!choice) {
+                return discard_choice::none;
+            }
+
+            return (*choice == 0) ? discard_choice::lhs : discard_choice::rhs;
+        }
+
+        const auto choice = decide(m_keep_policy, lhs, rhs);
+        if (choice == discard_choice::lhs) {
+            Q_EMIT image_discarded(lhs.path(), rhs.path());
+        } else if (choice == discard_choice::rhs) {
+            Q_EMIT image_discarded(rhs.path(), lhs.path());
+        }
+
+        return choice;
+    }
+
+    keep_choice engine::appraise(const std::vector<image_info>& group) const {
+
+        if (m_keep_policy == keep_policy::none) {
+            return std::nullopt;
+        }
+
+        if (m_keep_policy == keep_policy::ask) {
+
+            // Only one decision is ever pending when they are made one at a time, so the first
+            // to be made is this one.
+
+            request_decision(group, 0);
+            while (!thread_interrupted()) {
+                const auto decisions = take_decisions(true);
+                if (!decisions.empty()) {
+                    return decisions.front().second;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        // Of images that rank equally, the first is kept. Groups put the collection's image
+        // before an input; between images in the collection, which survives doesn't matter.
+
+        const auto keeper = std::max_element(std::cbegin(group), std::cend(group),
+            [policy = m_keep_policy](const image_info& lhs, const image_info& rhs) {
+                return keep_rank(policy, lhs) < keep_rank(policy, rhs);
+            });
+
+        const auto choice =
+            keep_choice{gsl::narrow_cast<std::size_t>(std::distance(std::cbegin(group), keeper))};
+
+        signal_discards(paths_of(group), choice);
+        return choice;
+    }
+
+    std::optional<keep_choice> engine::appraise(
+        const std::vector<image_info>& group, const std::size_t tag) const {
+
+        if (m_keep_policy != keep_policy::ask) {
+            return appraise(group);
+        }
+
+        request_decision(group, tag);
+        return std::nullopt;
+    }
+
+    std::vector<std::pair<std::size_t, keep_choice>> engine::take_decisions(
+        const bool block) const {
 
+        auto result = std::vector<std::pair<std::size_t, keep_choice>>{};
+        for (const auto& item : m_decisions.take(block)) {
+            signal_discards(item.paths, item.choice);
+            result.emplace_back(item.tag, item.choice);
+        }
+
+        return result;
+    }
+
+    void engine::request_decision(
+        const std::vector<image_info>& group, const std::size_t tag) const {
+
+        const auto paths = paths_of(group);
+        Q_EMIT decision_requested(m_decisions.post(tag, paths), paths);
+    }
+
+    void engine::signal_discards(const QStringList& paths, const keep_choice& choice) const {
+
+        if (!choice) {
+            return;
+        }
+
+        for (auto index = 0; index < paths.size(); ++index) {
+            if (gsl::narrow_cast<std::size_t>(index) != *choice) {
+                Q_EMIT image_discarded(paths[index], paths[gsl::narrow_cast<int>(*choice)]);
+            }
+        }
+    }
+
+    discard_choice engine::decide(
+        const keep_policy policy, const image_info& lhs, const image_info& rhs) {
+
+        if (policy == keep_policy::none || policy == keep_policy::ask) {
+            return discard_choice::none;
+        }
+
+        // Every pairer passes the input image (if either is one) as lhs, so discarding lhs on a
+        // tie keeps the collection as it is.
+
+        return (keep_rank(policy, rhs) < keep_rank(policy, lhs))
+            ? discard_choice::rhs
+            : discard_choice::lhs;
+    }
+
+    template <typename Pairer, typename... Args>
     int engine::compare_images(
-        pairer& pair_strategy, const int start_count, const int total_count) const {
+        Pairer& pair_strategy, const int start_count, const int total_count,
+        Args&&... args) const {
 
         auto count = start_count;
         auto last_percent_complete = int_percentage(count, total_count);
+        auto next_report_count = next_percentage_count(last_percent_complete, total_count);
 
         // TODO Currently, total_count is not updated when images are removed and the number that
         // is eventually processed ultimately changes; we need a mechanism for keeping that value
         // up-to-date.
 
+        // The percentage is only recalculated once enough pairs have been compared to change it,
+        // so that the common path through the comparison is a single integer comparison.
+
         pair_strategy.pair(
-            [this, &count, &last_percent_complete, total_count]
-            (const image_info&, const image_info&) {
+            [this, &count, &last_percent_complete, &next_report_count, total_count]
+            (const auto&... images) {
 
-                const auto percent_complete = int_percentage(count, total_count);
-                if (percent_complete > last_percent_complete) {
-                    Q_EMIT progress_changed(percent_complete);
-                    last_percent_complete = percent_complete;
+                if (count >= next_report_count) {
+                    const auto percent_complete = int_percentage(count, total_count);
+                    if (percent_complete > last_percent_complete) {
+                        Q_EMIT progress_changed(percent_complete);
+                        last_percent_complete = percent_complete;
+                    }
+
+                    next_report_count = std::max(
+                        next_percentage_count(last_percent_complete, total_count), count + 1);
                 }
 
                 ++count;
-                return discard_choice::none;
-            });
+                return appraise(images...);
+            }, std::forward<Args>(args)...);
+
+        if (m_metrics) {
+            m_metrics->pairs_compared += gsl::narrow_cast<std::uint64_t>(count - start_count);
+        }
 
         return count;
     }
 
     image_set engine::hash_images(
-        const QStringList& paths, const int start_count, const int total_count) const {
+        const QStringList& paths, hash_cache& cache, QStringList& failed_paths,
+        const int start_count, const int total_count) const {
 
-        auto result = image_set{};
-        auto last_percent_complete = int_percentage(start_count, total_count);
+        // Cache entries are looked up first, and the files without valid entries are then checked
+        // for byte-identical copies of each other, so that each set of copies is only decoded
+        // once; the other copies are given the attributes of the first once it has been hashed.
 
-        const auto begin = std::cbegin(paths);
-        const auto end = std::cend(paths);
-        for (auto iter = begin; iter != end && !thread_interrupted();) {
+        const auto path_count = gsl::narrow_cast<std::size_t>(paths.size());
+        auto cached = std::vector<std::optional<image_info>>(path_count);
+        auto sizes = std::vector<qint64>(path_count);
+        auto modified = std::vector<QDateTime>(path_count);
 
-            result.emplace(*iter++);
+        parallel_for(path_count, m_worker_count,
+            [&paths, &cache, &cached, &sizes, &modified](const std::size_t index) {
 
-            const auto hashed_count = start_count + std::distance(begin, iter);
-            const auto percent_complete = int_percentage(hashed_count, total_count);
+                const auto file_info = QFileInfo{paths[gsl::narrow_cast<int>(index)]};
+                cached[index] = cache.find(file_info);
+                if (!cached[index]) {
+                    sizes[index] = file_info.size();
+                    modified[index] = file_info.lastModified();
+                }
+            });
+
+        const auto originals = find_identical_files(paths, sizes, m_worker_count);
+
+        auto has_copies = std::vector<bool>(path_count);
+        auto original_count = 0;
+
+        for (auto index = 0; index < paths.size(); ++index) {
+            if (originals[index] == index) {
+                ++original_count;
+            } else {
+                has_copies[originals[index]] = true;
+            }
+        }
+
+        if (m_metrics) {
+            const auto hit_count = std::count_if(std::cbegin(cached), std::cend(cached),
+                [](const std::optional<image_info>& item) { return item.has_value(); });
+
+            m_metrics->cache_hits += gsl::narrow_cast<std::uint64_t>(hit_count);
+            m_metrics->cache_misses += path_count - gsl::narrow_cast<std::uint64_t>(hit_count);
+            m_metrics->identical_copies +=
+                path_count - gsl::narrow_cast<std::size_t>(original_count);
+        }
+
+        // Workers claim paths by index and hand back completed results through a bounded queue, so
+        // that at most a handful of images are decoded (or awaiting collection) at any one time.
+        // Everything that touches the result set, the cache's pending entries or the engine's
+        // signals happens on this thread, which also keeps the emitted progress monotonic.
 
+        const auto capacity = 2 * gsl::narrow_cast<std::size_t>(m_worker_count);
+        auto results = bounded_queue<hash_result>{capacity};
+        auto next_index = std::atomic<int>{0};
+
+        // With read-ahead, the files to be decoded are instead taken from the reader in the order
+        // their reads complete, once the workers have run out of cached entries to hand back.
+        // Slow storage benefits from more reads in flight than there are processor cores.
+
+        auto reader = std::unique_ptr<read_ahead>{};
+        if (m_read_ahead_bytes > 0) {
+
+            auto uncached_indices = std::vector<int>{};
+            for (auto index = 0; index < paths.size(); ++index) {
+                if (originals[index] == index && !cached[index]) {
+                    uncached_indices.push_back(index);
+                }
+            }
+
+            if (!uncached_indices.empty()) {
+                reader = std::make_unique<read_ahead>(
+                    paths, uncached_indices, m_read_ahead_bytes, std::max(m_worker_count, 4));
+            }
+        }
+
+        const auto variant = cache.variant();
+        const auto metrics = m_metrics;
+        const auto work = [&paths, &cached, &originals, &results, &next_index, &reader, variant,
+            metrics] {
+
+            for (auto index = next_index++; index < paths.size(); index = next_index++) {
+
+                if (originals[index] != index || (reader && !cached[index])) {
+                    continue;
+                }
+
+                auto result = hash_result{paths[index], std::move(cached[index]), true, index};
+                if (!result.info) {
+                    result.cached = false;
+                    try {
+                        result.info.emplace(QFileInfo{result.path}, variant, metrics);
+                    } catch (const file_io_error&) {
+                    }
+                }
+
+                if (!results.push(std::move(result))) {
+                    return;
+                }
+            }
+
+            if (!reader) {
+                return;
+            }
+
+            auto watch = stopwatch{metrics != nullptr};
+            while (auto file = reader->pop()) {
+
+                if (metrics) {
+                    metrics->read_ahead_wait_time.record(watch.lap());
+                }
+
+                auto result = hash_result{paths[file->index], std::nullopt, false, file->index};
+                try {
+                    if (file->data) {
+                        result.info.emplace(
+                            result.path, *file->data, file->last_modified, variant, metrics);
+                    } else {
+                        result.info.emplace(QFileInfo{result.path}, variant, metrics);
+                    }
+                } catch (const file_io_error&) {
+                }
+
+                if (!results.push(std::move(result))) {
+                    return;
+                }
+
+                watch.lap();
+            }
+        };
+
+        auto workers = std::vector<std::thread>{};
+        const auto worker_count = std::min(m_worker_count, original_count);
+        for (auto i = 0; i < worker_count; ++i) {
+            workers.emplace_back(work);
+        }
+
+        const auto start_failed_count = failed_paths.size();
+        auto result = image_set{};
+        auto copy_sources = std::vector<std::optional<image_info>>(path_count);
+        auto hashed_count = 0;
+        auto last_percent_complete = int_percentage(start_count, total_count);
+
+        const auto report_progress = [this, &hashed_count, &last_percent_complete, start_count,
+            total_count] {
+
+            const auto percent_complete = int_percentage(start_count + hashed_count, total_count);
             if (percent_complete > last_percent_complete) {
                 Q_EMIT progress_changed(percent_complete);
                 last_percent_complete = percent_complete;
             }
+        };
+
+        while (hashed_count < original_count && !thread_interrupted()) {
+
+            auto item = results.pop();
+            ++hashed_count;
+
+            if (!item->info) {
+                failed_paths.push_back(item->path);
+            } else {
+                if (has_copies[item->index]) {
+                    copy_sources[item->index] = *item->info;
+                }
+
+                if (!item->cached) {
+                    cache.insert(*item->info);
+                }
+
+                result.insert(*item->info);
+            }
+
+            report_progress();
+        }
+
+        results.close();
+        if (reader) {
+            reader->close();
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        // A copy of a file that couldn't be read can't be read either.
+
+        for (auto index = 0; index < paths.size() && !thread_interrupted(); ++index) {
+
+            const auto original = originals[index];
+            if (original == index) {
+                continue;
+            }
+
+            ++hashed_count;
+            if (const auto& source = copy_sources[original]) {
+                const auto copy = copy_of(*source, paths[index], modified[index]);
+                cache.insert(copy);
+                result.insert(copy);
+            } else {
+                failed_paths.push_back(paths[index]);
+            }
+
+            report_progress();
+        }
+
+        if (m_metrics) {
+            m_metrics->images_unreadable += gsl::narrow_cast<std::uint64_t>(
+                failed_paths.size() - start_failed_count);
         }
 
         return result;
@@ -117,74 +650,773 @@ namespace myriad {
 
     void engine::merge(const QStringList& input_image_paths, const QString& collection_path) const {
 
+        auto metrics = m_metrics_enabled ? std::make_unique<merge_metrics>() : nullptr;
+        m_metrics = metrics.get();
+        const auto reset_metrics = gsl::finally([this] { m_metrics = nullptr; });
+
+        // Decisions still pending when a merge ends (only if it was interrupted) can no longer be
+        // made.
+
+        const auto clear_decisions = gsl::finally([this] { m_decisions.clear(); });
+
+        if (m_memory_limit > 0) {
+            merge_external(input_image_paths, collection_path);
+        } else if (m_shard_count > 1) {
+            merge_sharded(input_image_paths, collection_path);
+        } else if (m_pipelined) {
+            merge_pipelined(input_image_paths, collection_path);
+        } else {
+            merge_phased(input_image_paths, collection_path);
+        }
+
+        if (!metrics) {
+            return;
+        }
+
+        metrics->set_active_phases(0);
+        const auto report = metrics->to_json();
+        Q_EMIT metrics_reported(report);
+
+        if (!m_metrics_path.isEmpty()) {
+            try {
+                write_metrics(report, m_metrics_path);
+            } catch (const file_io_error&) {
+            }
+        }
+    }
+
+    void engine::merge_phased(
+        const QStringList& input_image_paths, const QString& collection_path) const {
+
         auto collection_image_paths = QStringList{};
+        auto image_count = 0;
         auto folder_count = 0;
 
         signal_phase_change(phase::scan);
         m_input_signaller.sync(0, 0);
 
-        scan_for_images(collection_path, collection_image_paths, folder_count);
-        m_input_signaller.sync(collection_image_paths.size(), folder_count);
+        scan_for_images(collection_path, [&collection_image_paths](const QString& path) {
+            collection_image_paths.push_back(path);
+            return true;
+        }, image_count, folder_count);
+
+        m_input_signaller.sync(image_count, folder_count);
 
         signal_phase_change(phase::hash);
 
-        const auto image_count = input_image_paths.size() + collection_image_paths.size();
-        auto inputs = hash_images(input_image_paths, 0, image_count);
-        auto collection = hash_images(collection_image_paths, inputs.size(), image_count);
+        auto failed_paths = QStringList{};
+        auto inputs = image_set{};
+        auto collection = image_set{};
 
-        ksr::erase_if(inputs, [&collection](const image_info& item) {
-            return collection.count(item) > 0;
-        });
+        if (m_prefilter_threshold > 0) {
+            hash_prefiltered(input_image_paths, collection_image_paths, collection_path, inputs,
+                collection, failed_paths);
+        } else {
+            const auto hash_count = input_image_paths.size() + collection_image_paths.size();
+
+            hash_cache cache{collection_cache_path(collection_path), m_hash_variant};
+            inputs = hash_images(input_image_paths, cache, failed_paths, 0, hash_count);
+            collection = hash_images(
+                collection_image_paths, cache, failed_paths, input_image_paths.size(), hash_count);
+
+            // Entries are only pruned once every image has been looked up; otherwise,
+            // interrupting a merge would discard the cached attributes of every image not yet
+            // reached.
+
+            save_cache(cache, !thread_interrupted());
+        }
+
+        if (!failed_paths.isEmpty()) {
+            Q_EMIT images_unreadable(failed_paths);
+        }
+
+        for (const auto item : inputs.handles()) {
+            if (collection.contains(inputs, item)) {
+                inputs.erase(item);
+            }
+        }
 
         signal_phase_change(phase::compare);
 
-        auto deduplicator = deduplicate_pairer{collection};
-        auto merger = merge_pairer{inputs, collection};
+        // Deduplicating the collection and merging the inputs into it are done by a single
+        // pairer, so that a merge pair need only wait for a decision on the images it involves,
+        // rather than for the whole of deduplication. Unless the user is being asked, every
+        // decision is made at once, and the groups are decided strictly in order.
+
+        auto watch = stopwatch{m_metrics != nullptr};
+        auto pair_strategy =
+            deferred_merge_pairer{inputs, collection, m_distance_threshold, m_worker_count};
+
+        if (m_metrics) {
+            m_metrics->candidate_search_time.record(watch.lap());
+        }
 
-        auto count = 0;
-        const auto comp_count = deduplicator.count() + merger.count();
-        count = compare_images(deduplicator, count, comp_count);
-        compare_images(merger, count, comp_count);
+        compare_images(pair_strategy, 0, pair_strategy.count(), [this](const bool block) {
+            return take_decisions(block);
+        });
     }
 
-    void engine::scan_for_images(
-        const QString &base_path, QStringList &image_paths, int &folder_count) const {
+    void engine::hash_prefiltered(
+        const QStringList& input_image_paths, const QStringList& collection_image_paths,
+        const QString& collection_path, image_set& inputs, image_set& collection,
+        QStringList& failed_paths) const {
+
+        const auto hash_count = input_image_paths.size() + collection_image_paths.size();
+
+        hash_cache prefilter_cache{
+            collection_cache_path(collection_path, phash_variant::difference),
+            phash_variant::difference};
 
-        const auto info = QFileInfo{base_path};
-        if (!info.exists()) {
+        auto input_thumbs =
+            hash_images(input_image_paths, prefilter_cache, failed_paths, 0, hash_count);
+        const auto collection_thumbs = hash_images(collection_image_paths, prefilter_cache,
+            failed_paths, input_image_paths.size(), hash_count);
+
+        save_cache(prefilter_cache, !thread_interrupted());
+
+        if (thread_interrupted()) {
             return;
         }
 
-        if (info.isFile()) {
+        for (const auto item : input_thumbs.handles()) {
+            if (collection_thumbs.contains(input_thumbs, item)) {
+                input_thumbs.erase(item);
+            }
+        }
+
+        // Only images with a candidate under the difference hash can have a duplicate under the
+        // full hash too, or near enough; the rest never need more than their thumbnails decoded.
+
+        auto watch = stopwatch{m_metrics != nullptr};
+
+        const auto input_items = input_thumbs.handles();
+        const auto collection_items = collection_thumbs.handles();
+
+        const auto hashes_of = [](const image_set& set,
+            const std::vector<image_set::handle>& items) {
+
+            auto result = std::vector<std::uint64_t>{};
+            result.reserve(items.size());
+            for (const auto item : items) {
+                result.push_back(set.phash(item));
+            }
+
+            return result;
+        };
+
+        const auto input_hashes = hashes_of(input_thumbs, input_items);
+        const auto collection_hashes = hashes_of(collection_thumbs, collection_items);
+
+        auto input_marked = std::vector<bool>(input_items.size());
+        auto collection_marked = std::vector<bool>(collection_items.size());
+
+        for (const auto& [lhs, rhs] :
+            find_pairs_within(collection_hashes, m_prefilter_threshold, m_worker_count)) {
+
+            collection_marked[lhs] = true;
+            collection_marked[rhs] = true;
+        }
+
+        for (const auto& [src, dst] : find_pairs_between(
+            input_hashes, collection_hashes, m_prefilter_threshold, m_worker_count)) {
+
+            input_marked[src] = true;
+            collection_marked[dst] = true;
+        }
+
+        if (m_metrics) {
+            m_metrics->candidate_search_time.record(watch.lap());
+        }
+
+        const auto marked_paths = [](const image_set& set,
+            const std::vector<image_set::handle>& items, const std::vector<bool>& marked) {
+
+            auto result = QStringList{};
+            for (auto index = std::size_t{0}; index < items.size(); ++index) {
+                if (marked[index]) {
+                    result.push_back(set.path(items[index]));
+                }
+            }
+
+            return result;
+        };
+
+        const auto input_paths = marked_paths(input_thumbs, input_items, input_marked);
+        const auto collection_paths =
+            marked_paths(collection_thumbs, collection_items, collection_marked);
+
+        // The candidates are hashed in full as a second pass of the hashing phase, which reports
+        // its progress afresh. Most images are never looked up in the full cache, so it mustn't
+        // be pruned.
+
+        signal_phase_change(phase::hash);
+
+        const auto confirm_count = input_paths.size() + collection_paths.size();
+        hash_cache cache{collection_cache_path(collection_path, m_hash_variant), m_hash_variant};
+
+        inputs = hash_images(input_paths, cache, failed_paths, 0, confirm_count);
+        collection = hash_images(
+            collection_paths, cache, failed_paths, input_paths.size(), confirm_count);
+
+        save_cache(cache, false);
+
+        if (m_metrics) {
+            m_metrics->images_confirmed += gsl::narrow_cast<std::uint64_t>(confirm_count);
+        }
+    }
+
+    void engine::merge_external(
+        const QStringList& input_image_paths, const QString& collection_path) const {
+
+        try {
+            const auto spill_dir_path = QDir::tempPath();
+            auto collection_paths = path_spill{spill_dir_path};
+            auto spill_error = std::optional<file_io_error>{};
+            auto image_count = 0;
+            auto folder_count = 0;
+
+            signal_phase_change(phase::scan);
+            m_input_signaller.sync(0, 0);
+
+            // An exception mustn't escape into the scanner, so a failure to write stops the scan
+            // and is rethrown once it has finished.
+
+            const auto found = [&collection_paths, &spill_error](const QString& path) {
+                try {
+                    collection_paths.append(path);
+                    return true;
+                } catch (const file_io_error& error) {
+                    spill_error = error;
+                    return false;
+                }
+            };
+
+            scan_for_images(collection_path, found, image_count, folder_count);
+
+            if (spill_error) {
+                throw *spill_error;
+            }
+
+            m_input_signaller.sync(image_count, folder_count);
+
+            signal_phase_change(phase::hash);
+
+            const auto hash_count = input_image_paths.size() + collection_paths.size();
+            const auto chunk_size = external_chunk_size(m_memory_limit, collection_paths.size());
+
+            hash_cache cache{collection_cache_path(collection_path), m_hash_variant};
+            auto failed_paths = QStringList{};
+            auto collection = image_spill{spill_dir_path};
+
+            auto inputs = hash_images(input_image_paths, cache, failed_paths, 0, hash_count);
+            auto hashed_count = input_image_paths.size();
+
+            while (!thread_interrupted()) {
+
+                const auto chunk_paths = collection_paths.read(chunk_size);
+                if (chunk_paths.isEmpty()) {
+                    break;
+                }
+
+                const auto chunk =
+                    hash_images(chunk_paths, cache, failed_paths, hashed_count, hash_count);
+
+                for (const auto item : inputs.handles()) {
+                    if (chunk.contains(inputs, item)) {
+                        inputs.erase(item);
+                    }
+                }
+
+                collection.append(chunk);
+                hashed_count += chunk_paths.size();
+            }
+
+            if (!failed_paths.isEmpty()) {
+                Q_EMIT images_unreadable(failed_paths);
+            }
+
+            save_cache(cache, !thread_interrupted());
+
+            signal_phase_change(phase::compare);
+
+            auto watch = stopwatch{m_metrics != nullptr};
+            const auto plan = pass_planner{inputs, collection.hashes(), m_distance_threshold,
+                m_worker_count, gsl::narrow_cast<std::size_t>(chunk_size)};
+
+            if (m_metrics) {
+                m_metrics->candidate_search_time.record(watch.lap());
+                m_metrics->images_spilled += collection.size();
+            }
+
+            auto count = 0;
+            for (auto pass = std::size_t{0}; pass < plan.pass_count(); ++pass) {
+
+                if (thread_interrupted()) {
+                    break;
+                }
+
+                auto pass_collection = collection.load(plan.dst_ids(pass));
+                auto pass_inputs = image_set{};
+                for (const auto item : plan.src_items(pass)) {
+                    pass_inputs.insert(inputs.info(item));
+                }
+
+                watch.lap();
+                auto pair_strategy = deferred_merge_pairer{
+                    pass_inputs, pass_collection, m_distance_threshold, m_worker_count};
+
+                if (m_metrics) {
+                    m_metrics->candidate_search_time.record(watch.lap());
+                    m_metrics->images_reloaded += pass_collection.size();
+                    ++m_metrics->compare_passes;
+                }
+
+                count = compare_images(pair_strategy, count, plan.count(),
+                    [this](const bool block) { return take_decisions(block); });
+            }
+        } catch (const file_io_error& error) {
+            Q_EMIT merge_failed(QString::fromLatin1(error.what()));
+        }
+    }
+
+    void engine::merge_pipelined(
+        const QStringList& input_image_paths, const QString& collection_path) const {
+
+        // Inputs within the collection will be found when it is scanned, and are hashed and
+        // compared as part of it; this has to be decided up front, since the collection is never
+        // available in its entirety before comparisons begin.
+
+        auto own_input_paths = QStringList{};
+        for (const auto& path : input_image_paths) {
+            if (!path_within(path, collection_path)) {
+                own_input_paths.push_back(path);
+            }
+        }
+
+        signal_phases_change(phase::scan | phase::hash);
+        Q_EMIT progress_changed(0);
+        m_input_signaller.sync(0, 0);
+
+        // Scanning is cheap relative to hashing, so the scanner may run well ahead of the hashing
+        // workers; the bounded queues between the stages still keep the memory used by paths and
+        // results in flight from growing with the size of the collection. Closing the queues is
+        // enough to stop the other stages, which never check for interruption themselves.
+
+        constexpr auto scan_capacity = std::size_t{4096};
+        const auto hash_capacity = 2 * gsl::narrow_cast<std::size_t>(m_worker_count);
+
+        auto found_paths = bounded_queue<QString>{scan_capacity};
+        auto found_count = std::atomic<int>{0};
+        auto scan_complete = std::atomic<bool>{false};
+        auto folder_count = 0;
+
+        auto scanner = std::thread{
+            [this, &collection_path, &found_paths, &found_count, &scan_complete, &folder_count] {
+
+                auto image_count = 0;
+                scan_for_images(collection_path, [&found_paths, &found_count](const QString& path) {
+                    ++found_count;
+                    return found_paths.push(path);
+                }, image_count, folder_count);
+
+                scan_complete = true;
+                found_paths.close();
+            }};
+
+        hash_cache cache{collection_cache_path(collection_path), m_hash_variant};
+        auto failed_paths = QStringList{};
+
+        auto inputs = hash_images(
+            own_input_paths, cache, failed_paths, 0, own_input_paths.size() + found_count);
+
+        auto results = bounded_queue<hash_result>{hash_capacity};
+        auto running_count = std::atomic<int>{m_worker_count};
+
+        const auto variant = m_hash_variant;
+        const auto metrics = m_metrics;
+        const auto work = [&cache, &found_paths, &results, &running_count, variant, metrics] {
+            while (auto path = found_paths.pop()) {
+                if (!results.push(hash_path(*path, cache, variant, metrics))) {
+                    break;
+                }
+            }
+
+            if (--running_count == 0) {
+                results.close();
+            }
+        };
+
+        auto workers = std::vector<std::thread>{};
+        for (auto i = 0; i < m_worker_count; ++i) {
+            workers.emplace_back(work);
+        }
+
+        auto scanning = !scan_complete;
+        signal_phases_change(
+            scanning ? phase::scan | phase::hash | phase::compare : phase::hash | phase::compare);
+
+        auto collection = image_set{};
+        auto pair_strategy = stream_pairer{inputs, collection, m_distance_threshold};
+
+        auto hashed_count = own_input_paths.size();
+        auto last_percent_complete =
+            int_percentage(hashed_count, std::max(hashed_count + found_count, 1));
+
+        const auto callback = [this](const image_info& lhs, const image_info& rhs) {
+            return appraise(lhs, rhs);
+        };
+
+        while (!thread_interrupted()) {
+
+            auto item = results.pop();
+            if (!item) {
+                break;
+            }
+
+            ++hashed_count;
+            if (!item->info) {
+                failed_paths.push_back(item->path);
+                if (m_metrics) {
+                    ++m_metrics->cache_misses;
+                    ++m_metrics->images_unreadable;
+                }
+            } else {
+                if (!item->cached) {
+                    cache.insert(*item->info);
+                }
+
+                const auto pair_count = pair_strategy.add(*item->info, callback);
+                if (m_metrics) {
+                    ++(item->cached ? m_metrics->cache_hits : m_metrics->cache_misses);
+                    m_metrics->pairs_compared += gsl::narrow_cast<std::uint64_t>(pair_count);
+                }
+            }
+
+            if (scanning && scan_complete) {
+                scanning = false;
+                signal_phases_change(phase::hash | phase::compare);
+            }
+
+            const auto total_count = std::max(own_input_paths.size() + found_count, 1);
+            const auto percent_complete = int_percentage(hashed_count, total_count);
+            if (percent_complete > last_percent_complete) {
+                Q_EMIT progress_changed(percent_complete);
+                last_percent_complete = percent_complete;
+            }
+        }
+
+        found_paths.close();
+        results.close();
+
+        scanner.join();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        m_input_signaller.sync(found_count, folder_count);
+
+        if (!failed_paths.isEmpty()) {
+            Q_EMIT images_unreadable(failed_paths);
+        }
+
+        save_cache(cache, !thread_interrupted());
+    }
+
+    void engine::merge_sharded(
+        const QStringList& input_image_paths, const QString& collection_path) const {
+
+        try {
+            const auto shard_dir = QTemporaryDir{};
+            if (!shard_dir.isValid()) {
+                throw file_io_error{shard_dir.path()};
+            }
+
+            auto collection_image_paths = QStringList{};
+            auto image_count = 0;
+            auto folder_count = 0;
+
+            signal_phase_change(phase::scan);
+            m_input_signaller.sync(0, 0);
+
+            scan_for_images(collection_path, [&collection_image_paths](const QString& path) {
+                collection_image_paths.push_back(path);
+                return true;
+            }, image_count, folder_count);
+
+            m_input_signaller.sync(image_count, folder_count);
+
+            signal_phase_change(phase::hash);
+
+            const auto hash_count = input_image_paths.size() + collection_image_paths.size();
+            const auto cache_path = collection_cache_path(collection_path);
+
+            hash_cache cache{cache_path, m_hash_variant};
+            auto failed_paths = QStringList{};
+            auto inputs = hash_images(input_image_paths, cache, failed_paths, 0, hash_count);
+
+            // Shards are contiguous runs of the scan's paths, so the images of each shard file
+            // can be numbered on from those of the one before.
+
+            const auto path_count = collection_image_paths.size();
+            const auto shard_count = std::clamp(m_shard_count, 1, std::max(path_count, 1));
+            const auto shard_worker_count = std::max(m_worker_count / shard_count, 1);
+
+            auto shard_paths = QStringList{};
+            auto shard_sizes = std::vector<int>{};
+            auto hash_jobs = std::vector<worker_job>{};
+
+            for (auto shard = 0; shard < shard_count; ++shard) {
+
+                const auto begin = gsl::narrow_cast<int>(qint64{path_count} * shard / shard_count);
+                const auto end =
+                    gsl::narrow_cast<int>(qint64{path_count} * (shard + 1) / shard_count);
 
-            if (file_supported(base_path)) {
-                image_paths.push_back(base_path);
-                m_input_signaller.update(image_paths.size(), folder_count);
+                const auto list_path = shard_dir.filePath(QStringLiteral("paths-%1").arg(shard));
+                const auto shard_path = shard_dir.filePath(QStringLiteral("shard-%1").arg(shard));
+                write_path_list(list_path, collection_image_paths.mid(begin, end - begin));
+
+                shard_paths.push_back(shard_path);
+                shard_sizes.push_back(end - begin);
+                hash_jobs.push_back(worker_job{shard_hash_arguments(
+                    list_path, cache_path, m_hash_variant, shard_worker_count, shard_path),
+                    shard_path});
+            }
+
+            auto hashed_count = input_image_paths.size();
+            auto last_percent_complete = int_percentage(hashed_count, hash_count);
+
+            const auto shard_hashed = [this, &shard_sizes, &hashed_count, &last_percent_complete,
+                hash_count](const std::size_t shard) {
+
+                hashed_count += shard_sizes[shard];
+                const auto percent_complete = int_percentage(hashed_count, hash_count);
+                if (percent_complete > last_percent_complete) {
+                    Q_EMIT progress_changed(percent_complete);
+                    last_percent_complete = percent_complete;
+                }
+            };
+
+            if (!run_workers(hash_jobs, hash_jobs.size(), shard_hashed)) {
+                return;
+            }
+
+            auto collection = image_set{};
+            auto collection_items = std::vector<image_set::handle>{};
+            auto uncached = std::vector<image_info>{};
+            auto miss_count = std::uint64_t{0};
+            auto shard_offsets = std::vector<std::size_t>{};
+            const auto input_failed_count = failed_paths.size();
+
+            for (const auto& shard_path : shard_paths) {
+                shard_offsets.push_back(collection_items.size());
+                read_shard(shard_path, collection, collection_items, uncached, failed_paths);
+
+                for (const auto& info : uncached) {
+                    cache.insert(info);
+                }
+
+                miss_count += uncached.size();
+                uncached.clear();
+            }
+
+            if (m_metrics) {
+                m_metrics->cache_misses += miss_count;
+                m_metrics->cache_hits += collection_items.size() - miss_count;
+                m_metrics->images_unreadable +=
+                    gsl::narrow_cast<std::uint64_t>(failed_paths.size() - input_failed_count);
+            }
+
+            if (!failed_paths.isEmpty()) {
+                Q_EMIT images_unreadable(failed_paths);
             }
 
-        } else if (info.isDir()) {
+            // Images that other shards would have seen are never looked up here, so pruning
+            // would discard their entries.
+
+            save_cache(cache, false);
 
-            auto dir = QDir{base_path};
-            dir.setFilter(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+            for (const auto item : inputs.handles()) {
+                if (collection.contains(inputs, item)) {
+                    inputs.erase(item);
+                }
+            }
 
-            const auto items = dir.entryInfoList();
-            ++folder_count;
-            m_input_signaller.update(image_paths.size(), folder_count);
+            signal_phase_change(phase::compare);
+
+            auto watch = stopwatch{m_metrics != nullptr};
+            auto pair_jobs = std::vector<worker_job>{};
+            auto pair_offsets = std::vector<std::pair<std::size_t, std::size_t>>{};
+
+            for (auto lhs = 0; lhs < shard_count; ++lhs) {
+                for (auto rhs = lhs; rhs < shard_count; ++rhs) {
+
+                    const auto output_path =
+                        shard_dir.filePath(QStringLiteral("pairs-%1-%2").arg(lhs).arg(rhs));
+
+                    pair_jobs.push_back(worker_job{shard_pair_arguments(
+                        shard_paths[lhs], (lhs == rhs) ? QString{} : shard_paths[rhs],
+                        m_distance_threshold, shard_worker_count, output_path), output_path});
+
+                    pair_offsets.emplace_back(shard_offsets[lhs], shard_offsets[rhs]);
+                }
+            }
 
-            const auto end = std::cend(items);
-            for (auto iter = std::cbegin(items); iter != end && !thread_interrupted(); ++iter) {
-                scan_for_images(iter->absoluteFilePath(), image_paths, folder_count);
+            if (!run_workers(pair_jobs, gsl::narrow_cast<std::size_t>(shard_count),
+                    [](std::size_t) {})) {
+                return;
             }
+
+            // Every pair of the combined list has its lesser index first, since the shards are
+            // numbered in order, so sorting it gives the list a single search would have.
+
+            auto collection_candidates = candidate_list{};
+            for (auto index = std::size_t{0}; index < pair_jobs.size(); ++index) {
+                read_candidates(pair_jobs[index].output_path, pair_offsets[index].first,
+                    pair_offsets[index].second, collection_candidates);
+            }
+
+            std::sort(std::begin(collection_candidates), std::end(collection_candidates));
+
+            const auto input_items = inputs.handles();
+            auto input_hashes = std::vector<std::uint64_t>{};
+            for (const auto item : input_items) {
+                input_hashes.push_back(inputs.phash(item));
+            }
+
+            auto collection_hashes = std::vector<std::uint64_t>{};
+            for (const auto item : collection_items) {
+                collection_hashes.push_back(collection.phash(item));
+            }
+
+            const auto merge_candidates = find_pairs_between(
+                input_hashes, collection_hashes, m_distance_threshold, m_worker_count);
+
+            auto pair_strategy = deferred_merge_pairer{inputs, collection, input_items,
+                collection_items, collection_candidates, merge_candidates};
+
+            if (m_metrics) {
+                m_metrics->candidate_search_time.record(watch.lap());
+            }
+
+            compare_images(pair_strategy, 0, pair_strategy.count(), [this](const bool block) {
+                return take_decisions(block);
+            });
+        } catch (const file_io_error& error) {
+            Q_EMIT merge_failed(QString::fromLatin1(error.what()));
+        }
+    }
+
+    void engine::save_cache(hash_cache& cache, const bool prune) const {
+
+        auto watch = stopwatch{m_metrics != nullptr};
+
+        try {
+            const auto byte_count = cache.save(prune);
+            if (m_metrics) {
+                m_metrics->cache_save_time.record(watch.lap());
+                ++m_metrics->cache_writes;
+                m_metrics->cache_bytes_written += gsl::narrow_cast<std::uint64_t>(byte_count);
+            }
+        } catch (const file_io_error&) {
         }
     }
 
+    bool engine::scan_for_images(
+        const QString& base_path, const ksr::function_view<bool(const QString&)> found,
+        int& image_count, int& folder_count) const {
+
+        const auto start_image_count = image_count;
+        const auto start_folder_count = folder_count;
+
+        const auto scanner = directory_scanner{may_be_supported, m_worker_count};
+        const auto completed = scanner.scan(base_path, found,
+            [this, &image_count, &folder_count, start_image_count, start_folder_count](
+                const int scanned_image_count, const int scanned_folder_count) {
+
+                image_count = start_image_count + scanned_image_count;
+                folder_count = start_folder_count + scanned_folder_count;
+                m_input_signaller.update(image_count, folder_count);
+            });
+
+        if (m_metrics) {
+            m_metrics->files_scanned += gsl::narrow_cast<std::uint64_t>(
+                image_count - start_image_count);
+            m_metrics->folders_scanned += gsl::narrow_cast<std::uint64_t>(
+                folder_count - start_folder_count);
+        }
+
+        return completed;
+    }
+
+    bool engine::make_decision(const quint64 ticket, const int keep_index) {
+        return m_decisions.make(ticket, (keep_index < 0)
+            ? keep_choice{}
+            : keep_choice{gsl::narrow_cast<std::size_t>(keep_index)});
+    }
+
+    void engine::set_distance_threshold(const int threshold) {
+        m_distance_threshold = threshold;
+    }
+
+    void engine::set_hash_variant(const phash_variant variant) {
+        m_hash_variant = variant;
+    }
+
+    void engine::set_keep_policy(const keep_policy policy) {
+        m_keep_policy = policy;
+    }
+
+    void engine::set_metrics_enabled(const bool enabled) {
+        m_metrics_enabled = enabled;
+    }
+
+    void engine::set_metrics_path(const QString& path) {
+        m_metrics_path = path;
+    }
+
+    void engine::set_memory_limit(const qint64 bytes) {
+        m_memory_limit = std::max(bytes, qint64{0});
+    }
+
+    void engine::set_pipelined(const bool pipelined) {
+        m_pipelined = pipelined;
+    }
+
+    void engine::set_prefilter_threshold(const int threshold) {
+        m_prefilter_threshold = std::max(threshold, 0);
+    }
+
+    void engine::set_read_ahead(const qint64 bytes) {
+        m_read_ahead_bytes = std::max(bytes, qint64{0});
+    }
+
+    void engine::set_shard_count(const int shard_count) {
+        m_shard_count = std::max(shard_count, 1);
+    }
+
+    void engine::set_worker_count(const int worker_count) {
+        m_worker_count = std::max(worker_count, 1);
+    }
+
     void engine::signal_phase_change(const phase new_phase) const {
-        Q_EMIT phase_changed(new_phase);
+        signal_phases_change(new_phase);
         Q_EMIT progress_changed(0);
     }
 
-    bool thread_interrupted() {
-        return QThread::currentThread()->isInterruptionRequested();
+    void engine::signal_phases_change(const phases active_phases) const {
+
+        for (const auto latest : {phase::compare, phase::hash, phase::scan}) {
+            if (active_phases.testFlag(latest)) {
+                Q_EMIT phase_changed(latest);
+                break;
+            }
+        }
+
+        if (m_metrics) {
+            m_metrics->set_active_phases(static_cast<unsigned>(active_phases));
+        }
+
+        Q_EMIT phases_changed(active_phases);
     }
 }
 
@@ -1,22 +1,40 @@
 #ifndef MYRIAD_ENGINE_HPP
 #define MYRIAD_ENGINE_HPP
 
+#include "decision_queue.hpp"
 #include "image_info.hpp"
+#include "image_set.hpp"
+#include "metrics.hpp"
 #include "pairer.hpp"
+#include "ksr/function_view.hpp"
 #include "ksr/update_filter.hpp"
 
+#include <QJsonObject>
 #include <QObject>
+#include <QString>
 #include <QStringList>
-#include <unordered_set>
 
-class QString;
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace myriad {
 
+    class hash_cache;
+
+    ///
+    /// Performs the fundamental processing provided by Myriad, usually on a thread of its own. The
+    /// primary entry point is the merge() member function; refer to the documentation for that
+    /// function for more details.
     ///
-    /// A stateless class providing member functions that may be invoked from a different thread to
-    /// perform the fundamental processing provided by Myriad. The primary entry point is the
-    /// merge() member function; refer to the documentation for that function for more details.
+    /// An \ref engine holds the settings applied to each merge (the distance threshold, hash
+    /// variant, keep policy and so on), which are given by its \c set_ member functions. These
+    /// may only be called while no merge is in progress, from any thread, provided that the calls
+    /// happen before the next merge begins (as calls made before queuing a call to merge() do).
+    /// While a merge is in progress, the engine also holds the \ref decision_queue of decisions
+    /// requested from the user, and the metrics being collected for the merge; the only member
+    /// function that may be called then is make_decision(), which may be called from any thread.
     ///
 
     class engine : public QObject {
@@ -26,13 +44,37 @@ namespace myriad {
 
         ///
         /// Enumerates the processing states that the \ref engine passes through during a call to
-        /// merge(); refer to the documentation for that function for more details.
+        /// merge(); refer to the documentation for that function for more details. When merges
+        /// are pipelined, several phases may be in progress at once; the \ref phases flags
+        /// describe such a combination.
+        ///
+
+        enum class phase { scan = 0x1, hash = 0x2, compare = 0x4 };
+        Q_DECLARE_FLAGS(phases, phase)
+
+        ///
+        /// Enumerates the policies by which the \ref engine may decide which of two duplicate
+        /// images to keep: none at all, or the image with the greater number of pixels or the
+        /// larger file (each falling back on the other criterion to break ties), or whichever the
+        /// user chooses when asked by the decision_requested() signal. When two images are equal
+        /// by both criteria, an image in the collection is kept in preference to an input; between
+        /// two images in the collection, either may be kept.
         ///
 
-        enum class phase { scan, hash, compare };
+        enum class keep_policy { none, larger_resolution, larger_file, ask };
 
         explicit engine();
 
+        ///
+        /// Determines which of the duplicate images \p lhs and \p rhs (if either) should be
+        /// discarded under \p policy, which must not be \ref keep_policy::ask. If only one of them
+        /// is an input to a merge, it must be \p lhs, so that ties are decided in favour of the
+        /// collection.
+        ///
+
+        static discard_choice decide(
+            keep_policy policy, const image_info& lhs, const image_info& rhs);
+
         ///
         /// Merges a list of new image files with a "collection" of existing ones by identifying
         /// those new images that are visual duplicates of ones already in the collection and
@@ -42,15 +84,31 @@ namespace myriad {
         ///
         /// 1. The collection is scanned to identify all existing image files.
         /// 2. All images, both those specified as inputs and those already in the collection, are
-        ///    examined and their perceptual hashes are computed.
-        /// 3. All images in the collection are compared with each other to identify duplicates;
-        ///    when non-trivial duplicates are found, the \ref engine pauses and until the user
-        ///    indicates which version of the duplicated image should be kept.
+        ///    examined and their perceptual hashes are computed. The results are cached on disk
+        ///    between merges, so that images which have not changed since they were last examined
+        ///    need not be read again. With a prefilter (see set_prefilter_threshold()), only the
+        ///    images found by a cheaper hash to have candidate duplicates are hashed in full.
+        /// 3. All images in the collection are compared with each other to identify duplicates,
+        ///    which are grouped transitively into clusters; for each cluster, the \ref engine
+        ///    decides (or asks the user) which version of the duplicated image should be kept,
+        ///    and the others are discarded.
         /// 4. Each input image is considered in turn, and compared with each existing image in the
         ///    collection. If it is a duplicate of an existing image, the input image is either
         ///    discarded or used as a replacement for that existing image, depending upon the
         ///    outcome of a decision as in (3); otherwise, no action is taken.
         ///
+        /// While the user is asked to decide between a group of duplicates, the engine goes on to
+        /// the groups that don't involve any of the same images, so that the comparison phases
+        /// take no longer than the user takes to decide. Groups that do are deferred until the
+        /// decision is made, and are dropped if it discards one of their images.
+        ///
+        /// If the engine is set to pipeline merges, these phases overlap: images are hashed as soon
+        /// as the scan finds them, and each collection image is compared (as in (3) and then (4))
+        /// as soon as it has been hashed, so that the first duplicates may be presented long
+        /// before the whole collection has been examined. The inputs are still hashed in full
+        /// before comparisons begin. Since the images compared are not known in advance, the
+        /// engine waits for each decision the user is asked to make before continuing.
+        ///
         /// The process may be interrupted at any point by requesting an interruption on the
         /// engine's thread. If \p input_image_paths contains paths that are descendants of
         /// \p collection_path, they are treated as part of the collection and not as inputs.
@@ -59,54 +117,332 @@ namespace myriad {
         Q_INVOKABLE
         void merge(const QStringList& input_image_paths, const QString& collection_path) const;
 
+        ///
+        /// Sets the maximum Hamming distance between the perceptual hashes of two images for them
+        /// to be considered duplicates of each other. Must not be called while a merge operation
+        /// is in progress.
+        ///
+
+        void set_distance_threshold(int threshold);
+
+        ///
+        /// Makes the decision requested by the decision_requested() signal with the ticket
+        /// \p ticket, keeping the image at index \p keep_index of the paths given by the signal
+        /// and discarding the others, or keeping them all if \p keep_index is negative. Returns
+        /// \c false if no such decision is pending, as when the merge that requested it has since
+        /// ended, or if \p keep_index is not less than the number of paths, in which case the
+        /// decision remains pending. May be called from any thread while a merge operation is in
+        /// progress.
+        ///
+
+        bool make_decision(quint64 ticket, int keep_index);
+
+        ///
+        /// Sets the variant of the perceptual hash computed for each image (by default,
+        /// \ref phash_variant::compatible). The area variant is considerably cheaper for large
+        /// images, which it decodes at reduced resolution, but its hashes cannot be compared with
+        /// those of the compatible variant, so cached hashes of the other variant are recomputed.
+        /// Must not be called while a merge operation is in progress.
+        ///
+
+        void set_hash_variant(phash_variant variant);
+
+        ///
+        /// Sets the policy by which duplicate images are decided between during a merge operation
+        /// (by default, \ref keep_policy::none, under which every image is kept). Must not be
+        /// called while a merge operation is in progress.
+        ///
+
+        void set_keep_policy(keep_policy policy);
+
+        ///
+        /// Sets whether counters and timings are collected over the course of each merge operation
+        /// (by default, they are not). When they are, they are reported by the metrics_reported()
+        /// signal at the end of the operation, and written as JSON to the filesystem path set by
+        /// set_metrics_path() if there is one. Must not be called while a merge operation is in
+        /// progress.
+        ///
+
+        void set_metrics_enabled(bool enabled);
+        void set_metrics_path(const QString& path);
+
+        ///
+        /// Sets an approximate limit, in bytes, on the memory used by a merge operation (by
+        /// default, zero, for no limit). Under a limit, merges are phased whatever was set by
+        /// set_pipelined(), and the collection is held on disk rather than in memory, as described
+        /// for merge_external(). Must not be called while a merge operation is in progress.
+        ///
+
+        void set_memory_limit(qint64 bytes);
+
+        ///
+        /// Sets whether the phases of a merge operation are pipelined, as described for merge()
+        /// (by default, they are not). Must not be called while a merge operation is in progress.
+        ///
+
+        void set_pipelined(bool pipelined);
+
+        ///
+        /// Sets the greatest Hamming distance between the difference hashes of two images for
+        /// them to be hashed in full and compared (by default, zero, for no prefilter). With a
+        /// prefilter, a phased merge first computes the cheap \ref phash_variant::difference hash
+        /// of every image, from a thumbnail, and computes the hash set by set_hash_variant() only
+        /// for the images with a candidate duplicate under the prefilter. Only those images are
+        /// compared, and a pair must be within the threshold of both hashes to be considered
+        /// duplicates. The prefilter is ignored by the other kinds of merge. Must not be called
+        /// while a merge operation is in progress.
+        ///
+
+        void set_prefilter_threshold(int threshold);
+
+        ///
+        /// Sets the number of bytes of image files that may be read ahead of the threads that
+        /// decode them (by default, zero, for no read-ahead, each thread instead mapping the files
+        /// it decodes into memory). With a budget, the files to be hashed are read by a separate
+        /// \ref read_ahead stage, in an order chosen for locality on disk, so that on slow storage
+        /// the decoding threads find files already read rather than waiting on the disk. This
+        /// applies to the images hashed in bulk, which excludes the collection of a pipelined merge
+        /// and the images hashed by the worker processes of a sharded merge. Must not be called
+        /// while a merge operation is in progress.
+        ///
+
+        void set_read_ahead(qint64 bytes);
+
+        ///
+        /// Sets the number of shards into which the collection is divided by a merge operation (by
+        /// default, one, for none). With more than one, the merge is phased whatever was set by
+        /// set_pipelined(), and the shards are hashed and searched for candidate duplicates by
+        /// separate worker processes, as described for merge_sharded(). A memory limit set by
+        /// set_memory_limit() takes precedence. Must not be called while a merge operation is in
+        /// progress.
+        ///
+
+        void set_shard_count(int shard_count);
+
+        ///
+        /// Sets the number of threads used to read and hash images and to search for candidate
+        /// duplicates during a merge operation (by default, the number of processor cores
+        /// available). Must not be called while a merge operation is in progress.
+        ///
+
+        void set_worker_count(int worker_count);
+
     Q_SIGNALS:
 
+        ///
+        /// Emitted at the end of the hashing phase of a merge operation if any of the images found
+        /// could not be read. Those images are excluded from the remainder of the operation.
+        ///
+
+        void images_unreadable(const QStringList& paths) const;
+
+        ///
+        /// Emitted during the comparison phase of a merge operation whenever the image at
+        /// \p path is discarded as a duplicate of the image at \p kept_path.
+        ///
+
+        void image_discarded(const QString& path, const QString& kept_path) const;
+
+        ///
+        /// Emitted during the comparison phase of a merge operation under
+        /// \ref keep_policy::ask, to ask which of the duplicate images at \p paths to keep. The
+        /// answer is given by passing \p ticket to make_decision(), and the merge continues in
+        /// the meantime as far as it can without it.
+        ///
+
+        void decision_requested(quint64 ticket, const QStringList& paths) const;
+
         void input_count_changed(int file_count, int folder_count) const;
+
+        ///
+        /// Emitted at the end of a merge operation, if metrics are enabled, with the counters and
+        /// timings collected over its course; refer to \ref merge_metrics for their meaning.
+        ///
+
+        void metrics_reported(const QJsonObject& metrics) const;
+
+        ///
+        /// Emitted if a merge operation is abandoned because the temporary file at \p path, to
+        /// which the collection was being written under a memory limit or by the worker processes
+        /// of a sharded merge, could not be written or read back. A worker that fails is run
+        /// again once before the merge is abandoned.
+        ///
+
+        void merge_failed(const QString& path) const;
+
+        ///
+        /// Emitted whenever the merge operation enters a new phase. When several phases are in
+        /// progress at once, this reports the latest of them to have begun; the phases_changed()
+        /// signal, emitted at the same times, reports all of them.
+        ///
+
         void phase_changed(phase new_phase) const;
+        void phases_changed(phases active_phases) const;
         void progress_changed(int percent_complete) const;
 
     private:
 
+        ///
+        /// Determines which of the duplicate images \p lhs and \p rhs (if either) should be
+        /// discarded.
+        ///
+
+        discard_choice appraise(const image_info& lhs, const image_info& rhs) const;
+
+        ///
+        /// Determines which image of \p group, a group of duplicates, should be kept in
+        /// preference to all of the others, returning its index, or \c std::nullopt if none of
+        /// them should be discarded. Under \ref keep_policy::ask, this waits for the user's
+        /// decision.
+        ///
+
+        keep_choice appraise(const std::vector<image_info>& group) const;
+
+        ///
+        /// Determines which image of \p group should be kept as above, unless the user must be
+        /// asked; in that case, the decision is requested under \p tag and an empty
+        /// \c std::optional is returned, the decision being collected later by take_decisions().
+        ///
+
+        std::optional<keep_choice> appraise(
+            const std::vector<image_info>& group, std::size_t tag) const;
+
+        ///
+        /// Returns the tags and outcomes of the decisions the user has made since this was last
+        /// called, emitting the image_discarded() signal for each image they discard. If \p block
+        /// is \c true, this waits for at least one decision unless an interruption is requested
+        /// on the engine's thread.
+        ///
+
+        std::vector<std::pair<std::size_t, keep_choice>> take_decisions(bool block) const;
+
+        void request_decision(const std::vector<image_info>& group, std::size_t tag) const;
+        void signal_discards(const QStringList& paths, const keep_choice& choice) const;
+
         ///
         /// Compares images as specified by \p pair_strategy, emitting the progress_changed() signal
         /// to indicate how close to completion this process is. A single merge operation may use a
-        /// sequence of different \p pairer strategies; because of this, a call to compare_images()
+        /// sequence of different pairing strategies; because of this, a call to compare_images()
         /// need not take the emitted progress from 0 to 100. \p start_count specifies how many
         /// images have already been compared before this particular call to compare_images() was
         /// made; \p total_count specifies how many images need to be compared before that phase of
         /// the merge operation is considered complete. This operation may be interrupted by
-        /// requesting an interruption on the engine's thread.
+        /// requesting an interruption on the engine's thread. \p pair_strategy is a
+        /// \ref deferred_merge_pairer, and \p args are passed to its pair() member function after
+        /// the request for each group; each group decided counts as a single comparison.
         ///
 
-        int compare_images(pairer& pair_strategy, int start_count, int total_count) const;
+        template <typename Pairer, typename... Args>
+        int compare_images(
+            Pairer& pair_strategy, int start_count, int total_count, Args&&... args) const;
 
         ///
         /// Constructs an \ref image_info object for each filesystem path in \p paths, emitting the
-        /// progress_changed() signal to indicate how close to completion this process is. A single
-        /// merge operation may hash more than one group of image paths; because of this, a call to
-        /// hash_images() need not take the emitted percentage progress from 0 to 100.
-        /// \p start_count specifies how many images have already been hashed before this particular
-        /// call to hash_images() was made; \p total_count specifies how many images need to be
-        /// hashed before that phase of the merge operation is considered complete. This operation
-        /// may be interrupted by requesting an interruption on the engine's thread.
+        /// progress_changed() signal to indicate how close to completion this process is. Images
+        /// with valid entries in \p cache are constructed from those entries rather than being read
+        /// from disk; all other images are hashed with the variant of \p cache, and added to it. Of
+        /// a set of files that are byte-for-byte identical, only one is decoded and hashed, and the
+        /// others are given its attributes. Images are hashed in parallel, and the paths of any
+        /// that cannot be read are appended to \p failed_paths rather than interrupting the
+        /// operation. A single merge operation may hash more than one group of image paths; because
+        /// of this, a call to hash_images() need not take the emitted percentage progress from 0 to
+        /// 100. \p start_count specifies how many images have already been hashed before this
+        /// particular call to hash_images() was made; \p total_count specifies how many images need
+        /// to be hashed before that phase of the merge operation is considered complete. This
+        /// operation may be interrupted by requesting an interruption on the engine's thread.
         ///
 
         image_set hash_images(
-            const QStringList &paths, int start_count, int total_count) const;
+            const QStringList &paths, hash_cache& cache, QStringList& failed_paths,
+            int start_count, int total_count) const;
+
+        ///
+        /// Writes \p cache back to disk, pruning it if \p prune is \c true, as hash_cache::save()
+        /// does. Failing to write the cache costs the next merge time, but doesn't affect the
+        /// outcome of this one, so errors are ignored.
+        ///
+
+        void save_cache(hash_cache& cache, bool prune) const;
+
+        ///
+        /// Performs the phases of merge() one after another, each running to completion before
+        /// the next begins.
+        ///
+
+        void merge_phased(
+            const QStringList& input_image_paths, const QString& collection_path) const;
+
+        ///
+        /// Hashes the images of a phased merge through the prefilter set by
+        /// set_prefilter_threshold(): every image at \p input_image_paths and
+        /// \p collection_image_paths is given its difference hash (through a \ref hash_cache of
+        /// its own), and the images with candidates under that hash are then hashed in full into
+        /// \p inputs and \p collection, dropping inputs within the collection. The paths of any
+        /// images that could not be read are appended to \p failed_paths.
+        ///
+
+        void hash_prefiltered(
+            const QStringList& input_image_paths, const QStringList& collection_image_paths,
+            const QString& collection_path, image_set& inputs, image_set& collection,
+            QStringList& failed_paths) const;
 
         ///
-        /// If \p base_path is the filesystem path to a directory, recursively scans the descendants
-        /// of that directory and appends to \p image_paths the paths of all supported image files
-        /// therein; if \p base_path is the path to a file, that file is itself appended to
-        /// \p image_paths if it is supported. \p folder_count is set to the number of directories
-        /// that were scanned during this operation. As this scan is performed, the
-        /// input_count_changed() signal is emitted to indicate how many supported image files have
-        /// been found and how many directories have been scanned. This operation may be interrupted
-        /// by requesting an interruption on the engine's thread.
+        /// Performs the phases of merge() concurrently: the collection is scanned on one thread
+        /// and hashed on the worker threads, while the engine's thread compares each image as
+        /// soon as it has been hashed. Stages are connected by bounded queues, so a fast stage is
+        /// held back by a slow one rather than buffering an unbounded number of results.
         ///
 
-        void scan_for_images(
-            const QString &base_path, QStringList &image_paths, int &folder_count) const;
+        void merge_pipelined(
+            const QStringList& input_image_paths, const QString& collection_path) const;
+
+        ///
+        /// Performs the phases of merge() one after another within the limit set by
+        /// set_memory_limit(). The paths found by the scan are written to a temporary file, and
+        /// then hashed a chunk at a time, each chunk's records being appended to an
+        /// \ref image_spill so that only their perceptual hashes remain in memory. Candidates are
+        /// found from those hashes, and the images are compared in passes planned by a
+        /// \ref pass_planner, reading back the records of only those images that have duplicates,
+        /// a chunk at a time. The inputs are held in memory throughout. Byte-identical copies are
+        /// only recognised (and decoded once) within a chunk.
+        ///
+
+        void merge_external(
+            const QStringList& input_image_paths, const QString& collection_path) const;
+
+        ///
+        /// Performs the phases of merge() one after another, dividing the collection as found by
+        /// the scan into contiguous shards of paths. Each shard is hashed by a worker process
+        /// (this executable, run as described for run_shard_worker()), which writes its images to
+        /// a shard file; other workers then find the candidate duplicates within each shard and
+        /// between each pair of shards from the hashes in those files. Up to one worker per shard
+        /// runs at once, each with an equal share of the worker threads. The engine combines the
+        /// shard files into a single collection and the candidate files into a single sorted list,
+        /// and compares the images just as merge_phased() does. The inputs are hashed, and
+        /// searched for candidates, by the engine itself. Workers only read the \ref hash_cache;
+        /// the engine adds what they had to hash, but doesn't prune the cache.
+        ///
+
+        void merge_sharded(
+            const QStringList& input_image_paths, const QString& collection_path) const;
+
+        ///
+        /// If \p base_path is the filesystem path to a directory, scans the descendants of that
+        /// directory and calls \p found with the path of each supported image file therein; if
+        /// \p base_path is the path to a file, \p found is called with that path if the file is
+        /// supported. Directories are read in parallel by a \ref directory_scanner using the
+        /// engine's worker threads, so paths are found in no particular order. \p image_count and
+        /// \p folder_count are incremented by the number of supported images found and
+        /// directories scanned. As this scan is performed, the input_count_changed() signal is
+        /// emitted to indicate those numbers. The scan stops early, returning \c false, if
+        /// \p found returns \c false or an interruption is requested on the engine's thread;
+        /// otherwise, it returns \c true. This may be called from a thread other than the
+        /// engine's, in which case it can only be stopped by means of \p found.
+        ///
+
+        bool scan_for_images(
+            const QString& base_path, ksr::function_view<bool(const QString&)> found,
+            int& image_count, int& folder_count) const;
 
         ///
         /// Emits the phase_changed() signal to indicate that a merge operation being performed by
@@ -116,10 +452,30 @@ namespace myriad {
 
         void signal_phase_change(phase new_phase) const;
 
+        ///
+        /// Emits the phase_changed() and phases_changed() signals to indicate that the phases in
+        /// \p active_phases are now in progress, without resetting the current progress.
+        ///
+
+        void signal_phases_change(phases active_phases) const;
+
         mutable ksr::sampled_filter<int, int> m_input_signaller;
+        mutable decision_queue m_decisions;
+        mutable merge_metrics* m_metrics = nullptr;
+        QString m_metrics_path;
+        qint64 m_memory_limit = 0;
+        qint64 m_read_ahead_bytes = 0;
+        int m_worker_count;
+        int m_shard_count = 1;
+        int m_distance_threshold = 8;
+        int m_prefilter_threshold = 0;
+        phash_variant m_hash_variant = phash_variant::compatible;
+        keep_policy m_keep_policy = keep_policy::none;
+        bool m_metrics_enabled = false;
+        bool m_pipelined = false;
     };
-
-    bool thread_interrupted();
 }
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(myriad::engine::phases)
+
 #endif
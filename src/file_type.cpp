@@ -0,0 +1,228 @@
+#include "file_type.hpp"
+#include "hash.hpp"
+
+#include <QFile>
+#include <QImageReader>
+#include <QList>
+#include <QMimeDatabase>
+#include <QMimeType>
+#include <QString>
+
+#include <array>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+using namespace std::literals::string_view_literals;
+
+namespace myriad {
+
+    namespace {
+
+        ///
+        /// Determines an \ref image_format code identifying the image format named \p format_name
+        /// by \c QImageReader. If the format is not one that receives special treatment,
+        /// \c image_format::other is returned.
+        ///
+
+        image_format format(const QByteArray& format_name) {
+
+            using format_name_pair = std::pair<const char*, image_format>;
+            static const auto formats_by_name = std::array<format_name_pair, 5>{{
+                {"bmp",  image_format::bmp},
+                {"gif",  image_format::gif},
+                {"jpeg", image_format::jpeg},
+                {"jpg",  image_format::jpeg},
+                {"png",  image_format::png}
+            }};
+
+            for (const auto& [name, format] : formats_by_name) {
+                if (format_name == name) {
+                    return format;
+                }
+            }
+
+            return image_format::other;
+        }
+
+        ///
+        /// Gets a list of the names of all image formats that Myriad is able to process.
+        ///
+
+        const QList<QByteArray>& supported_formats() {
+            static const auto result = QImageReader::supportedImageFormats();
+            return result;
+        }
+
+        file_type type_of_format(const QByteArray& format_name) {
+
+            if (!supported_formats().contains(format_name)) {
+                return file_type{};
+            }
+
+            return file_type{format_name, format(format_name)};
+        }
+
+        ///
+        /// Gets a table mapping lower-case file extensions to the types of the files they denote.
+        /// \c QImageReader names most formats by their usual extensions; the exceptions (and
+        /// extensions that are synonyms for other formats) are translated here.
+        ///
+
+        const std::unordered_map<QString, file_type>& types_by_extension() {
+
+            static const auto result = [] {
+
+                using alias_pair = std::pair<const char*, const char*>;
+                static const auto aliases = std::array<alias_pair, 4>{{
+                    {"jfif", "jpeg"},
+                    {"jpe",  "jpeg"},
+                    {"jpg",  "jpeg"},
+                    {"tif",  "tiff"}
+                }};
+
+                auto types = std::unordered_map<QString, file_type>{};
+                for (const auto& format_name : supported_formats()) {
+                    types.emplace(QString::fromLatin1(format_name).toLower(),
+                        type_of_format(format_name));
+                }
+
+                for (const auto& [extension, format_name] : aliases) {
+                    const auto type = type_of_format(format_name);
+                    if (type.supported()) {
+                        types[QString::fromLatin1(extension)] = type;
+                    }
+                }
+
+                return types;
+            }();
+
+            return result;
+        }
+
+        ///
+        /// Determines whether \c QMimeDatabase associates the extension \p extension of the
+        /// filesystem path \p path with some type of file, by its name alone. The names of backup
+        /// files (such as those ending in a tilde) are taken to say nothing about their contents.
+        /// Results are remembered by extension, since looking the type up is comparatively slow.
+        ///
+
+        bool extension_known(const QString& path, const QString& extension) {
+
+            static auto mutex = std::mutex{};
+            static auto known_extensions = std::unordered_map<QString, bool>{};
+
+            const auto lock = std::lock_guard<std::mutex>{mutex};
+            if (const auto iter = known_extensions.find(extension);
+                iter != std::end(known_extensions)) {
+
+                return iter->second;
+            }
+
+            const auto type = QMimeDatabase{}.mimeTypeForFile(path, QMimeDatabase::MatchExtension);
+            const auto result = !type.isDefault()
+                && type.name() != QStringLiteral("application/x-trash");
+
+            known_extensions.emplace(extension, result);
+            return result;
+        }
+
+        struct signature_part {
+            std::size_t offset;
+            std::string_view bytes;
+        };
+
+        ///
+        /// The bytes by which a file of the format named \c format_name is recognised: those of
+        /// \c first, and those of \c second where they aren't empty.
+        ///
+
+        struct signature {
+            const char* format_name;
+            signature_part first;
+            signature_part second;
+        };
+
+        constexpr auto signatures = std::array<signature, 8>{{
+            {"jpeg", {0, "\xFF\xD8\xFF"sv}, {}},
+            {"png",  {0, "\x89PNG\r\n\x1A\n"sv}, {}},
+            {"gif",  {0, "GIF87a"sv}, {}},
+            {"gif",  {0, "GIF89a"sv}, {}},
+            {"bmp",  {0, "BM"sv}, {}},
+            {"webp", {0, "RIFF"sv}, {8, "WEBP"sv}},
+            {"tiff", {0, "II*\0"sv}, {}},
+            {"tiff", {0, "MM\0*"sv}, {}}
+        }};
+
+        constexpr auto signature_size = std::size_t{12};
+    }
+
+    std::optional<file_type> file_type_from_path(const QString& path) {
+
+        const auto name_start = path.lastIndexOf(QChar{'/'}) + 1;
+        const auto dot = path.lastIndexOf(QChar{'.'});
+        if (dot <= name_start) {
+            return std::nullopt;
+        }
+
+        const auto extension = path.mid(dot + 1).toLower();
+        const auto& types = types_by_extension();
+        if (const auto iter = types.find(extension); iter != std::end(types)) {
+            return iter->second;
+        }
+
+        if (extension_known(path, extension)) {
+            return file_type{};
+        }
+
+        return std::nullopt;
+    }
+
+    file_type file_type_from_content(const QByteArray& data) {
+
+        const auto contents = std::string_view{
+            data.constData(), static_cast<std::size_t>(data.size())};
+
+        const auto matches = [&contents](const signature_part& part) {
+            return contents.size() >= part.offset + part.bytes.size()
+                && contents.compare(part.offset, part.bytes.size(), part.bytes) == 0;
+        };
+
+        for (const auto& [format_name, first, second] : signatures) {
+            if (matches(first) && matches(second)) {
+                return type_of_format(format_name);
+            }
+        }
+
+        return file_type{};
+    }
+
+    file_type detect_file_type(const QString& path) {
+
+        if (const auto type = file_type_from_path(path)) {
+            return *type;
+        }
+
+        QFile file{path};
+        if (!file.open(QIODevice::ReadOnly)) {
+            return file_type{};
+        }
+
+        return file_type_from_content(file.read(signature_size));
+    }
+
+    bool may_be_supported(const QString& path) {
+
+        if (const auto type = file_type_from_path(path)) {
+            return type->supported();
+        }
+
+        const auto name_start = path.lastIndexOf(QChar{'/'}) + 1;
+        if (path.lastIndexOf(QChar{'.'}) > name_start) {
+            return true;
+        }
+
+        return detect_file_type(path).supported();
+    }
+}
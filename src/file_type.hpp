@@ -0,0 +1,72 @@
+#ifndef MYRIAD_FILE_TYPE_HPP
+#define MYRIAD_FILE_TYPE_HPP
+
+#include "image_info.hpp"
+
+#include <QByteArray>
+
+#include <optional>
+
+class QString;
+
+namespace myriad {
+
+    ///
+    /// Describes the type of a file, as far as Myriad is concerned. \c name is the name by which
+    /// \c QImageReader identifies the format of the file (which may be passed to it to skip its
+    /// own detection), and is empty if the file is not an image that Myriad is able to process.
+    ///
+
+    struct file_type {
+
+        bool supported() const {
+            return !name.isEmpty();
+        }
+
+        QByteArray name;
+        image_format format = image_format::other;
+    };
+
+    ///
+    /// Determines the type of the file at the filesystem path \p path from the extension of that
+    /// path alone, without any I/O. An extension that \c QMimeDatabase associates with some other
+    /// type of file is taken to mean the file is unsupported. If \p path has no extension, or one
+    /// that isn't associated with any type (as in \c photo.jpg_large or \c photo.jpeg~), an
+    /// empty \c std::optional is returned instead, since its type can only be determined by
+    /// examining its contents. May only be called after the \c QCoreApplication instance has been
+    /// created, but may then be called from any thread.
+    ///
+
+    std::optional<file_type> file_type_from_path(const QString& path);
+
+    ///
+    /// Determines the type of a file from the leading bytes of its contents, \p data, by
+    /// recognising the signatures of common image formats; the first 12 bytes suffice for all of
+    /// these. Formats without a recognisable signature are reported as unsupported. May only be
+    /// called after the \c QCoreApplication instance has been created, but may then be called
+    /// from any thread.
+    ///
+
+    file_type file_type_from_content(const QByteArray& data);
+
+    ///
+    /// Determines the type of the file at the filesystem path \p path from its extension if it
+    /// has one, and otherwise by reading the first few bytes of the file. Thread-safe as for
+    /// file_type_from_path().
+    ///
+
+    file_type detect_file_type(const QString& path);
+
+    ///
+    /// Determines whether the file at the filesystem path \p path may be an image that Myriad is
+    /// able to process, and so should be hashed: that is, whether its extension is associated with
+    /// a supported image format, or with no type at all. In the latter case, the file is only
+    /// examined when it is hashed, as \ref image_info recognises the format from its contents
+    /// anyway; only a path without an extension requires the file to be read here, as for
+    /// detect_file_type(). Thread-safe as for file_type_from_path().
+    ///
+
+    bool may_be_supported(const QString& path);
+}
+
+#endif
@@ -1,9 +1,26 @@
 #include "hash.hpp"
-#include "image_info.hpp"
 
 #include <QString>
 
-using myriad::image_info;
+namespace myriad {
+
+    // 64-bit FNV-1a over the UTF-16 code units of the string. This is not a particularly strong
+    // hash, but filesystem paths are short and the cost of a collision is only a failed string
+    // comparison on lookup.
+
+    std::uint64_t stable_hash(const QString& value) noexcept {
+
+        constexpr auto offset_basis = std::uint64_t{0xcbf29ce484222325};
+        constexpr auto prime = std::uint64_t{0x100000001b3};
+
+        auto result = offset_basis;
+        for (const auto ch : value) {
+            result = (result ^ ch.unicode()) * prime;
+        }
+
+        return result;
+    }
+}
 
 namespace std {
 
@@ -16,8 +33,4 @@ namespace std {
     std::size_t hash<QString>::operator()(const QString& value) const noexcept {
         return qHash(value);
     }
-
-    std::size_t hash<image_info>::operator()(const image_info& value) const noexcept {
-        return hash<QString>{}(value.path());
-    }
 }
@@ -2,11 +2,19 @@
 #define MYRIAD_HASH_HPP
 
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 
 class QString;
 namespace myriad {
-    class image_info;
+
+    ///
+    /// Computes a 64-bit hash of \p value that, unlike <tt>std::hash<QString></tt>, is stable
+    /// between runs of the program (\c qHash() is randomly seeded per process), and is therefore
+    /// suitable for use as a key in data persisted to disk.
+    ///
+
+    std::uint64_t stable_hash(const QString& value) noexcept;
 }
 
 namespace std {
@@ -15,11 +23,6 @@ namespace std {
     struct hash<QString> {
         std::size_t operator()(const QString& value) const noexcept;
     };
-
-    template <>
-    struct hash<myriad::image_info> {
-        std::size_t operator()(const myriad::image_info& value) const noexcept;
-    };
 }
 
 #endif
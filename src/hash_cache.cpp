@@ -0,0 +1,285 @@
+#include "hash_cache.hpp"
+#include "exception.hpp"
+#include "hash.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <unordered_set>
+
+namespace myriad {
+
+    // The backing file consists of a header, followed by a table of fixed-size entries sorted by
+    // the stable hash of their paths (so that lookups can binary search the mapped table directly),
+    // followed by the UTF-16 data of all of those paths concatenated together. Bump cache_version
+    // whenever the layout of any of these, or the meaning of any stored attribute, changes. (The
+    // variant of each entry's hash occupies what was previously padding, which was always zero;
+    // since the compatible variant is also zero, this needed no change of version.)
+
+    struct hash_cache::header {
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t entry_size;
+        std::uint64_t entry_count;
+        std::uint64_t string_length;
+    };
+
+    struct hash_cache::entry {
+        std::uint64_t path_hash;
+        std::uint64_t file_size;
+        std::int64_t modified;
+        std::uint64_t phash;
+        std::uint64_t checksum;
+        std::uint64_t path_offset;
+        std::uint32_t path_length;
+        std::int32_t width;
+        std::int32_t height;
+        std::uint8_t format;
+        std::uint8_t variant;
+        std::array<std::uint8_t, 2> reserved;
+    };
+
+    namespace {
+
+        constexpr auto cache_magic = std::array<char, 8>{{'M', 'Y', 'R', 'I', 'A', 'D', 'H', 'C'}};
+        constexpr auto cache_version = std::uint32_t{2};
+
+        std::int64_t modified_msecs(const QDateTime& time) {
+            return time.toMSecsSinceEpoch();
+        }
+    }
+
+    hash_cache::hash_cache(const QString& cache_path, const phash_variant variant)
+      : m_path{cache_path}, m_variant{variant} {
+
+        static_assert(std::is_trivially_copyable<header>::value, "");
+        static_assert(std::is_trivially_copyable<entry>::value, "");
+        static_assert(sizeof(header) % alignof(entry) == 0, "");
+
+        load();
+    }
+
+    std::optional<image_info> hash_cache::find(const QFileInfo& file_info) {
+
+        const auto path = file_info.absoluteFilePath();
+        const auto path_hash = stable_hash(path);
+
+        const auto begin = entries();
+        const auto end = begin + m_entry_count;
+        auto iter = std::lower_bound(begin, end, path_hash,
+            [](const entry& item, const std::uint64_t value) { return item.path_hash < value; });
+
+        for (; iter != end && iter->path_hash == path_hash; ++iter) {
+
+            if (entry_path(*iter) != path) {
+                continue;
+            }
+
+            // A stale entry is left unretained, so that it is dropped on the next pruning save()
+            // (by which point it will usually have been superseded by a call to insert()).
+
+            if (iter->file_size != static_cast<std::uint64_t>(file_info.size())
+                || iter->modified != modified_msecs(file_info.lastModified())
+                || iter->variant != static_cast<std::uint8_t>(m_variant)) {
+                return std::nullopt;
+            }
+
+            m_retained[std::distance(begin, iter)] = true;
+            return image_info{
+                path, iter->file_size, file_info.lastModified(), iter->width, iter->height,
+                static_cast<image_format>(iter->format), iter->checksum, iter->phash};
+        }
+
+        return std::nullopt;
+    }
+
+    void hash_cache::insert(const image_info& info) {
+        if (info.last_modified().isValid()) {
+            m_added.push_back(info);
+        }
+    }
+
+    qint64 hash_cache::save(const bool prune) {
+
+        struct pending {
+            entry item;
+            QString path;
+        };
+
+        auto items = std::vector<pending>{};
+        auto added_paths = std::unordered_set<QString>{};
+
+        for (auto iter = std::crbegin(m_added); iter != std::crend(m_added); ++iter) {
+
+            auto path = iter->path();
+            if (!added_paths.insert(path).second) {
+                continue;
+            }
+
+            auto item = entry{};
+            item.path_hash = stable_hash(path);
+            item.file_size = iter->file_size();
+            item.modified = modified_msecs(iter->last_modified());
+            item.phash = iter->phash();
+            item.width = iter->width();
+            item.height = iter->height();
+            item.checksum = iter->checksum();
+            item.format = static_cast<std::uint8_t>(iter->format());
+            item.variant = static_cast<std::uint8_t>(m_variant);
+
+            items.push_back({item, std::move(path)});
+        }
+
+        const auto mapped = entries();
+        for (auto index = std::size_t{0}; index < m_entry_count; ++index) {
+
+            if (prune && !m_retained[index]) {
+                continue;
+            }
+
+            auto path = entry_path(mapped[index]);
+            if (added_paths.count(path) == 0) {
+                items.push_back({mapped[index], std::move(path)});
+            }
+        }
+
+        std::sort(std::begin(items), std::end(items), [](const pending& lhs, const pending& rhs) {
+            return lhs.item.path_hash < rhs.item.path_hash;
+        });
+
+        auto table = std::vector<entry>{};
+        table.reserve(items.size());
+
+        auto string_length = std::uint64_t{0};
+        for (auto& pending_item : items) {
+            pending_item.item.path_offset = string_length;
+            pending_item.item.path_length = pending_item.path.size();
+            string_length += pending_item.path.size();
+            table.push_back(pending_item.item);
+        }
+
+        const auto file_header = header{
+            cache_magic, cache_version, sizeof(entry), table.size(), string_length};
+
+        QSaveFile file{m_path};
+        if (!file.open(QIODevice::WriteOnly)) {
+            throw file_io_error{m_path};
+        }
+
+        file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+        file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(entry));
+        for (const auto& pending_item : items) {
+            const auto& path = pending_item.path;
+            file.write(reinterpret_cast<const char*>(path.utf16()), path.size() * sizeof(char16_t));
+        }
+
+        // QSaveFile discards everything if any write failed, so checking the commit suffices.
+
+        if (!file.commit()) {
+            throw file_io_error{m_path};
+        }
+
+        load();
+        return gsl::narrow_cast<qint64>(
+            sizeof(file_header) + table.size() * sizeof(entry) + string_length * sizeof(char16_t));
+    }
+
+    auto hash_cache::entries() const -> const entry* {
+        return (m_data == nullptr)
+            ? nullptr
+            : reinterpret_cast<const entry*>(m_data + sizeof(header));
+    }
+
+    QString hash_cache::entry_path(const entry& item) const {
+
+        if (item.path_offset > m_string_length
+            || item.path_length > m_string_length - item.path_offset) {
+            return {};
+        }
+
+        // The returned string refers directly to the mapped data rather than copying it, so must
+        // not outlive the current mapping.
+
+        const auto strings = m_data + sizeof(header) + m_entry_count * sizeof(entry);
+        const auto chars = reinterpret_cast<const QChar*>(strings) + item.path_offset;
+        return QString::fromRawData(chars, gsl::narrow_cast<int>(item.path_length));
+    }
+
+    void hash_cache::load() {
+
+        if (m_data != nullptr) {
+            m_file.unmap(const_cast<uchar*>(m_data));
+            m_data = nullptr;
+        }
+
+        m_file.close();
+        m_entry_count = 0;
+        m_string_length = 0;
+        m_retained.clear();
+        m_added.clear();
+
+        m_file.setFileName(m_path);
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+
+        const auto file_size = static_cast<std::uint64_t>(m_file.size());
+        if (file_size < sizeof(header)) {
+            m_file.close();
+            return;
+        }
+
+        const auto data = m_file.map(0, m_file.size());
+        if (data == nullptr) {
+            m_file.close();
+            return;
+        }
+
+        auto file_header = header{};
+        std::memcpy(&file_header, data, sizeof(header));
+
+        const auto max_entry_count = (file_size - sizeof(header)) / sizeof(entry);
+        const auto valid = file_header.magic == cache_magic
+            && file_header.version == cache_version
+            && file_header.entry_size == sizeof(entry)
+            && file_header.entry_count <= max_entry_count
+            && file_header.string_length <=
+                (file_size - sizeof(header) - file_header.entry_count * sizeof(entry))
+                    / sizeof(char16_t);
+
+        if (!valid) {
+            m_file.unmap(data);
+            m_file.close();
+            return;
+        }
+
+        m_data = data;
+        m_entry_count = file_header.entry_count;
+        m_string_length = file_header.string_length;
+        m_retained = std::vector<std::atomic<bool>>(m_entry_count);
+    }
+
+    QString collection_cache_path(const QString& collection_path, const phash_variant variant) {
+
+        const auto cache_dir = QDir{
+            QStandardPaths::writableLocation(QStandardPaths::CacheLocation)};
+
+        cache_dir.mkpath(QStringLiteral("."));
+
+        const auto key = stable_hash(QFileInfo{collection_path}.absoluteFilePath());
+        const auto suffix = (variant == phash_variant::difference)
+            ? QStringLiteral(".difference.cache")
+            : QStringLiteral(".cache");
+
+        return cache_dir.filePath(QString::number(key, 16) + suffix);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef MYRIAD_HASH_CACHE_HPP
+#define MYRIAD_HASH_CACHE_HPP
+
+#include "image_info.hpp"
+
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+class QFileInfo;
+
+namespace myriad {
+
+    ///
+    /// A persistent index of the attributes of images that have previously been hashed, allowing
+    /// the expensive work done by the \ref image_info constructor to be skipped for files that
+    /// have not changed since they were last examined. The index is stored in a single file on
+    /// disk, which is memory-mapped when the \ref hash_cache is constructed; lookups are then
+    /// performed directly against the mapped data, so that loading the cache costs nothing
+    /// beyond the page faults incurred by the entries actually examined. Entries are keyed by
+    /// absolute path, and are only considered valid if the size and modification time of the file
+    /// they describe match those recorded when the entry was created, and their perceptual hashes
+    /// were computed with the variant the cache is being used for.
+    ///
+    /// The file format is native-endian and is not intended to be portable between machines.
+    ///
+
+    class hash_cache {
+    public:
+
+        ///
+        /// Creates a cache backed by the file at the filesystem path \p cache_path, which is mapped
+        /// into memory if it exists. If that file does not exist or does not contain valid cache
+        /// data, the cache is initially empty. Perceptual hashes looked up in or added to the cache
+        /// are taken to have been computed as specified by \p variant.
+        ///
+
+        explicit hash_cache(
+            const QString& cache_path, phash_variant variant = phash_variant::compatible);
+
+        hash_cache(const hash_cache&) = delete;
+        hash_cache& operator=(const hash_cache&) = delete;
+
+        ///
+        /// Looks up the attributes of the file described by \p file_info, returning an
+        /// \ref image_info object constructed from those attributes if a valid entry for that file
+        /// exists, or an empty \c std::optional otherwise. This may be called concurrently from
+        /// multiple threads, and concurrently with insert(), but not concurrently with save().
+        ///
+
+        std::optional<image_info> find(const QFileInfo& file_info);
+
+        ///
+        /// Records the attributes of \p info so that they will be available from subsequent calls
+        /// to find() once save() has been called. The entry is keyed by the size and modification
+        /// time held by \p info, which should have been found before the file was read; if its
+        /// modification time is unknown, \p info is ignored.
+        ///
+
+        void insert(const image_info& info);
+
+        ///
+        /// Writes the current contents of the cache back to disk, replacing the backing file
+        /// atomically. If \p prune is \c true, entries that have not been looked up by a call to
+        /// find() or added by a call to insert() since the cache was loaded are dropped; this keeps
+        /// the cache from accumulating entries for files that no longer exist, but should only be
+        /// done once every file of interest has been looked up. Returns the size in bytes of the
+        /// file written.
+        /// \throws file_io_error if the cache file could not be written.
+        ///
+
+        qint64 save(bool prune);
+
+        phash_variant variant() const {
+            return m_variant;
+        }
+
+    private:
+
+        struct entry;
+        struct header;
+
+        const entry* entries() const;
+        QString entry_path(const entry& item) const;
+        void load();
+
+        QString m_path;
+        QFile m_file;
+        phash_variant m_variant;
+
+        const uchar* m_data = nullptr;
+        std::size_t m_entry_count = 0;
+        std::uint64_t m_string_length = 0;
+
+        std::vector<std::atomic<bool>> m_retained;
+        std::vector<image_info> m_added;
+    };
+
+    ///
+    /// Determines the filesystem path of the \ref hash_cache used for the collection rooted at
+    /// \p collection_path to hold hashes of \p variant. Caches are kept in the user's cache
+    /// directory (rather than within the collection itself) so that read-only collections may
+    /// still benefit from them. The DCT-based variants share a cache, one replacing the other;
+    /// difference hashes are kept in a cache of their own, since an image hashed in full for a
+    /// merge filtered by them needs both.
+    ///
+
+    QString collection_cache_path(
+        const QString& collection_path, phash_variant variant = phash_variant::compatible);
+}
+
+#endif
@@ -0,0 +1,179 @@
+#include "identical_files.hpp"
+#include "digest.hpp"
+#include "exception.hpp"
+#include "parallel.hpp"
+
+#include "ksr/algorithm.hpp"
+
+#include <QFile>
+#include <QString>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <optional>
+
+namespace myriad {
+
+    namespace {
+
+        using group_list = std::vector<std::vector<int>>;
+        using key_list = std::vector<std::optional<std::uint64_t>>;
+
+        ///
+        /// The number of bytes read from each end of a file when its contents are first
+        /// compared. Files that differ usually do so within their headers (which, for images,
+        /// record their dimensions and often a timestamp) or within the last stretch of their
+        /// compressed data, so this rules out all but a very few files that are not identical.
+        ///
+
+        constexpr auto edge_size = qint64{4096};
+
+        std::optional<std::uint64_t> edge_digest(const QString& path, const qint64 size) {
+
+            QFile file{path};
+            if (!file.open(QIODevice::ReadOnly)) {
+                return std::nullopt;
+            }
+
+            if (size <= 2 * edge_size) {
+                const auto data = file.readAll();
+                return digest_of(data.constData(), gsl::narrow_cast<std::size_t>(data.size()));
+            }
+
+            auto result = digest{};
+
+            const auto head = file.read(edge_size);
+            result.update(head.constData(), gsl::narrow_cast<std::size_t>(head.size()));
+
+            if (!file.seek(size - edge_size)) {
+                return std::nullopt;
+            }
+
+            const auto tail = file.read(edge_size);
+            result.update(tail.constData(), gsl::narrow_cast<std::size_t>(tail.size()));
+
+            if (head.size() != edge_size || tail.size() != edge_size) {
+                return std::nullopt;
+            }
+
+            return result.value();
+        }
+
+        std::optional<std::uint64_t> full_digest(const QString& path) {
+
+            QFile file{path};
+            if (!file.open(QIODevice::ReadOnly)) {
+                return std::nullopt;
+            }
+
+            try {
+                return digest_of(file);
+            } catch (const file_io_error&) {
+                return std::nullopt;
+            }
+        }
+
+        ///
+        /// Splits each group in \p groups into subgroups whose members have equal \p keys,
+        /// returning those subgroups that have more than one member. Members without keys are
+        /// dropped, and each subgroup keeps its members in their original order.
+        ///
+
+        group_list refine(const group_list& groups, const key_list& keys) {
+
+            auto result = group_list{};
+            for (auto group : groups) {
+
+                ksr::erase_if(group, [&keys](const int index) {
+                    return !keys[index];
+                });
+
+                std::stable_sort(std::begin(group), std::end(group),
+                    [&keys](const int lhs, const int rhs) {
+                        return *keys[lhs] < *keys[rhs];
+                    });
+
+                for (auto first = std::begin(group); first != std::end(group);) {
+
+                    const auto last = std::find_if(first, std::end(group),
+                        [&keys, first](const int index) {
+                            return *keys[index] != *keys[*first];
+                        });
+
+                    if (last - first > 1) {
+                        result.emplace_back(first, last);
+                    }
+
+                    first = last;
+                }
+            }
+
+            return result;
+        }
+
+        ///
+        /// Calls \p key_of for each member of each group in \p groups on up to \p worker_count
+        /// threads, and refines the groups by the keys it returns.
+        ///
+
+        template <typename Func>
+        group_list refine_by(
+            const group_list& groups, const std::size_t path_count, const int worker_count,
+            Func&& key_of) {
+
+            auto members = std::vector<int>{};
+            for (const auto& group : groups) {
+                members.insert(std::end(members), std::begin(group), std::end(group));
+            }
+
+            auto keys = key_list(path_count);
+            parallel_for(members.size(), worker_count,
+                [&members, &keys, &key_of](const std::size_t member) {
+                    keys[members[member]] = key_of(members[member]);
+                });
+
+            return refine(groups, keys);
+        }
+    }
+
+    std::vector<int> find_identical_files(
+        const QStringList& paths, const std::vector<qint64>& sizes, const int worker_count) {
+
+        const auto path_count = gsl::narrow_cast<std::size_t>(paths.size());
+
+        auto result = std::vector<int>(path_count);
+        std::iota(std::begin(result), std::end(result), 0);
+
+        auto by_size = key_list(path_count);
+        auto candidates = std::vector<int>{};
+        for (auto index = 0; index < paths.size(); ++index) {
+            if (sizes[index] > 0) {
+                by_size[index] = static_cast<std::uint64_t>(sizes[index]);
+                candidates.push_back(index);
+            }
+        }
+
+        auto groups = refine(group_list{std::move(candidates)}, by_size);
+
+        groups = refine_by(groups, path_count, worker_count, [&paths, &sizes](const int index) {
+            return edge_digest(paths[index], sizes[index]);
+        });
+
+        groups = refine_by(groups, path_count, worker_count, [&paths](const int index) {
+            return full_digest(paths[index]);
+        });
+
+        for (const auto& group : groups) {
+            for (const auto index : group) {
+                result[index] = group.front();
+            }
+        }
+
+        return result;
+    }
+}
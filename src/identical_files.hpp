@@ -0,0 +1,29 @@
+#ifndef MYRIAD_IDENTICAL_FILES_HPP
+#define MYRIAD_IDENTICAL_FILES_HPP
+
+#include <QStringList>
+#include <QtGlobal>
+
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// Identifies byte-for-byte identical files among those at the filesystem paths \p paths,
+    /// whose sizes in bytes are given by the corresponding elements of \p sizes, while reading as
+    /// little of them as possible. Files are first grouped by size; files that share their size
+    /// with another are then grouped by a digest of their first and last few KiB; and only files
+    /// still grouped together after that are digested in full. Files whose size is given as
+    /// zero or less are not considered at all. The files are read on up to \p worker_count
+    /// threads, and this may be interrupted by requesting an interruption on the calling thread.
+    ///
+    /// Returns, for each path, the index of the first path in \p paths whose file is identical to
+    /// it; this is the path's own index if there is no such path, and for files that could not
+    /// be read.
+    ///
+
+    std::vector<int> find_identical_files(
+        const QStringList& paths, const std::vector<qint64>& sizes, int worker_count);
+}
+
+#endif
@@ -1,106 +1,197 @@
 #include "image_info.hpp"
+#include "digest.hpp"
 #include "exception.hpp"
-#include "hash.hpp"
+#include "file_type.hpp"
+#include "metrics.hpp"
+#include "phash.hpp"
 
-#include "pHash.h"
-
-#include <QDir>
+#include <QBuffer>
+#include <QByteArray>
 #include <QFile>
+#include <QFileInfo>
 #include <QImage>
-#include <QMimeDatabase>
-#include <QTemporaryFile>
+#include <QImageReader>
+#include <QSize>
+
+#include "gsl/gsl"
 
-#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
 
 namespace myriad {
 
     namespace {
 
         ///
-        /// Generates a checksum for the contents of the file at the filesystem path \p path (which
-        /// may be zero if the file was able to be opened but no data were able to read from it).
-        /// \throws file_io_error if the file could not be opened.
+        /// The length of the shorter side of the images from which area hashes are computed, so
+        /// that each cell of the 32x32 grid they are reduced to averages at least 8x8 pixels.
+        /// Beyond that, hashes barely change with the scale at which images are decoded.
         ///
 
-        uint16_t checksum(const QString& path) {
+        constexpr auto area_decode_length = 256;
 
-            QFile file{path};
-            if (!file.open(QIODevice::ReadOnly)) {
-                throw file_io_error{path};
-            }
+        ///
+        /// The length of the shorter side of the images from which difference hashes are
+        /// computed, so that each of the 9x8 cells they are reduced to averages several pixels.
+        ///
 
-            const auto raw_data  = file.readAll();
-            return qChecksum(raw_data, raw_data.length());
-        }
+        constexpr auto difference_decode_length = 32;
 
         ///
-        /// Determines an \ref image_format code identifying the format of the image file at the
-        /// filesystem path \p path. If the file does not have a recognised image (or non-image)
-        /// MIME type, \c image_format::other is returned (and it is the responsibility of calling
-        /// code to detect this error through other means).
+        /// Determines the size at which an image of size \p size should be decoded to compute a
+        /// hash from its reduction: scaled down, preserving its aspect ratio, until its shorter
+        /// side is \p length pixels long. Images already that small are left as they are.
         ///
 
-        image_format format(const QString& path) {
+        QSize reduced_decode_size(const QSize& size, const int length) {
+
+            const auto shorter = std::min(size.width(), size.height());
+            if (shorter <= length) {
+                return size;
+            }
 
-            static const std::unordered_map<QString, image_format> formats_by_mime_name{
-                {QStringLiteral("image/bmp"),  image_format::bmp},
-                {QStringLiteral("image/gif"),  image_format::gif},
-                {QStringLiteral("image/jpeg"), image_format::jpeg},
-                {QStringLiteral("image/png"),  image_format::png}
-            };
+            const auto scale = static_cast<double>(length) / shorter;
+            return QSize{
+                std::max(gsl::narrow_cast<int>(std::lround(size.width() * scale)), 1),
+                std::max(gsl::narrow_cast<int>(std::lround(size.height() * scale)), 1)};
+        }
+    }
 
-            const QMimeDatabase mime_db;
-            const auto mime_name = mime_db.mimeTypeForFile(path).name();
+    image_info::image_info(
+        const QFileInfo& file_info, const phash_variant variant, merge_metrics* const metrics)
+      : m_path{file_info.absoluteFilePath()},
+        m_file_size{gsl::narrow_cast<std::uint64_t>(std::max(file_info.size(), qint64{0}))},
+        m_last_modified{file_info.lastModified()} {
+
+        auto watch = stopwatch{metrics != nullptr};
+
+        QFile file{m_path};
+        if (!file.open(QIODevice::ReadOnly)) {
+            throw file_io_error{m_path};
+        }
+
+        // The file is read exactly once: it is memory-mapped where possible (falling back to an
+        // ordinary read otherwise), and that single buffer both supplies the decoder and is
+        // checksummed. The mapping is released when file goes out of scope, so data must not
+        // outlive it.
+
+        const auto file_size = file.size();
+        if (file_size > std::numeric_limits<int>::max()) {
+            throw file_io_error{m_path};
+        }
+
+        auto data = QByteArray{};
+        if (const auto mapped = file.map(0, file_size)) {
+            data = QByteArray::fromRawData(
+                reinterpret_cast<const char*>(mapped), gsl::narrow_cast<int>(file_size));
+        } else {
+            data = file.readAll();
+        }
 
-            const auto iter = formats_by_mime_name.find(mime_name);
-            return (iter == std::cend(formats_by_mime_name)) ? image_format::other : iter->second;
+        if (metrics) {
+            metrics->read_time.record(watch.lap());
+            metrics->bytes_read += gsl::narrow_cast<std::uint64_t>(file_size);
         }
+
+        decode(data, variant, metrics);
     }
 
-    image_info::image_info(const QString& path)
-        : m_file_info{path} {
+    image_info::image_info(
+        const QString& path, const QByteArray& data, const QDateTime& last_modified,
+        const phash_variant variant, merge_metrics* const metrics)
+      : m_path{QFileInfo{path}.absoluteFilePath()},
+        m_file_size{gsl::narrow_cast<std::uint64_t>(data.size())},
+        m_last_modified{last_modified} {
 
-        const QImage image{path};
-        if (image.isNull()) {
-            throw file_io_error{path};
+        if (metrics) {
+            metrics->bytes_read += gsl::narrow_cast<std::uint64_t>(data.size());
         }
 
-        m_width = image.width();
-        m_height = image.height();
+        decode(data, variant, metrics);
+    }
 
-        m_checksum = myriad::checksum(path);
-        m_format = myriad::format(path);
+    image_info::image_info(
+        const QString& path, const std::uint64_t file_size, const QDateTime& last_modified,
+        const int width, const int height, const image_format format,
+        const std::uint64_t checksum, const std::uint64_t phash)
+      : m_width{width}, m_height{height}, m_format{format}, m_checksum{checksum}, m_phash{phash},
+        m_path{path}, m_file_size{file_size}, m_last_modified{last_modified} {}
 
-        // While ulong64 and std::uint64_t are specified to be compatible types, there is
-        // potentially a conversion between the two that prevents a reference to result.phash from
-        // being passed directly to ph_dct_imagehash().
+    void image_info::decode(
+        const QByteArray& data, const phash_variant variant, merge_metrics* const metrics) {
 
-        ulong64 phash = 0;
+        auto watch = stopwatch{metrics != nullptr};
+        const auto& path = m_path;
 
-        // The pHash library only supports JPEG and BMP files, so if the image is not already in one
-        // of those formats, a temporary bitmap file is created and used to calculate the hash
-        // value.
+        // The format is recognised from the data itself, so that misnamed files are still read
+        // correctly, and handed to the reader so that it need not probe for the format again.
 
-        if (m_format == image_format::jpeg || m_format == image_format::bmp) {
-            ph_dct_imagehash(path.toLatin1(), phash);
-        } else {
+        auto type = file_type_from_content(data);
+        if (!type.supported()) {
+            type = file_type_from_path(path).value_or(file_type{});
+        }
 
-            QTemporaryFile temp_bmp{QDir::tempPath() + "/myriad_XXXXXX.bmp"};
-            const auto temp_path = QFileInfo{temp_bmp}.filePath();
-            if (!temp_bmp.open()) {
-                throw file_io_error{temp_path};
-            }
+        // The buffer shares data rather than copying it, since it is only read.
+
+        QBuffer buffer;
+        buffer.setData(data);
+        buffer.open(QIODevice::ReadOnly);
+
+        // The dimensions are read from the header, where the format records them, so that the
+        // image itself need only be decoded at the scale its hash requires. The compatible hash
+        // filters the image at its full resolution, so can't be computed from a scaled decode:
+        // not even from libjpeg's, which changes the value of every pixel it keeps, and so would
+        // change hashes already in caches and reports.
+        // Decoders that can scale natively (as libjpeg does, by discarding DCT coefficients) then
+        // never hold the image at full size; the others scale it once decoded.
+
+        QImageReader reader{&buffer, type.name};
+        const auto size = reader.size();
+        if (variant != phash_variant::compatible && size.isValid()) {
+            reader.setScaledSize(reduced_decode_size(size, (variant == phash_variant::area)
+                ? area_decode_length
+                : difference_decode_length));
+        }
+
+        const auto image = reader.read();
+        if (image.isNull()) {
+            throw file_io_error{path};
+        }
 
-            image.save(&temp_bmp, "BMP");
-            temp_bmp.close();
-            ph_dct_imagehash(temp_path.toLatin1(), phash);
+        m_width = size.isValid() ? size.width() : image.width();
+        m_height = size.isValid() ? size.height() : image.height();
+        m_format = type.format;
+
+        if (metrics) {
+            metrics->decode_time[static_cast<std::size_t>(m_format)].record(watch.lap());
         }
 
-        m_phash = phash;
+        m_checksum = digest_of(data.constData(), gsl::narrow_cast<std::size_t>(data.size()));
+        if (metrics) {
+            metrics->checksum_time.record(watch.lap());
+        }
+
+        // Hashes were originally computed by ph_dct_imagehash(), which was given JPEG files
+        // directly and bitmap copies of all other formats; of these, only greyscale JPEG files
+        // are loaded by it with a single channel.
+
+        const auto single_channel = m_format == image_format::jpeg
+            && (image.format() == QImage::Format_Grayscale8
+                || image.format() == QImage::Format_Indexed8);
+
+        m_phash = (variant == phash_variant::difference)
+            ? difference_hash(image, single_channel)
+            : dct_hash(image, single_channel, variant);
+        if (metrics) {
+            metrics->hash_time.record(watch.lap());
+            ++metrics->images_decoded;
+        }
     }
 
     bool operator==(const image_info& lhs, const image_info& rhs) {
-        return lhs.m_file_info == rhs.m_file_info;
+        return QFileInfo{lhs.m_path} == QFileInfo{rhs.m_path};
     }
 
     bool operator!=(const image_info& lhs, const image_info& rhs) {
@@ -1,6 +1,10 @@
 #ifndef MYRIAD_IMAGE_ATTR_HPP
 #define MYRIAD_IMAGE_ATTR_HPP
 
+#include "phash.hpp"
+
+#include <QByteArray>
+#include <QDateTime>
 #include <QFileInfo>
 #include <QString>
 
@@ -8,6 +12,8 @@
 
 namespace myriad {
 
+    struct merge_metrics;
+
     ///
     /// Identifies specific image formats that are associated with special appraisal logic. While
     /// Myriad supports all formats supported by \c QImage, most of these receive no special
@@ -37,20 +43,62 @@ namespace myriad {
         friend bool operator!=(const image_info& lhs, const image_info& rhs);
 
         ///
-        /// Fetches information about the image file at the filesystem path \p path and constructs
-        /// an \ref image_info object to store that information. Since the stored image attributes
-        /// include the perceptual hash of the image, this is an expensive operation.
-        /// \throws file_io_error if image data could not be read from \p path.
+        /// Fetches information about the image file described by \p file_info and constructs an
+        /// \ref image_info object to store that information. Since the stored image attributes
+        /// include the perceptual hash of the image, this is an expensive operation. The hash is
+        /// computed as specified by \p variant; for the variants other than
+        /// \ref phash_variant::compatible, only as many pixels are decoded as that hash needs,
+        /// where the image's format allows it. If \p metrics is not null, the time taken by each
+        /// stage of that operation is recorded there.
+        ///
+        /// The size and modification time of the file are taken from \p file_info before the file
+        /// is read (so those it already holds, as after a lookup in a \ref hash_cache, are used as
+        /// they are). If the file changes while it is being read, they then describe an earlier
+        /// version of it, and a cache entry made from this object is never taken to be current.
+        /// \throws file_io_error if image data could not be read from the file.
         ///
 
-        explicit image_info(const QString& path);
+        explicit image_info(
+            const QFileInfo& file_info, phash_variant variant = phash_variant::compatible,
+            merge_metrics* metrics = nullptr);
 
-        std::uint16_t checksum() const {
+        ///
+        /// Constructs an \ref image_info object for the image file at the filesystem path
+        /// \p path as above, but from \p data, the entire contents of that file, which the caller
+        /// has already read (as a \ref read_ahead does), so that no further reads are made. The
+        /// file is taken to have been last modified at \p last_modified, which the caller should
+        /// have found before reading it.
+        /// \throws file_io_error if \p data could not be decoded as an image.
+        ///
+
+        explicit image_info(
+            const QString& path, const QByteArray& data, const QDateTime& last_modified,
+            phash_variant variant, merge_metrics* metrics = nullptr);
+
+        ///
+        /// Constructs an \ref image_info object for the file at the absolute filesystem path
+        /// \p path from attributes that have previously been computed for it (for example, by a
+        /// \ref hash_cache) without reading or examining that file. It is the responsibility of
+        /// calling code to ensure that these attributes are still current. \p last_modified may
+        /// be null where it isn't known, in which case the object can't be added to a cache.
+        ///
+
+        explicit image_info(
+            const QString& path, std::uint64_t file_size, const QDateTime& last_modified,
+            int width, int height, image_format format, std::uint64_t checksum,
+            std::uint64_t phash);
+
+        ///
+        /// Gets a 64-bit digest of the contents of the image file, which may be used to determine
+        /// whether two files are byte-for-byte identical.
+        ///
+
+        std::uint64_t checksum() const {
             return m_checksum;
         }
 
         std::uint64_t file_size() const {
-            return m_file_info.size();
+            return m_file_size;
         }
 
         image_format format() const {
@@ -61,8 +109,12 @@ namespace myriad {
             return m_height;
         }
 
+        QDateTime last_modified() const {
+            return m_last_modified;
+        }
+
         QString path() const {
-            return m_file_info.absoluteFilePath();
+            return m_path;
         }
 
         std::uint64_t phash() const {
@@ -75,14 +127,18 @@ namespace myriad {
 
     private:
 
+        void decode(const QByteArray& data, phash_variant variant, merge_metrics* metrics);
+
         int m_width = 0;
         int m_height = 0;
 
         image_format m_format = image_format::other;
-        std::uint16_t m_checksum = 0;
+        std::uint64_t m_checksum = 0;
         std::uint64_t m_phash = 0;
 
-        QFileInfo m_file_info;
+        QString m_path;
+        std::uint64_t m_file_size = 0;
+        QDateTime m_last_modified;
     };
 }
 
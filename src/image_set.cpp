@@ -0,0 +1,187 @@
+#include "image_set.hpp"
+#include "hash.hpp"
+
+#include <QDateTime>
+#include <QString>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <iterator>
+
+namespace myriad {
+
+    namespace {
+
+        const char16_t* utf16_of(const QString& value) {
+            return reinterpret_cast<const char16_t*>(value.utf16());
+        }
+    }
+
+    std::pair<image_set::handle, bool> image_set::insert(const image_info& item) {
+
+        static_assert(sizeof(record) == 56, "");
+
+        const auto path = item.path();
+        const auto path_hash = stable_hash(path);
+        const auto path_length = gsl::narrow_cast<std::size_t>(path.size());
+
+        if (const auto existing = find(path_hash, utf16_of(path), path_length)) {
+            return {*existing, false};
+        }
+
+        if (2 * (m_size + 1) > m_table.size()) {
+            grow_table();
+        }
+
+        auto result = handle{};
+        if (m_free.empty()) {
+            result = gsl::narrow_cast<handle>(m_records.size());
+            m_records.emplace_back();
+        } else {
+            result = m_free.back();
+            m_free.pop_back();
+        }
+
+        m_records[result] = record{
+            path_hash, m_paths.size(), item.phash(), item.checksum(), item.file_size(),
+            gsl::narrow_cast<std::uint32_t>(path_length), item.width(), item.height(),
+            static_cast<std::uint8_t>(item.format()), true};
+
+        m_paths.insert(std::end(m_paths), utf16_of(path), utf16_of(path) + path_length);
+
+        const auto mask = m_table.size() - 1;
+        auto slot = slot_of(path_hash);
+        while (m_table[slot] != empty_slot) {
+            slot = (slot + 1) & mask;
+        }
+
+        m_table[slot] = result;
+        ++m_size;
+        return {result, true};
+    }
+
+    void image_set::erase(const handle item) {
+
+        // Linear probing with backward-shift deletion: rather than leaving a tombstone, each
+        // later entry in the same run is moved back into the gap unless doing so would place it
+        // before its home slot, so lookups never need to probe past an empty slot.
+
+        const auto mask = m_table.size() - 1;
+        auto gap = slot_of(m_records[item].path_hash);
+        while (m_table[gap] != item) {
+            gap = (gap + 1) & mask;
+        }
+
+        for (auto slot = (gap + 1) & mask; m_table[slot] != empty_slot; slot = (slot + 1) & mask) {
+
+            const auto home = slot_of(m_records[m_table[slot]].path_hash);
+            if (((slot - home) & mask) >= ((slot - gap) & mask)) {
+                m_table[gap] = m_table[slot];
+                gap = slot;
+            }
+        }
+
+        m_table[gap] = empty_slot;
+        m_records[item].live = false;
+        m_free.push_back(item);
+        --m_size;
+    }
+
+    std::optional<image_set::handle> image_set::find(const QString& path) const {
+        return find(stable_hash(path), utf16_of(path), gsl::narrow_cast<std::size_t>(path.size()));
+    }
+
+    bool image_set::contains(const image_set& other, const handle item) const {
+
+        const auto& other_record = other.m_records[item];
+        const auto path = other.m_paths.data() + other_record.path_offset;
+        return find(other_record.path_hash, path, other_record.path_length).has_value();
+    }
+
+    std::vector<image_set::handle> image_set::handles() const {
+
+        auto result = std::vector<handle>{};
+        result.reserve(m_size);
+
+        for (auto item = handle{0}; item < m_records.size(); ++item) {
+            if (m_records[item].live) {
+                result.push_back(item);
+            }
+        }
+
+        return result;
+    }
+
+    image_info image_set::info(const handle item) const {
+
+        const auto& rec = m_records[item];
+        return image_info{
+            path(item), rec.file_size, QDateTime{}, rec.width, rec.height,
+            static_cast<image_format>(rec.format), rec.checksum, rec.phash};
+    }
+
+    QString image_set::path(const handle item) const {
+
+        const auto& rec = m_records[item];
+        return QString{
+            reinterpret_cast<const QChar*>(m_paths.data() + rec.path_offset),
+            gsl::narrow_cast<int>(rec.path_length)};
+    }
+
+    std::size_t image_set::slot_of(const std::uint64_t path_hash) const {
+
+        // FNV-1a mixes poorly into its low bits, which are the ones the mask keeps, so they are
+        // folded together with the high bits first.
+
+        return gsl::narrow_cast<std::size_t>(path_hash ^ (path_hash >> 32)) & (m_table.size() - 1);
+    }
+
+    std::optional<image_set::handle> image_set::find(
+        const std::uint64_t path_hash, const char16_t* const path,
+        const std::size_t length) const {
+
+        if (m_table.empty()) {
+            return std::nullopt;
+        }
+
+        const auto mask = m_table.size() - 1;
+        for (auto slot = slot_of(path_hash); m_table[slot] != empty_slot;
+             slot = (slot + 1) & mask) {
+
+            const auto item = m_table[slot];
+            const auto& rec = m_records[item];
+
+            if (rec.path_hash == path_hash && rec.path_length == length) {
+                const auto begin = m_paths.data() + rec.path_offset;
+                if (std::equal(begin, begin + length, path)) {
+                    return item;
+                }
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    void image_set::grow_table() {
+
+        constexpr auto min_capacity = std::size_t{64};
+        const auto capacity = std::max(2 * m_table.size(), min_capacity);
+
+        m_table.assign(capacity, empty_slot);
+        const auto mask = capacity - 1;
+
+        for (auto item = handle{0}; item < m_records.size(); ++item) {
+            if (!m_records[item].live) {
+                continue;
+            }
+
+            auto slot = slot_of(m_records[item].path_hash);
+            while (m_table[slot] != empty_slot) {
+                slot = (slot + 1) & mask;
+            }
+
+            m_table[slot] = item;
+        }
+    }
+}
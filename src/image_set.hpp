@@ -0,0 +1,125 @@
+#ifndef MYRIAD_IMAGE_SET_HPP
+#define MYRIAD_IMAGE_SET_HPP
+
+#include "image_info.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+class QString;
+
+namespace myriad {
+
+    ///
+    /// A set of images, keyed by path, storing the attributes of each in a compact fixed-size
+    /// record rather than as a full \ref image_info object. Paths are stored once each, in a
+    /// single arena of UTF-16 code units, together with their precomputed \ref stable_hash();
+    /// lookups go through an open-addressed table of those hashes, so neither looking up nor
+    /// storing a path involves the filesystem or any allocation per image. Each image costs a
+    /// 56-byte record and a slot or two of the table, beyond the text of its path.
+    ///
+    /// Images are identified by handles that remain valid until the image they refer to is
+    /// erased; erasure is constant-time, and simply returns the record to a free list for reuse
+    /// by later insertions. The text of erased paths is never reclaimed, however, so the arena
+    /// only grows for as long as the set exists: a long-lived set from which images are
+    /// repeatedly erased (as the \ref collection_index of the daemon is) must be rebuilt from
+    /// time to time to release it, as collection_index::compact() does.
+    ///
+    /// \ref image_info objects for stored images are constructed on demand by info(), which is
+    /// cheap enough to do for each pair of images compared, but not for each image considered.
+    /// The file size of each image is kept, but not its modification time, so those objects can't
+    /// be added to a \ref hash_cache.
+    ///
+
+    class image_set {
+    public:
+
+        using handle = std::uint32_t;
+
+        ///
+        /// Adds the image described by \p item to the set, unless an image with the same path is
+        /// already present. Returns the handle of the image in the set with that path, and whether
+        /// it was added by this call.
+        ///
+
+        std::pair<handle, bool> insert(const image_info& item);
+
+        ///
+        /// Removes the image with the handle \p item from the set, invalidating that handle.
+        ///
+
+        void erase(handle item);
+
+        ///
+        /// Looks up the image with the filesystem path \p path, which must be absolute.
+        ///
+
+        std::optional<handle> find(const QString& path) const;
+
+        ///
+        /// Determines whether the set contains an image with the same path as the image with the
+        /// handle \p item in \p other.
+        ///
+
+        bool contains(const image_set& other, handle item) const;
+
+        ///
+        /// Gets the handles of all of the images in the set, in an unspecified order.
+        ///
+
+        std::vector<handle> handles() const;
+
+        ///
+        /// Constructs an \ref image_info object describing the image with the handle \p item.
+        ///
+
+        image_info info(handle item) const;
+
+        QString path(handle item) const;
+
+        std::uint64_t phash(const handle item) const {
+            return m_records[item].phash;
+        }
+
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        std::size_t size() const {
+            return m_size;
+        }
+
+    private:
+
+        struct record {
+            std::uint64_t path_hash;
+            std::uint64_t path_offset;
+            std::uint64_t phash;
+            std::uint64_t checksum;
+            std::uint64_t file_size;
+            std::uint32_t path_length;
+            std::int32_t width;
+            std::int32_t height;
+            std::uint8_t format;
+            bool live;
+        };
+
+        static constexpr auto empty_slot = ~handle{0};
+
+        std::size_t slot_of(std::uint64_t path_hash) const;
+        std::optional<handle> find(
+            std::uint64_t path_hash, const char16_t* path, std::size_t length) const;
+        void grow_table();
+
+        std::vector<record> m_records;
+        std::vector<handle> m_free;
+        std::vector<char16_t> m_paths;
+        std::vector<handle> m_table;
+        std::size_t m_size = 0;
+    };
+}
+
+#endif
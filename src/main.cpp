@@ -1,10 +1,29 @@
+#include "batch.hpp"
+#include "command_line.hpp"
+#include "daemon.hpp"
 #include "engine.hpp"
+#include "shard_worker.hpp"
 
 #include <QApplication>
 #include <QThread>
 
 int main(int argc, char** argv) {
-    
+
+    // Batch, daemon and shard worker modes construct their own QCoreApplication, so this must be
+    // decided before the QApplication (and with it, the windowing system) is initialised.
+
+    if (myriad::option_given(argc, argv, "--batch")) {
+        return myriad::run_batch(argc, argv);
+    }
+
+    if (myriad::option_given(argc, argv, "--daemon")) {
+        return myriad::run_daemon(argc, argv);
+    }
+
+    if (myriad::option_given(argc, argv, "--shard-worker")) {
+        return myriad::run_shard_worker(argc, argv);
+    }
+
     QApplication app{argc, argv};
 
     myriad::engine worker;
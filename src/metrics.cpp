@@ -0,0 +1,158 @@
+#include "metrics.hpp"
+#include "exception.hpp"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QString>
+
+#include <algorithm>
+
+namespace myriad {
+
+    namespace {
+
+        constexpr auto format_names = std::array<const char*, merge_metrics::format_count>{{
+            "other", "bmp", "gif", "jpeg", "png"}};
+
+        constexpr auto phase_names =
+            std::array<const char*, merge_metrics::phase_count>{{"scan", "hash", "compare"}};
+
+        double to_us(const std::uint64_t ns) {
+            return static_cast<double>(ns) / 1000.0;
+        }
+
+        double to_ms(const std::chrono::nanoseconds duration) {
+            return std::chrono::duration<double, std::milli>{duration}.count();
+        }
+
+        double load(const std::atomic<std::uint64_t>& counter) {
+            return static_cast<double>(counter.load(std::memory_order_relaxed));
+        }
+    }
+
+    void duration_histogram::record(const std::chrono::nanoseconds duration) noexcept {
+
+        const auto ns = static_cast<std::uint64_t>(std::max(duration.count(), std::int64_t{0}));
+
+        auto bucket = 0;
+        for (auto us = ns / 1000; us > 1 && bucket < bucket_count - 1; us >>= 1) {
+            ++bucket;
+        }
+
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        auto max_ns = m_max_ns.load(std::memory_order_relaxed);
+        while (ns > max_ns && !m_max_ns.compare_exchange_weak(max_ns, ns)) {
+        }
+    }
+
+    QJsonObject duration_histogram::to_json() const {
+
+        const auto count = m_count.load(std::memory_order_relaxed);
+        const auto total_ns = m_total_ns.load(std::memory_order_relaxed);
+
+        auto buckets = QJsonArray{};
+        for (auto index = 0; index < bucket_count; ++index) {
+            const auto bucket_size = m_buckets[index].load(std::memory_order_relaxed);
+            if (bucket_size > 0) {
+                buckets.append(QJsonObject{
+                    {QStringLiteral("below_us"), static_cast<double>(std::uint64_t{2} << index)},
+                    {QStringLiteral("count"), static_cast<double>(bucket_size)}});
+            }
+        }
+
+        return QJsonObject{
+            {QStringLiteral("count"), static_cast<double>(count)},
+            {QStringLiteral("total_us"), to_us(total_ns)},
+            {QStringLiteral("mean_us"), count > 0 ? to_us(total_ns) / count : 0.0},
+            {QStringLiteral("max_us"), to_us(m_max_ns.load(std::memory_order_relaxed))},
+            {QStringLiteral("buckets"), buckets}};
+    }
+
+    void merge_metrics::set_active_phases(const unsigned active_phases) {
+
+        const auto now = stopwatch::clock::now();
+        if (!m_start) {
+            m_start = now;
+        }
+
+        for (auto index = 0; index < phase_count; ++index) {
+
+            auto& start = m_phase_start[index];
+            const auto active = (active_phases & (1u << index)) != 0;
+
+            if (active && !start) {
+                start = now;
+            } else if (!active && start) {
+                m_phase_time[index] += now - *start;
+                start.reset();
+            }
+        }
+
+        m_wall_time = now - *m_start;
+    }
+
+    QJsonObject merge_metrics::to_json() const {
+
+        const auto counters = QJsonObject{
+            {QStringLiteral("files_scanned"), load(files_scanned)},
+            {QStringLiteral("folders_scanned"), load(folders_scanned)},
+            {QStringLiteral("bytes_read"), load(bytes_read)},
+            {QStringLiteral("images_decoded"), load(images_decoded)},
+            {QStringLiteral("images_unreadable"), load(images_unreadable)},
+            {QStringLiteral("identical_copies"), load(identical_copies)},
+            {QStringLiteral("cache_hits"), load(cache_hits)},
+            {QStringLiteral("cache_misses"), load(cache_misses)},
+            {QStringLiteral("cache_writes"), load(cache_writes)},
+            {QStringLiteral("cache_bytes_written"), load(cache_bytes_written)},
+            {QStringLiteral("pairs_compared"), load(pairs_compared)},
+            {QStringLiteral("images_spilled"), load(images_spilled)},
+            {QStringLiteral("images_reloaded"), load(images_reloaded)},
+            {QStringLiteral("compare_passes"), load(compare_passes)},
+            {QStringLiteral("images_confirmed"), load(images_confirmed)}};
+
+        auto decode = QJsonObject{};
+        for (auto index = 0; index < format_count; ++index) {
+            if (decode_time[index].count() > 0) {
+                const auto name = QString::fromLatin1(format_names[index]);
+                decode.insert(name, decode_time[index].to_json());
+            }
+        }
+
+        const auto timings = QJsonObject{
+            {QStringLiteral("read"), read_time.to_json()},
+            {QStringLiteral("read_ahead_wait"), read_ahead_wait_time.to_json()},
+            {QStringLiteral("decode"), decode},
+            {QStringLiteral("checksum"), checksum_time.to_json()},
+            {QStringLiteral("hash"), hash_time.to_json()},
+            {QStringLiteral("candidate_search"), candidate_search_time.to_json()},
+            {QStringLiteral("cache_save"), cache_save_time.to_json()}};
+
+        auto phases = QJsonObject{};
+        for (auto index = 0; index < phase_count; ++index) {
+            phases.insert(QString::fromLatin1(phase_names[index]), to_ms(m_phase_time[index]));
+        }
+
+        return QJsonObject{
+            {QStringLiteral("wall_time_ms"), to_ms(m_wall_time)},
+            {QStringLiteral("phase_time_ms"), phases},
+            {QStringLiteral("counters"), counters},
+            {QStringLiteral("timings"), timings}};
+    }
+
+    void write_metrics(const QJsonObject& metrics, const QString& path) {
+
+        QSaveFile file{path};
+        if (!file.open(QIODevice::WriteOnly)) {
+            throw file_io_error{path};
+        }
+
+        file.write(QJsonDocument{metrics}.toJson(QJsonDocument::Indented));
+        if (!file.commit()) {
+            throw file_io_error{path};
+        }
+    }
+}
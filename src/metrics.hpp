@@ -0,0 +1,157 @@
+#ifndef MYRIAD_METRICS_HPP
+#define MYRIAD_METRICS_HPP
+
+#include <QJsonObject>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+class QString;
+
+namespace myriad {
+
+    ///
+    /// Measures the time elapsed between successive calls to lap(). A disabled stopwatch never
+    /// reads the clock, and always reports a duration of zero, so that instrumented code costs
+    /// next to nothing when no metrics are being collected.
+    ///
+
+    class stopwatch {
+    public:
+
+        using clock = std::chrono::steady_clock;
+
+        explicit stopwatch(const bool enabled) noexcept
+          : m_enabled{enabled} {
+
+            if (m_enabled) {
+                m_last = clock::now();
+            }
+        }
+
+        std::chrono::nanoseconds lap() noexcept {
+
+            if (!m_enabled) {
+                return std::chrono::nanoseconds{0};
+            }
+
+            const auto now = clock::now();
+            const auto result = now - m_last;
+            m_last = now;
+            return result;
+        }
+
+    private:
+        clock::time_point m_last;
+        bool m_enabled;
+    };
+
+    ///
+    /// Accumulates durations into buckets whose bounds are successive powers of two microseconds,
+    /// along with their count, total and maximum. Durations may be recorded concurrently from any
+    /// number of threads.
+    ///
+
+    class duration_histogram {
+    public:
+
+        static constexpr auto bucket_count = 32;
+
+        void record(std::chrono::nanoseconds duration) noexcept;
+
+        std::uint64_t count() const noexcept {
+            return m_count.load(std::memory_order_relaxed);
+        }
+
+        ///
+        /// Describes the histogram as a JSON object, with durations given in microseconds. Only
+        /// non-empty buckets are listed, each by its exclusive upper bound.
+        ///
+
+        QJsonObject to_json() const;
+
+    private:
+        std::array<std::atomic<std::uint64_t>, bucket_count> m_buckets{};
+        std::atomic<std::uint64_t> m_count{0};
+        std::atomic<std::uint64_t> m_total_ns{0};
+        std::atomic<std::uint64_t> m_max_ns{0};
+    };
+
+    ///
+    /// Counters and timings collected over the course of a single merge operation, to show where
+    /// its time goes. The counters and histograms may be updated concurrently from any thread;
+    /// the phases, only from the thread performing the merge. Reading an image is timed up to the
+    /// point at which its contents are memory-mapped, so for most files, the time spent waiting
+    /// on the disk shows up in the decoding and checksum timings instead. When files are read
+    /// ahead, the time decoding threads spend waiting for the next file to be read is recorded
+    /// as \c read_ahead_wait_time instead, and the reads themselves aren't timed.
+    ///
+
+    struct merge_metrics {
+
+        ///
+        /// The number of \ref image_format values, by whose values \c decode_time is indexed, and
+        /// the number of \ref engine::phase values.
+        ///
+
+        static constexpr auto format_count = 5;
+        static constexpr auto phase_count = 3;
+
+        ///
+        /// Records that the phases in \p active_phases (a combination of \ref engine::phase
+        /// values) are now in progress, accumulating the time spent in each phase since it began.
+        /// Passing zero marks the end of the merge.
+        ///
+
+        void set_active_phases(unsigned active_phases);
+
+        ///
+        /// Describes the metrics collected so far as a JSON object.
+        ///
+
+        QJsonObject to_json() const;
+
+        std::atomic<std::uint64_t> files_scanned{0};
+        std::atomic<std::uint64_t> folders_scanned{0};
+        std::atomic<std::uint64_t> bytes_read{0};
+        std::atomic<std::uint64_t> images_decoded{0};
+        std::atomic<std::uint64_t> images_unreadable{0};
+        std::atomic<std::uint64_t> identical_copies{0};
+        std::atomic<std::uint64_t> cache_hits{0};
+        std::atomic<std::uint64_t> cache_misses{0};
+        std::atomic<std::uint64_t> cache_writes{0};
+        std::atomic<std::uint64_t> cache_bytes_written{0};
+        std::atomic<std::uint64_t> pairs_compared{0};
+        std::atomic<std::uint64_t> images_spilled{0};
+        std::atomic<std::uint64_t> images_reloaded{0};
+        std::atomic<std::uint64_t> compare_passes{0};
+        std::atomic<std::uint64_t> images_confirmed{0};
+
+        duration_histogram read_time;
+        duration_histogram read_ahead_wait_time;
+        std::array<duration_histogram, format_count> decode_time;
+        duration_histogram checksum_time;
+        duration_histogram hash_time;
+        duration_histogram candidate_search_time;
+        duration_histogram cache_save_time;
+
+    private:
+        std::array<std::chrono::nanoseconds, phase_count> m_phase_time{};
+        std::array<std::optional<stopwatch::clock::time_point>, phase_count> m_phase_start;
+        std::optional<stopwatch::clock::time_point> m_start;
+        std::chrono::nanoseconds m_wall_time{0};
+    };
+
+    ///
+    /// Writes \p metrics as indented JSON to the file at the filesystem path \p path, replacing
+    /// any existing file only once the whole document has been written.
+    /// \throws file_io_error if the file could not be written.
+    ///
+
+    void write_metrics(const QJsonObject& metrics, const QString& path);
+}
+
+#endif
@@ -1,70 +1,409 @@
 #include "pairer.hpp"
-#include "engine.hpp"
+#include "parallel.hpp"
+#include "phash_index.hpp"
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
 
 namespace myriad {
 
-    int deduplicate_pairer::count() const {
-        const auto size = m_set.size();
-        return size * (size - 1) / 2;
+    namespace {
+
+        ///
+        /// The number of images along each side of the tiles into which the space of possible
+        /// pairs is divided for exhaustive comparison (and the number of queries per task when an
+        /// index is used instead). Each tile's hashes occupy 8 KiB per side, so that both sides
+        /// remain in the L1 cache while the tile is compared.
+        ///
+
+        constexpr auto block_size = std::size_t{1024};
+
+        std::size_t block_count(const std::size_t size) {
+            return (size + block_size - 1) / block_size;
+        }
+
+        ///
+        /// Calls \p find_tile for each of \p tile_count tiles on up to \p worker_count threads,
+        /// passing it the index of the tile and a list to which to append the candidate pairs
+        /// found within it. Since tiles are claimed by threads in an unpredictable order, the
+        /// results are sorted before being returned, making them independent of the scheduling of
+        /// the threads (and of the size and shape of the tiles themselves).
+        ///
+
+        template <typename Func>
+        candidate_list find_candidates(
+            const std::size_t tile_count, const int worker_count, Func&& find_tile) {
+
+            auto tile_candidates = std::vector<candidate_list>(tile_count);
+            parallel_for(tile_count, worker_count,
+                [&tile_candidates, &find_tile](const std::size_t tile) {
+                    find_tile(tile, tile_candidates[tile]);
+                });
+
+            auto result = candidate_list{};
+            result.reserve(std::accumulate(std::cbegin(tile_candidates), std::cend(tile_candidates),
+                std::size_t{0}, [](const std::size_t sum, const candidate_list& candidates) {
+                    return sum + candidates.size();
+                }));
+
+            for (const auto& candidates : tile_candidates) {
+                result.insert(std::end(result), std::cbegin(candidates), std::cend(candidates));
+            }
+
+            std::sort(std::begin(result), std::end(result));
+            return result;
+        }
+
+        ///
+        /// Estimates whether it will be quicker to find the pairs of hashes within \p threshold of
+        /// each other using a \ref phash_index holding \p indexed_count hashes and queried
+        /// \p query_count times, or by exhaustively making \p comparison_count comparisons with
+        /// the batched kernel. Exhaustive comparison streams through contiguous hashes several at
+        /// a time, whereas every probe of the index is a potential cache miss, and the index's
+        /// bucket tables alone take several megabytes to set up; so the index only wins for large
+        /// sets of images and small thresholds.
+        ///
+
+        bool prefer_index(
+            const std::size_t indexed_count, const std::size_t query_count,
+            const std::uint64_t comparison_count, const int threshold) {
+
+            constexpr auto bucket_count = 65536.0;
+            constexpr auto setup_cost = 4 * bucket_count;
+            constexpr auto comparisons_per_cost = 4.0;
+
+            const auto probes = static_cast<double>(phash_index::probe_count(threshold));
+            const auto index_cost = setup_cost
+                + static_cast<double>(query_count) * probes * (1 + indexed_count / bucket_count);
+
+            return index_cost < static_cast<double>(comparison_count) / comparisons_per_cost;
+        }
+
+        std::vector<std::uint64_t> hashes_of(
+            const image_set& set, const std::vector<image_set::handle>& items) {
+
+            auto result = std::vector<std::uint64_t>{};
+            result.reserve(items.size());
+
+            for (const auto item : items) {
+                result.push_back(set.phash(item));
+            }
+
+            return result;
+        }
+    }
+
+    candidate_list find_pairs_within(
+        const std::vector<std::uint64_t>& hashes, const int threshold, const int worker_count) {
+
+        // Each image is paired only with those before it, so that every pair is found exactly
+        // once with the images in the same relative order as the container's own. In the
+        // exhaustive case, the lower triangle of the pair space is divided into square tiles;
+        // with the index, the images are divided into blocks of queries.
+
+        const auto size = hashes.size();
+        const auto comparison_count = std::uint64_t{size} * (size - 1) / 2;
+        const auto blocks = block_count(size);
+
+        if (!prefer_index(size, size, comparison_count, threshold)) {
+
+            auto tiles = std::vector<std::pair<std::size_t, std::size_t>>{};
+            for (auto row = std::size_t{0}; row < blocks; ++row) {
+                for (auto col = std::size_t{0}; col <= row; ++col) {
+                    tiles.emplace_back(row, col);
+                }
+            }
+
+            return find_candidates(tiles.size(), worker_count,
+                [&hashes, &tiles, size, threshold](
+                    const std::size_t tile, candidate_list& result) {
+
+                    const auto [row, col] = tiles[tile];
+                    const auto lhs_begin = col * block_size;
+                    const auto rhs_end = std::min((row + 1) * block_size, size);
+
+                    for (auto id = row * block_size; id < rhs_end; ++id) {
+                        const auto lhs_end = std::min((col + 1) * block_size, id);
+                        const auto lhs_count = lhs_end > lhs_begin ? lhs_end - lhs_begin : 0;
+
+                        for_each_match(
+                            hashes[id], hashes.data() + lhs_begin, lhs_count, threshold,
+                            [&result, id, lhs_begin](const std::size_t offset) {
+                                result.emplace_back(lhs_begin + offset, id);
+                            });
+                    }
+                });
+        }
+
+        auto index = phash_index{threshold};
+        for (auto id = std::size_t{0}; id < size; ++id) {
+            index.insert(hashes[id], id);
+        }
+
+        return find_candidates(blocks, worker_count,
+            [&hashes, &index, size](const std::size_t block, candidate_list& result) {
+
+                const auto end = std::min((block + 1) * block_size, size);
+                for (auto id = block * block_size; id < end; ++id) {
+                    index.find(hashes[id], [&result, id](const std::size_t lhs_id) {
+                        if (lhs_id < id) {
+                            result.emplace_back(lhs_id, id);
+                        }
+                    });
+                }
+            });
     }
 
-    void deduplicate_pairer::pair(const ksr::function_view<compare_sig> callback) {
+    candidate_list find_pairs_between(
+        const std::vector<std::uint64_t>& src_hashes,
+        const std::vector<std::uint64_t>& dst_hashes, const int threshold,
+        const int worker_count) {
+
+        const auto src_size = src_hashes.size();
+        const auto dst_size = dst_hashes.size();
+        const auto comparison_count = std::uint64_t{src_size} * dst_size;
+        const auto src_blocks = block_count(src_size);
+
+        if (!prefer_index(dst_size, src_size, comparison_count, threshold)) {
 
-        auto lhs_iter = std::begin(m_set);
-        const auto end = std::end(m_set);
-        for (; lhs_iter != end; ++lhs_iter) {
+            const auto dst_blocks = block_count(dst_size);
+            return find_candidates(src_blocks * dst_blocks, worker_count,
+                [&src_hashes, &dst_hashes, src_size, dst_size, dst_blocks, threshold](
+                    const std::size_t tile, candidate_list& result) {
 
-            auto rhs_iter = lhs_iter;
-            ++rhs_iter;
-            for (; rhs_iter != end && !thread_interrupted(); ++rhs_iter) {
+                    const auto src_begin = (tile / dst_blocks) * block_size;
+                    const auto src_end = std::min(src_begin + block_size, src_size);
+                    const auto dst_begin = (tile % dst_blocks) * block_size;
+                    const auto dst_count = std::min(block_size, dst_size - dst_begin);
 
-                const auto choice = callback(*lhs_iter, *rhs_iter);
-                switch (choice) {
-                    case discard_choice::lhs:
-                        lhs_iter = m_set.erase(lhs_iter);
-                        break;
+                    for (auto src_id = src_begin; src_id < src_end; ++src_id) {
+                        for_each_match(
+                            src_hashes[src_id], dst_hashes.data() + dst_begin, dst_count,
+                            threshold, [&result, src_id, dst_begin](const std::size_t offset) {
+                                result.emplace_back(src_id, dst_begin + offset);
+                            });
+                    }
+                });
+        }
+
+        auto index = phash_index{threshold};
+        for (auto id = std::size_t{0}; id < dst_size; ++id) {
+            index.insert(dst_hashes[id], id);
+        }
 
-                    case discard_choice::rhs:
-                        rhs_iter = m_set.erase(rhs_iter);
-                        break;
+        return find_candidates(src_blocks, worker_count,
+            [&src_hashes, &index, src_size](const std::size_t block, candidate_list& result) {
 
-                    case discard_choice::none:
-                        break;
+                const auto end = std::min((block + 1) * block_size, src_size);
+                for (auto src_id = block * block_size; src_id < end; ++src_id) {
+                    index.find(src_hashes[src_id], [&result, src_id](const std::size_t dst_id) {
+                        result.emplace_back(src_id, dst_id);
+                    });
+                }
+            });
+    }
+
+    namespace {
+
+        ///
+        /// Groups the \p size images between which \p candidates are found into clusters, each a
+        /// connected component of the graph whose edges are the candidates. The members of each
+        /// cluster of two or more images are appended to \p members, and the index in \p members
+        /// at which each cluster ends is appended to \p offsets, after an initial zero.
+        ///
+
+        void find_clusters(
+            const std::size_t size, const candidate_list& candidates,
+            std::vector<std::size_t>& members, std::vector<std::size_t>& offsets) {
+
+            // The clusters are found by union-find, with each tree rooted at its lowest index, so
+            // that the root of an image's cluster also gives the cluster's place in the order.
+
+            auto roots = std::vector<std::size_t>(size);
+            std::iota(std::begin(roots), std::end(roots), std::size_t{0});
+
+            const auto find_root = [&roots](std::size_t id) {
+                while (roots[id] != id) {
+                    roots[id] = roots[roots[id]];
+                    id = roots[id];
+                }
+
+                return id;
+            };
+
+            for (const auto& [lhs_id, rhs_id] : candidates) {
+                const auto lhs_root = find_root(lhs_id);
+                const auto rhs_root = find_root(rhs_id);
+                if (lhs_root < rhs_root) {
+                    roots[rhs_root] = lhs_root;
+                } else if (rhs_root < lhs_root) {
+                    roots[lhs_root] = rhs_root;
+                }
+            }
+
+            // A counting sort by root then groups the members of each cluster of more than one
+            // image together, in their original order.
+
+            auto sizes = std::vector<std::size_t>(size);
+            for (auto id = std::size_t{0}; id < size; ++id) {
+                roots[id] = find_root(id);
+                ++sizes[roots[id]];
+            }
+
+            auto starts = std::vector<std::size_t>(size);
+            offsets.push_back(0);
+
+            for (auto id = std::size_t{0}; id < size; ++id) {
+                if (sizes[id] > 1) {
+                    starts[id] = offsets.back();
+                    offsets.push_back(offsets.back() + sizes[id]);
                 }
             }
+
+            members.resize(offsets.back());
+            for (auto id = std::size_t{0}; id < size; ++id) {
+                if (sizes[roots[id]] > 1) {
+                    members[starts[roots[id]]++] = id;
+                }
+            }
+        }
+    }
+
+    deferred_merge_pairer::deferred_merge_pairer(
+        image_set& src_set, image_set& dst_set, const int threshold, const int worker_count)
+      : deferred_merge_pairer{
+            src_set, dst_set, src_set.handles(), dst_set.handles(), threshold, worker_count} {}
+
+    deferred_merge_pairer::deferred_merge_pairer(
+        image_set& src_set, image_set& dst_set, const std::vector<image_set::handle>& src_items,
+        const std::vector<image_set::handle>& dst_items, const int threshold,
+        const int worker_count)
+      : deferred_merge_pairer{src_set, dst_set, src_items, dst_items,
+            find_pairs_within(hashes_of(dst_set, dst_items), threshold, worker_count),
+            find_pairs_between(hashes_of(src_set, src_items), hashes_of(dst_set, dst_items),
+                threshold, worker_count)} {}
+
+    deferred_merge_pairer::deferred_merge_pairer(
+        image_set& src_set, image_set& dst_set, const std::vector<image_set::handle>& src_items,
+        const std::vector<image_set::handle>& dst_items, const candidate_list& dst_candidates,
+        const candidate_list& merge_candidates)
+      : m_src_set{src_set},
+        m_dst_set{dst_set},
+        m_items{dst_items},
+        m_dst_count{dst_items.size()} {
+
+        // Clusters of collection images come first, so that every merge pair involving one of
+        // them is deferred until the cluster has been decided, just as it would follow the
+        // cluster if decisions were made one at a time.
+
+        find_clusters(m_dst_count, dst_candidates, m_members, m_offsets);
+
+        m_items.insert(std::end(m_items), std::cbegin(src_items), std::cend(src_items));
+        for (const auto& [src_id, dst_id] : merge_candidates) {
+            m_members.push_back(dst_id);
+            m_members.push_back(m_dst_count + src_id);
+            m_offsets.push_back(m_members.size());
         }
     }
 
-    int merge_pairer::count() const {
-        return m_src_set.size() * m_dst_set.size();
+    int deferred_merge_pairer::count() const {
+        return gsl::narrow_cast<int>(m_offsets.size() - 1);
     }
 
-    void merge_pairer::pair(const ksr::function_view<compare_sig> callback) {
+    pass_planner::pass_planner(
+        const image_set& src_set, const std::vector<std::uint64_t>& dst_hashes,
+        const int threshold, const int worker_count, const std::size_t pass_size) {
+
+        const auto src_items = src_set.handles();
+        const auto dst_size = dst_hashes.size();
 
-        auto src_iter = std::begin(m_src_set);
-        const auto src_end = std::end(m_src_set);
+        // Components are found over both sets at once, with source images numbered after the
+        // destination's. The groups counted are those of a deferred_merge_pairer: the clusters
+        // within the destination, then each pair across the sets.
 
-        for (; src_iter != src_end; ++src_iter) {
+        auto candidates = find_pairs_within(dst_hashes, threshold, worker_count);
+        auto members = std::vector<std::size_t>{};
+        auto offsets = std::vector<std::size_t>{};
 
-            auto dst_iter = std::begin(m_dst_set);
-            const auto dst_end = std::end(m_dst_set);
+        find_clusters(dst_size, candidates, members, offsets);
+        m_count = gsl::narrow_cast<int>(offsets.size() - 1);
 
-            for (; dst_iter != dst_end && !thread_interrupted(); ++dst_iter) {
+        const auto merge_candidates =
+            find_pairs_between(hashes_of(src_set, src_items), dst_hashes, threshold, worker_count);
 
-                const auto choice = callback(*src_iter, *dst_iter);
-                switch (choice) {
-                    case discard_choice::lhs:
-                        src_iter = m_src_set.erase(src_iter);
-                        break;
+        m_count += gsl::narrow_cast<int>(merge_candidates.size());
+        for (const auto& [src_id, dst_id] : merge_candidates) {
+            candidates.emplace_back(dst_id, dst_size + src_id);
+        }
+
+        members.clear();
+        offsets.clear();
+        find_clusters(dst_size + src_items.size(), candidates, members, offsets);
+
+        auto pass_dst_count = std::size_t{0};
+        for (auto index = std::size_t{1}; index < offsets.size(); ++index) {
 
-                    case discard_choice::rhs:
-                        dst_iter = m_dst_set.erase(dst_iter);
-                        break;
+            const auto begin = std::cbegin(members) + offsets[index - 1];
+            const auto end = std::cbegin(members) + offsets[index];
+            const auto dst_count = gsl::narrow_cast<std::size_t>(std::count_if(begin, end,
+                [dst_size](const std::size_t id) { return id < dst_size; }));
 
-                    case discard_choice::none:
-                        break;
+            const auto full = pass_dst_count > 0 && pass_dst_count + dst_count > pass_size;
+            if (m_dst_ids.empty() || full) {
+                m_dst_ids.emplace_back();
+                m_src_items.emplace_back();
+                pass_dst_count = 0;
+            }
+
+            pass_dst_count += dst_count;
+            for (auto iter = begin; iter != end; ++iter) {
+                if (*iter < dst_size) {
+                    m_dst_ids.back().push_back(*iter);
+                } else {
+                    m_src_items.back().push_back(src_items[*iter - dst_size]);
                 }
             }
         }
+
+        for (auto& ids : m_dst_ids) {
+            std::sort(std::begin(ids), std::end(ids));
+        }
+    }
+
+    stream_pairer::stream_pairer(image_set& src_set, image_set& dst_set, const int threshold)
+      : m_src_set{src_set},
+        m_dst_set{dst_set},
+        m_src_items{src_set.handles()},
+        m_dst_items{dst_set.handles()},
+        m_src_erased(m_src_items.size()),
+        m_dst_erased(m_dst_items.size()),
+        m_src_index{threshold},
+        m_dst_index{threshold} {
+
+        for (auto id = std::size_t{0}; id < m_src_items.size(); ++id) {
+            m_src_index.insert(m_src_set.phash(m_src_items[id]), id);
+        }
+
+        for (auto id = std::size_t{0}; id < m_dst_items.size(); ++id) {
+            m_dst_index.insert(m_dst_set.phash(m_dst_items[id]), id);
+        }
+    }
+
+    std::vector<std::size_t> stream_pairer::sorted_matches(
+        const phash_index& index, const std::uint64_t hash) {
+
+        // Matches are sorted so that the order of comparisons doesn't depend on the internal
+        // layout of the indices.
+
+        auto result = std::vector<std::size_t>{};
+        index.find(hash, [&result](const std::size_t id) {
+            result.push_back(id);
+        });
+
+        std::sort(std::begin(result), std::end(result));
+        return result;
     }
 }
@@ -1,101 +1,474 @@
 #ifndef MYRIAD_PAIRER_HPP
 #define MYRIAD_PAIRER_HPP
 
-#include "hash.hpp"
 #include "image_info.hpp"
-#include "ksr/function_view.hpp"
+#include "image_set.hpp"
+#include "parallel.hpp"
+#include "phash_index.hpp"
 
-#include <unordered_set>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace myriad {
 
-    // We need our image_info container to provide reasonable (optimised) performance on erasure
-    // and search, robust iterator invalidation guarantees make life much nicer in
-    // compare_images(), and the cases where contiguous-memory performance gains kick in are
-    // those cases where the container is sufficiently small that its performance doesn't really
-    // matter. So std::unordered_set is a good choice for now (though std::colony would be worth
-    // a look if it ever becomes a thing; not worth the extra dependency for now though).
+    enum class discard_choice { none, lhs, rhs };
 
-    using image_set = std::unordered_set<image_info>;
+    ///
+    /// The outcome of a decision between a group of duplicate images: the index within the group
+    /// of the one image to keep, all of the others being discarded, or no index if every image in
+    /// the group is to be kept.
+    ///
 
-    enum class discard_choice { none, lhs, rhs };
+    using keep_choice = std::optional<std::size_t>;
 
-    // TODO We don't need the virtual function mechanism (and therefore function_view); a
-    // templatised approach would be better.
+    using candidate_list = std::vector<std::pair<std::size_t, std::size_t>>;
 
     ///
-    /// \ref pairer implementations provide specific algorithms for matching up images within one or
+    /// Finds every pair of \p hashes within \p threshold of each other, as pairs of indices into
+    /// \p hashes with the lesser index first, on up to \p worker_count threads. The pairs are
+    /// sorted, however many threads are used. This is the search for candidates made by a
+    /// \ref deferred_merge_pairer within its destination container.
+    ///
+
+    candidate_list find_pairs_within(
+        const std::vector<std::uint64_t>& hashes, int threshold, int worker_count = 1);
+
+    ///
+    /// Finds every pair of a hash in \p src_hashes and a hash in \p dst_hashes within
+    /// \p threshold of each other, as sorted pairs of indices into each, on up to
+    /// \p worker_count threads. This is the search for candidates made by a
+    /// \ref deferred_merge_pairer between its source and destination containers.
+    ///
+
+    candidate_list find_pairs_between(
+        const std::vector<std::uint64_t>& src_hashes, const std::vector<std::uint64_t>& dst_hashes,
+        int threshold, int worker_count = 1);
+
+    ///
+    /// The pairer classes below provide specific algorithms for matching up images within one or
     /// more containers, defining which images get compared to which other images and the order in
-    /// which these comparisons happen.
+    /// which these comparisons happen. Only images whose perceptual hashes are within a threshold
+    /// Hamming distance of each other are ever compared. A \ref deferred_merge_pairer finds these
+    /// candidates when it is constructed, so the underlying containers must not be modified (other
+    /// than by the pairer itself) between its construction and the completion of pair(). The
+    /// perceptual hashes of the images are copied into contiguous arrays indexed in parallel with
+    /// the handles of the images themselves, so that the search for candidates never needs to
+    /// touch the images' records in their containers.
+    ///
+    /// The search for candidates is divided into tiles that are distributed between
+    /// \c worker_count threads, and may be interrupted by requesting an interruption on the
+    /// constructing thread (in which case some candidates will be missing). The candidates found
+    /// are always paired in the same order, however many threads are used, and since discarding
+    /// an image depends on the outcomes of the pairings before it, pair() itself always resolves
+    /// them on the calling thread.
+    ///
+    /// The callables passed to the pairers are template arguments, so they are called directly
+    /// rather than through type-erased wrappers, and may be inlined into the loop over the
+    /// candidates. Pairing may be interrupted by requesting an interruption on the calling thread.
+    ///
+
+    ///
+    /// Deduplicates a destination container and merges a source container into it, without
+    /// waiting on decisions that take time to be made (such as by asking the user). Each cluster
+    /// of duplicate destination images forms a group to be decided between: a connected component
+    /// of the graph whose edges join the images within \p threshold of each other, so that two
+    /// images in a cluster may be further than \p threshold apart, so long as a chain of
+    /// duplicates joins them. So does each pair of a destination image and a source image within
+    /// \p threshold of each other, in that order. count() gives the number of groups, which may
+    /// overestimate the number offered, since groups involving discarded images are skipped.
+    /// pair() offers every group to \p request, passing a vector of its images and a ticket
+    /// identifying it; this returns the \ref keep_choice for the group at once if it can, or an
+    /// empty \c std::optional if the decision is still pending. \p wait must then return the
+    /// tickets and choices of the pending decisions made since it was last called; if its
+    /// argument is \c true, it must block until there is at least one, unless an interruption is
+    /// requested on the calling thread.
+    ///
+    /// Clusters are offered first, in the container's own order, and then the pairs in order of
+    /// their source and destination images, except that a group containing an image involved in
+    /// a pending decision, or in a group already deferred behind one, is deferred until every
+    /// earlier group involving its images has been decided; it is then dropped if any of its
+    /// images was discarded. Every other group is offered
+    /// meanwhile, so that the time taken by decisions overlaps with the rest of the comparison
+    /// rather than adding to it. Each image is still decided upon one group at a time, in order,
+    /// so the outcome is the same as if the groups were decided one at a time. Discarded images
+    /// are erased from their containers in batches, as the outcomes of pending decisions arrive.
     ///
 
-    class pairer {
+    class deferred_merge_pairer {
     public:
 
-        using compare_sig = discard_choice(const image_info&, const image_info&);
+        explicit deferred_merge_pairer(
+            image_set& src_set, image_set& dst_set, int threshold, int worker_count = 1);
 
         ///
-        /// Calculates the number of image pairings that will be processed by the \ref pairer
-        /// implementation, when the pair() member function is executed to completion.
+        /// Constructs a pairer from candidates that have already been found, such as by other
+        /// processes: \p dst_candidates as by find_pairs_within() over the images \p dst_items
+        /// of \p dst_set, and \p merge_candidates as by find_pairs_between() from the images
+        /// \p src_items of \p src_set to \p dst_items.
         ///
 
-        virtual int count() const = 0;
+        explicit deferred_merge_pairer(
+            image_set& src_set, image_set& dst_set,
+            const std::vector<image_set::handle>& src_items,
+            const std::vector<image_set::handle>& dst_items,
+            const candidate_list& dst_candidates, const candidate_list& merge_candidates);
 
-        ///
-        /// Matches up \ref image_info objects from within a container or containers referenced by
-        /// the specific \ref pairer implementation, and for each such pair, calls \p callback to
-        /// determine which of the pair (if either) should be discarded, then erases elements from
-        /// or moves elements between the underlying containers if appropriate before continuing.
-        /// This process may be interrupted by requesting an interruption on the calling thread.
-        ///
+        int count() const;
+
+        template <typename Request, typename Wait>
+        void pair(Request&& request, Wait&& wait);
+
+    private:
+
+        explicit deferred_merge_pairer(
+            image_set& src_set, image_set& dst_set,
+            const std::vector<image_set::handle>& src_items,
+            const std::vector<image_set::handle>& dst_items, int threshold, int worker_count);
+
+        image_set& m_src_set;
+        image_set& m_dst_set;
 
-        virtual void pair(ksr::function_view<compare_sig> callback) = 0;
+        // Destination images are identified by their indices into m_items, and source images by
+        // their indices offset by m_dst_count. The members of each group are stored contiguously,
+        // and m_offsets holds the index in m_members at which each group begins, followed by the
+        // total number of members.
+
+        std::vector<image_set::handle> m_items;
+        std::size_t m_dst_count;
+        std::vector<std::size_t> m_members;
+        std::vector<std::size_t> m_offsets;
     };
 
     ///
-    /// Pairs every \ref image_info object within a single container with every other such object
-    /// exactly once, in an unspecified order. If the the callback passed to pair() specifies that
-    /// one of the paired images should be discarded, it is deleted without any effect on the other
-    /// image in the pair.
+    /// Plans the work of a \ref deferred_merge_pairer from a source container into a destination
+    /// of which only the perceptual hashes are known (such as an \ref image_spill), dividing it
+    /// into passes that each involve at most \p pass_size destination images, unless a single
+    /// group of connected duplicates has more than that. Each pass is made up of whole connected
+    /// components of the graph whose edges join the images within \p threshold of each other,
+    /// so no decision made in one pass can affect another, and pairing the images of each pass
+    /// in turn has the same outcome as pairing them all at once. Images with no duplicates belong
+    /// to no pass, so the destination's full records need only be read for the images that have
+    /// duplicates, and only for one pass at a time.
     ///
 
-    class deduplicate_pairer : public pairer {
+    class pass_planner {
     public:
 
-        explicit deduplicate_pairer(image_set& set)
-          : m_set{set} {
+        explicit pass_planner(
+            const image_set& src_set, const std::vector<std::uint64_t>& dst_hashes, int threshold,
+            int worker_count, std::size_t pass_size);
+
+        ///
+        /// Gets the number of groups that a \ref deferred_merge_pairer would decide between
+        /// over all of the passes together.
+        ///
+
+        int count() const {
+            return m_count;
+        }
+
+        std::size_t pass_count() const {
+            return m_dst_ids.size();
+        }
+
+        ///
+        /// Gets the indices into the destination's hashes of the images in the pass with the
+        /// index \p pass, in ascending order.
+        ///
+
+        const std::vector<std::size_t>& dst_ids(const std::size_t pass) const {
+            return m_dst_ids[pass];
         }
 
-        int count() const override;
-        void pair(ksr::function_view<compare_sig> callback) override;
+        const std::vector<image_set::handle>& src_items(const std::size_t pass) const {
+            return m_src_items[pass];
+        }
 
     private:
-        image_set& m_set;
+        int m_count = 0;
+        std::vector<std::vector<std::size_t>> m_dst_ids;
+        std::vector<std::vector<image_set::handle>> m_src_items;
     };
 
     ///
-    /// Pairs each \ref image_info object in a source container with every \ref image_info object in
-    /// a destination container (but does not compare images internally within either of these
-    /// containers). If the callback passed to pair() specifies that one of the paired images should
-    /// be discarded, the other image in the pair is moved to its former location following the
-    /// deletion. This callback is passed the source image as its first argument and the destination
-    /// image as the second argument.
+    /// Pairs images as they are added one at a time to a destination container, for use while
+    /// those images are still being produced. Each image added is first paired with every image
+    /// in the destination container within \p threshold of it, then, unless it was discarded,
+    /// with every image in the source container within \p threshold of it (with the source image
+    /// as the first argument to the comparison). Since the full set of images is never known,
+    /// candidates are found with \ref phash_index objects that grow as images are added, rather
+    /// than in advance. Neither container may be modified other than by the \ref stream_pairer
+    /// while it exists.
     ///
 
-    class merge_pairer : public pairer {
+    class stream_pairer {
     public:
 
-        explicit merge_pairer(image_set& src_set, image_set& dst_set)
-          : m_src_set{src_set}, m_dst_set{dst_set} {
-        }
+        explicit stream_pairer(image_set& src_set, image_set& dst_set, int threshold);
+
+        ///
+        /// Inserts \p item into the destination container and pairs it with the images already
+        /// present as described above, calling \p compare for each such pair to determine which
+        /// of the pair (if either) should be discarded. Returns the number of pairs compared. This
+        /// process may be interrupted by requesting an interruption on the calling thread.
+        ///
 
-        int count() const override;
-        void pair(ksr::function_view<compare_sig> callback) override;
+        template <typename Compare>
+        int add(const image_info& item, Compare&& compare);
 
     private:
-        image_set &m_src_set;
-        image_set &m_dst_set;
+
+        static std::vector<std::size_t> sorted_matches(
+            const phash_index& index, std::uint64_t hash);
+
+        image_set& m_src_set;
+        image_set& m_dst_set;
+        std::vector<image_set::handle> m_src_items;
+        std::vector<image_set::handle> m_dst_items;
+        std::vector<bool> m_src_erased;
+        std::vector<bool> m_dst_erased;
+        phash_index m_src_index;
+        phash_index m_dst_index;
     };
+
+    template <typename Request, typename Wait>
+    void deferred_merge_pairer::pair(Request&& request, Wait&& wait) {
+
+        const auto group_count = m_offsets.size() - 1;
+        auto erased = std::vector<bool>(m_items.size());
+        auto pending_count = std::size_t{0};
+
+        // Each image in a group that is pending, or deferred behind one, holds a queue of those
+        // groups in the order they were reached. A deferred group is only offered again once it
+        // is at the front of the queues of all of its images, so that every image is decided
+        // upon one group at a time, in order, whenever the decisions ahead of it are made. Groups
+        // that are decided at once never enter the queues.
+
+        auto queues = std::unordered_map<std::size_t, std::deque<std::size_t>>{};
+        auto deferred = std::vector<bool>(group_count);
+        auto ready = std::deque<std::size_t>{};
+        auto discarded = std::vector<std::size_t>{};
+        auto group = std::vector<image_info>{};
+
+        const auto enqueue = [this, &queues](const std::size_t index) {
+            for (auto member = m_offsets[index]; member < m_offsets[index + 1]; ++member) {
+                queues[m_members[member]].push_back(index);
+            }
+        };
+
+        const auto at_front = [this, &queues](const std::size_t index) {
+            return std::all_of(
+                std::cbegin(m_members) + m_offsets[index],
+                std::cbegin(m_members) + m_offsets[index + 1],
+                [&queues, index](const std::size_t id) { return queues[id].front() == index; });
+        };
+
+        // Takes a group from the front of its images' queues, readying each deferred group that
+        // is then at the front of all of its own.
+
+        const auto release = [this, &queues, &deferred, &ready, &at_front](
+            const std::size_t index) {
+
+            for (auto member = m_offsets[index]; member < m_offsets[index + 1]; ++member) {
+
+                const auto id = m_members[member];
+                auto& queue = queues[id];
+                queue.pop_front();
+
+                if (queue.empty()) {
+                    queues.erase(id);
+                } else if (const auto next = queue.front(); deferred[next] && at_front(next)) {
+                    deferred[next] = false;
+                    ready.push_back(next);
+                }
+            }
+        };
+
+        const auto apply = [this, &erased, &discarded](
+            const std::size_t index, const keep_choice& choice) {
+
+            const auto begin = m_offsets[index];
+            const auto end = m_offsets[index + 1];
+            for (auto member = begin; member < end && choice; ++member) {
+                const auto id = m_members[member];
+                if (member - begin != *choice) {
+                    erased[id] = true;
+                    discarded.push_back(id);
+                }
+            }
+        };
+
+        const auto erase_discarded = [this, &discarded] {
+            for (const auto id : discarded) {
+                if (id < m_dst_count) {
+                    m_dst_set.erase(m_items[id]);
+                } else {
+                    m_src_set.erase(m_items[id]);
+                }
+            }
+
+            discarded.clear();
+        };
+
+        auto next_index = std::size_t{0};
+        while (!thread_interrupted()) {
+
+            if (pending_count > 0 && (ready.empty() || next_index == group_count)) {
+                const auto block = ready.empty() && next_index == group_count;
+                for (const auto& [index, choice] : wait(block)) {
+                    apply(index, choice);
+                    release(index);
+                    --pending_count;
+                }
+
+                erase_discarded();
+            }
+
+            auto index = std::size_t{0};
+            auto queued = false;
+
+            if (!ready.empty()) {
+                index = ready.front();
+                ready.pop_front();
+                queued = true;
+            } else if (next_index < group_count) {
+                index = next_index++;
+            } else if (pending_count > 0) {
+                continue;
+            } else {
+                break;
+            }
+
+            const auto begin = std::cbegin(m_members) + m_offsets[index];
+            const auto end = std::cbegin(m_members) + m_offsets[index + 1];
+
+            const auto skip = std::any_of(begin, end,
+                [&erased](const std::size_t id) { return erased[id]; });
+
+            if (skip) {
+                if (queued) {
+                    release(index);
+                }
+
+                continue;
+            }
+
+            const auto blocked = !queued && std::any_of(begin, end,
+                [&queues](const std::size_t id) { return queues.count(id) != 0; });
+
+            if (blocked) {
+                enqueue(index);
+                deferred[index] = true;
+                continue;
+            }
+
+            group.clear();
+            for (auto member = begin; member < end; ++member) {
+                const auto id = *member;
+                const auto& set = (id < m_dst_count) ? m_dst_set : m_src_set;
+                group.push_back(set.info(m_items[id]));
+            }
+
+            if (const auto choice = request(std::as_const(group), index)) {
+                apply(index, *choice);
+                if (queued) {
+                    release(index);
+                }
+            } else {
+                if (!queued) {
+                    enqueue(index);
+                }
+
+                ++pending_count;
+            }
+        }
+
+        erase_discarded();
+    }
+
+    template <typename Compare>
+    int stream_pairer::add(const image_info& item, Compare&& compare) {
+
+        const auto [handle, inserted] = m_dst_set.insert(item);
+        if (!inserted) {
+            return 0;
+        }
+
+        const auto id = m_dst_items.size();
+        const auto hash = item.phash();
+
+        m_dst_items.push_back(handle);
+        m_dst_erased.push_back(false);
+
+        // The image being added is only indexed once it has survived deduplication.
+
+        auto count = 0;
+        for (const auto lhs_id : sorted_matches(m_dst_index, hash)) {
+
+            if (thread_interrupted()) {
+                return count;
+            }
+
+            if (m_dst_erased[lhs_id]) {
+                continue;
+            }
+
+            ++count;
+            const auto choice = compare(m_dst_set.info(m_dst_items[lhs_id]), item);
+            switch (choice) {
+                case discard_choice::lhs:
+                    m_dst_set.erase(m_dst_items[lhs_id]);
+                    m_dst_erased[lhs_id] = true;
+                    break;
+
+                case discard_choice::rhs:
+                    m_dst_set.erase(handle);
+                    m_dst_erased[id] = true;
+                    return count;
+
+                case discard_choice::none:
+                    break;
+            }
+        }
+
+        m_dst_index.insert(hash, id);
+
+        for (const auto src_id : sorted_matches(m_src_index, hash)) {
+
+            if (thread_interrupted()) {
+                return count;
+            }
+
+            if (m_src_erased[src_id]) {
+                continue;
+            }
+
+            ++count;
+            const auto choice = compare(m_src_set.info(m_src_items[src_id]), item);
+            switch (choice) {
+                case discard_choice::lhs:
+                    m_src_set.erase(m_src_items[src_id]);
+                    m_src_erased[src_id] = true;
+                    break;
+
+                case discard_choice::rhs:
+                    m_dst_set.erase(handle);
+                    m_dst_erased[id] = true;
+                    return count;
+
+                case discard_choice::none:
+                    break;
+            }
+        }
+
+        return count;
+    }
 }
 
 #endif
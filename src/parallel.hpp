@@ -0,0 +1,63 @@
+#ifndef MYRIAD_PARALLEL_HPP
+#define MYRIAD_PARALLEL_HPP
+
+#include <QThread>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// Determines whether an interruption has been requested on the calling thread, which
+    /// long-running operations check periodically in order to finish early.
+    ///
+
+    inline bool thread_interrupted() {
+        return QThread::currentThread()->isInterruptionRequested();
+    }
+
+    ///
+    /// Calls \p func with each index in the range <tt>[0, count)</tt>, using up to
+    /// \p worker_count threads including the calling one. Each thread claims the next unclaimed
+    /// index whenever it finishes with its last, so tasks of uneven cost are balanced between
+    /// threads without any coordination beyond a shared counter. No new indices are claimed once
+    /// an interruption has been requested on the calling thread, in which case some indices may
+    /// never be passed to \p func. Returns once every claimed call has completed.
+    ///
+
+    template <typename Func>
+    void parallel_for(const std::size_t count, const int worker_count, Func&& func) {
+
+        const auto owner = QThread::currentThread();
+        auto next_index = std::atomic<std::size_t>{0};
+
+        const auto work = [owner, count, &next_index, &func] {
+            for (auto index = next_index++; index < count; index = next_index++) {
+                if (owner->isInterruptionRequested()) {
+                    return;
+                }
+
+                func(index);
+            }
+        };
+
+        const auto thread_count = std::min(
+            static_cast<std::size_t>(std::max(worker_count, 1)), std::max(count, std::size_t{1}));
+
+        auto workers = std::vector<std::thread>{};
+        for (auto i = std::size_t{1}; i < thread_count; ++i) {
+            workers.emplace_back(work);
+        }
+
+        work();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+}
+
+#endif
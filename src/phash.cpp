@@ -0,0 +1,464 @@
+#include "phash.hpp"
+
+#include <QImage>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace myriad {
+
+    namespace {
+
+        constexpr auto pi = 3.14159265358979323846;
+
+        constexpr auto dct_size = 32;
+        constexpr auto block_size = 8;
+        constexpr auto filter_radius = 3;
+
+        template <int Size>
+        using square_matrix = std::array<float, Size * Size>;
+
+        using coefficient_block = std::array<float, block_size * block_size>;
+
+        ///
+        /// Gets the \p Size by \p Size matrix of the type-II discrete cosine transform (stored in
+        /// row-major order), computed with exactly the same mix of single- and double-precision
+        /// arithmetic as <tt>ph_dct_matrix()</tt>.
+        ///
+
+        template <int Size>
+        const square_matrix<Size>& dct_basis() {
+
+            static const auto result = [] {
+
+                auto basis = square_matrix<Size>{};
+                const auto first_row = 1 / std::sqrt(static_cast<float>(Size));
+                const auto scale = std::sqrt(2.0 / Size);
+
+                for (auto x = 0; x < Size; ++x) {
+                    basis[x] = first_row;
+                    for (auto y = 1; y < Size; ++y) {
+                        const auto value = scale * std::cos((pi / 2 / Size) * y * (2 * x + 1));
+                        basis[y * Size + x] = static_cast<float>(value);
+                    }
+                }
+
+                return basis;
+            }();
+
+            return result;
+        }
+
+        ///
+        /// Computes the block of coefficients in rows and columns 1 to \c block_size (inclusive)
+        /// of <tt>C * input * transpose(C)</tt>, where \c C is the DCT basis, and returns them in
+        /// row-major order. Only the rows of the intermediate product that contribute to this
+        /// block are computed. Each coefficient is accumulated in double precision, over the same
+        /// sequence of single-precision products and in the same order as CImg's matrix product,
+        /// so that the result is identical to that of computing the full transform with CImg.
+        /// The independent sums are laid out contiguously so that the compiler can vectorise across
+        /// them without reordering any individual sum.
+        ///
+
+        template <int Size>
+        coefficient_block low_frequency_dct(const square_matrix<Size>& input) {
+
+            const auto& basis = dct_basis<Size>();
+
+            auto partial = std::array<float, block_size * Size>{};
+            for (auto row = 0; row < block_size; ++row) {
+
+                auto sums = std::array<double, Size>{};
+                for (auto k = 0; k < Size; ++k) {
+                    const auto coefficient = basis[(row + 1) * Size + k];
+                    for (auto col = 0; col < Size; ++col) {
+                        sums[col] += coefficient * input[k * Size + col];
+                    }
+                }
+
+                for (auto col = 0; col < Size; ++col) {
+                    partial[row * Size + col] = static_cast<float>(sums[col]);
+                }
+            }
+
+            auto result = coefficient_block{};
+            for (auto row = 0; row < block_size; ++row) {
+
+                auto sums = std::array<double, block_size>{};
+                for (auto k = 0; k < Size; ++k) {
+                    const auto value = partial[row * Size + k];
+                    for (auto col = 0; col < block_size; ++col) {
+                        sums[col] += value * basis[(col + 1) * Size + k];
+                    }
+                }
+
+                for (auto col = 0; col < block_size; ++col) {
+                    result[row * block_size + col] = static_cast<float>(sums[col]);
+                }
+            }
+
+            return result;
+        }
+
+        ///
+        /// Computes the median of \p values as CImg does: for an even number of values, this is
+        /// the mean of the two middle values, computed in single precision.
+        ///
+
+        float median(coefficient_block values) {
+
+            const auto begin = std::begin(values);
+            const auto middle = begin + values.size() / 2;
+            std::nth_element(begin, middle, std::end(values));
+
+            const auto upper = *middle;
+            const auto lower = *std::max_element(begin, middle);
+            return (upper + lower) / 2;
+        }
+
+        ///
+        /// Reduces \p image to the input of the DCT as <tt>ph_dct_imagehash()</tt> does: by
+        /// convolving it with a 7x7 box filter (extending the edges of the image outwards) and
+        /// taking a nearest-neighbour sample of the result. Only the filtered values at the sampled
+        /// points are computed. These are sums of at most 49 8-bit values, and therefore exact in
+        /// single precision however they are accumulated.
+        ///
+
+        square_matrix<dct_size> reduce_compatible(const grey_view& image) {
+
+            const auto sample_offsets = [](const int extent) {
+
+                // CImg's nearest-neighbour resize maps output index i to input index
+                // floor(i * extent / dct_size); the filter window around each of those is clamped
+                // to the image.
+
+                auto result = std::array<std::array<int, 2 * filter_radius + 1>, dct_size>{};
+                for (auto i = 0; i < dct_size; ++i) {
+                    const auto centre = gsl::narrow_cast<int>(std::int64_t{i} * extent / dct_size);
+                    for (auto d = -filter_radius; d <= filter_radius; ++d) {
+                        result[i][d + filter_radius] = std::clamp(centre + d, 0, extent - 1);
+                    }
+                }
+
+                return result;
+            };
+
+            const auto cols = sample_offsets(image.width);
+            const auto rows = sample_offsets(image.height);
+
+            auto result = square_matrix<dct_size>{};
+            for (auto y = 0; y < dct_size; ++y) {
+                for (auto x = 0; x < dct_size; ++x) {
+
+                    auto sum = 0;
+                    for (const auto row : rows[y]) {
+                        const auto line = image.pixels + row * image.stride;
+                        for (const auto col : cols[x]) {
+                            sum += line[col];
+                        }
+                    }
+
+                    result[y * dct_size + x] = static_cast<float>(sum);
+                }
+            }
+
+            return result;
+        }
+
+        ///
+        /// Reduces \p image to a grid of \p Columns by \p Rows cells (in row-major order) by
+        /// averaging the pixels in each cell. Rows are accumulated into per-column sums a band at
+        /// a time, in a loop simple enough for the compiler to vectorise, so that each pixel is
+        /// touched exactly once (for images with at least as many pixels as cells in each
+        /// dimension).
+        ///
+
+        template <int Columns, int Rows>
+        std::array<float, Columns * Rows> reduce_cells(const grey_view& image) {
+
+            const auto cell_bounds = [](const int extent, const int index, const int count) {
+                const auto begin = gsl::narrow_cast<int>(std::int64_t{index} * extent / count);
+                const auto end = gsl::narrow_cast<int>(std::int64_t{index + 1} * extent / count);
+                return std::make_pair(begin, std::max(end, begin + 1));
+            };
+
+            auto column_sums = std::vector<std::uint32_t>(image.width);
+            auto result = std::array<float, Columns * Rows>{};
+
+            for (auto y = 0; y < Rows; ++y) {
+
+                const auto [row_begin, row_end] = cell_bounds(image.height, y, Rows);
+                std::fill(std::begin(column_sums), std::end(column_sums), 0);
+
+                for (auto row = row_begin; row < row_end; ++row) {
+                    const auto line = image.pixels + row * image.stride;
+                    for (auto col = 0; col < image.width; ++col) {
+                        column_sums[col] += line[col];
+                    }
+                }
+
+                for (auto x = 0; x < Columns; ++x) {
+
+                    const auto [col_begin, col_end] = cell_bounds(image.width, x, Columns);
+                    const auto sums = column_sums.data();
+                    const auto sum = std::accumulate(
+                        sums + col_begin, sums + col_end, std::uint64_t{0});
+
+                    const auto area = (row_end - row_begin) * (col_end - col_begin);
+                    result[y * Columns + x] = static_cast<float>(sum) / static_cast<float>(area);
+                }
+            }
+
+            return result;
+        }
+
+        ///
+        /// Reduces \p image to the input of the DCT by averaging the pixels in each cell of a
+        /// 32x32 grid laid over it.
+        ///
+
+        square_matrix<dct_size> reduce_area(const grey_view& image) {
+            return reduce_cells<dct_size, dct_size>(image);
+        }
+
+        ///
+        /// Converts \p count pixels from \p source, in the 32-bit RGB format used by \c QImage, to
+        /// the luma values that CImg's <tt>RGBtoYCbCr()</tt> computes for them, writing these to
+        /// \p dest. CImg computes these in single precision, but the computation involves only
+        /// integers and divisions by a power of two small enough to be exact, and so can be
+        /// performed in 16-bit integer arithmetic; with SSE2 and AVX2, 8 and 16 pixels
+        /// respectively are converted at a time.
+        ///
+
+        void rgb_to_luma(const QRgb* source, std::uint8_t* dest, const int count) {
+
+            auto index = 0;
+
+#if defined(__AVX2__)
+
+            const auto wide_mask = _mm256_set1_epi32(0xff);
+            const auto wide_r_weight = _mm256_set1_epi16(66);
+            const auto wide_g_weight = _mm256_set1_epi16(129);
+            const auto wide_b_weight = _mm256_set1_epi16(25);
+            const auto wide_rounding = _mm256_set1_epi16(128);
+            const auto wide_offset = _mm256_set1_epi16(16);
+
+            for (; index + 16 <= count; index += 16) {
+
+                const auto pixels = reinterpret_cast<const __m256i*>(source + index);
+                const auto lo = _mm256_loadu_si256(pixels);
+                const auto hi = _mm256_loadu_si256(pixels + 1);
+
+                const auto channel = [&lo, &hi, &wide_mask](const int shift) {
+                    return _mm256_packs_epi32(
+                        _mm256_and_si256(_mm256_srli_epi32(lo, shift), wide_mask),
+                        _mm256_and_si256(_mm256_srli_epi32(hi, shift), wide_mask));
+                };
+
+                auto luma = _mm256_mullo_epi16(channel(16), wide_r_weight);
+                luma = _mm256_add_epi16(luma, _mm256_mullo_epi16(channel(8), wide_g_weight));
+                luma = _mm256_add_epi16(luma, _mm256_mullo_epi16(channel(0), wide_b_weight));
+                luma = _mm256_add_epi16(luma, wide_rounding);
+                luma = _mm256_add_epi16(_mm256_srli_epi16(luma, 8), wide_offset);
+
+                // The packs above work within 128-bit lanes, interleaving the halves of lo and hi;
+                // this restores their original order before narrowing to bytes.
+
+                luma = _mm256_permute4x64_epi64(luma, _MM_SHUFFLE(3, 1, 2, 0));
+                const auto packed = _mm_packus_epi16(
+                    _mm256_castsi256_si128(luma), _mm256_extracti128_si256(luma, 1));
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + index), packed);
+            }
+
+#endif
+
+#if defined(__SSE2__)
+
+            const auto mask = _mm_set1_epi32(0xff);
+            const auto r_weight = _mm_set1_epi16(66);
+            const auto g_weight = _mm_set1_epi16(129);
+            const auto b_weight = _mm_set1_epi16(25);
+            const auto rounding = _mm_set1_epi16(128);
+            const auto offset = _mm_set1_epi16(16);
+
+            for (; index + 8 <= count; index += 8) {
+
+                const auto pixels = reinterpret_cast<const __m128i*>(source + index);
+                const auto lo = _mm_loadu_si128(pixels);
+                const auto hi = _mm_loadu_si128(pixels + 1);
+
+                const auto channel = [&lo, &hi, &mask](const int shift) {
+                    return _mm_packs_epi32(
+                        _mm_and_si128(_mm_srli_epi32(lo, shift), mask),
+                        _mm_and_si128(_mm_srli_epi32(hi, shift), mask));
+                };
+
+                auto luma = _mm_mullo_epi16(channel(16), r_weight);
+                luma = _mm_add_epi16(luma, _mm_mullo_epi16(channel(8), g_weight));
+                luma = _mm_add_epi16(luma, _mm_mullo_epi16(channel(0), b_weight));
+                luma = _mm_add_epi16(luma, rounding);
+                luma = _mm_add_epi16(_mm_srli_epi16(luma, 8), offset);
+
+                _mm_storel_epi64(
+                    reinterpret_cast<__m128i*>(dest + index), _mm_packus_epi16(luma, luma));
+            }
+
+#endif
+
+            for (; index < count; ++index) {
+                const auto pixel = source[index];
+                const auto luma = 66 * qRed(pixel) + 129 * qGreen(pixel) + 25 * qBlue(pixel) + 128;
+                dest[index] = gsl::narrow_cast<std::uint8_t>((luma >> 8) + 16);
+            }
+        }
+
+        ///
+        /// Calls \p func with a greyscale view of the decoded image \p image, taken from its raw
+        /// intensities if \p single_channel is \c true and from its luma otherwise (as described
+        /// for dct_hash()), and returns the result.
+        ///
+
+        template <typename Func>
+        std::uint64_t hash_grey(const QImage& image, const bool single_channel, Func&& func) {
+
+            const auto width = image.width();
+            const auto height = image.height();
+
+            if (single_channel) {
+                const auto grey = image.convertToFormat(QImage::Format_Grayscale8);
+                return func(grey_view{grey.constBits(), width, height, grey.bytesPerLine()});
+            }
+
+            const auto rgb = image.convertToFormat(QImage::Format_RGB32);
+            auto luma = std::vector<std::uint8_t>(gsl::narrow_cast<std::size_t>(width) * height);
+
+            for (auto y = 0; y < height; ++y) {
+                const auto line = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+                rgb_to_luma(line, &luma[gsl::narrow_cast<std::size_t>(y) * width], width);
+            }
+
+            return func(grey_view{luma.data(), width, height, width});
+        }
+    }
+
+    std::uint64_t match_mask(
+        const std::uint64_t query, const std::uint64_t* const hashes, const std::size_t count,
+        const int threshold) {
+
+        auto result = std::uint64_t{0};
+        auto index = std::size_t{0};
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+
+        const auto query_512 = _mm512_set1_epi64(static_cast<long long>(query));
+        const auto threshold_512 = _mm512_set1_epi64(threshold);
+
+        for (; index + 8 <= count; index += 8) {
+            const auto diff = _mm512_xor_si512(_mm512_loadu_si512(hashes + index), query_512);
+            const auto mask = _mm512_cmple_epu64_mask(_mm512_popcnt_epi64(diff), threshold_512);
+            result |= std::uint64_t{mask} << index;
+        }
+
+#elif defined(__AVX2__)
+
+        // AVX2 has no 64-bit popcount, so bits are counted a nibble at a time by table lookup
+        // and the per-byte counts summed into each 64-bit lane by a sum of absolute differences
+        // against zero.
+
+        const auto query_256 = _mm256_set1_epi64x(static_cast<long long>(query));
+        const auto threshold_256 = _mm256_set1_epi64x(threshold);
+        const auto nibble_mask = _mm256_set1_epi8(0x0f);
+        const auto nibble_counts = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+
+        for (; index + 4 <= count; index += 4) {
+
+            const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hashes + index));
+            const auto diff = _mm256_xor_si256(block, query_256);
+
+            const auto lo = _mm256_and_si256(diff, nibble_mask);
+            const auto hi = _mm256_and_si256(_mm256_srli_epi16(diff, 4), nibble_mask);
+            const auto byte_counts = _mm256_add_epi8(
+                _mm256_shuffle_epi8(nibble_counts, lo), _mm256_shuffle_epi8(nibble_counts, hi));
+
+            const auto counts = _mm256_sad_epu8(byte_counts, _mm256_setzero_si256());
+            const auto over = _mm256_cmpgt_epi64(counts, threshold_256);
+            const auto mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(over)) & 0xf;
+            result |= static_cast<std::uint64_t>(mask) << index;
+        }
+
+#endif
+
+        for (; index < count; ++index) {
+            if (hamming_distance(hashes[index], query) <= threshold) {
+                result |= std::uint64_t{1} << index;
+            }
+        }
+
+        return result;
+    }
+
+    std::uint64_t dct_hash(const grey_view& image, const phash_variant variant) {
+
+        const auto reduced = (variant == phash_variant::compatible)
+            ? reduce_compatible(image)
+            : reduce_area(image);
+
+        const auto coefficients = low_frequency_dct<dct_size>(reduced);
+        const auto threshold = median(coefficients);
+
+        auto result = std::uint64_t{0};
+        for (auto i = 0; i < block_size * block_size; ++i) {
+            if (coefficients[i] > threshold) {
+                result |= std::uint64_t{1} << i;
+            }
+        }
+
+        return result;
+    }
+
+    std::uint64_t dct_hash(
+        const QImage& image, const bool single_channel, const phash_variant variant) {
+
+        return hash_grey(image, single_channel, [variant](const grey_view& view) {
+            return dct_hash(view, variant);
+        });
+    }
+
+    std::uint64_t difference_hash(const grey_view& image) {
+
+        constexpr auto columns = block_size + 1;
+        constexpr auto rows = block_size;
+
+        const auto cells = reduce_cells<columns, rows>(image);
+
+        auto result = std::uint64_t{0};
+        for (auto y = 0; y < rows; ++y) {
+            for (auto x = 0; x < block_size; ++x) {
+                if (cells[y * columns + x] < cells[y * columns + x + 1]) {
+                    result |= std::uint64_t{1} << (y * block_size + x);
+                }
+            }
+        }
+
+        return result;
+    }
+
+    std::uint64_t difference_hash(const QImage& image, const bool single_channel) {
+        return hash_grey(image, single_channel, [](const grey_view& view) {
+            return difference_hash(view);
+        });
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef MYRIAD_PHASH_HPP
+#define MYRIAD_PHASH_HPP
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+class QImage;
+
+namespace myriad {
+
+    ///
+    /// Selects the perceptual hash computed for an image. The first two are DCT-based hashes
+    /// computed by dct_hash(), and differ in how the image is reduced before the DCT is applied.
+    /// \c compatible reproduces the 7x7 mean filter and nearest-neighbour resize performed by
+    /// libpHash's <tt>ph_dct_imagehash()</tt>, so that its hashes match those computed by that
+    /// function (and therefore those stored by earlier versions of Myriad) bit for bit. \c area
+    /// instead averages each of the 32x32 cells of the image in a single pass, which is cheaper for
+    /// large images and less sensitive to the scale at which they were decoded, but produces
+    /// different hashes. \c difference is the gradient hash computed by difference_hash(), which
+    /// needs only a thumbnail of the image, but is too coarse to decide duplicates by itself; it
+    /// serves to rule out images that can't have any before either of the others is computed.
+    ///
+
+    enum class phash_variant { compatible, area, difference };
+
+    ///
+    /// A non-owning reference to an 8-bit single-channel image in memory. \c stride is the
+    /// distance in bytes between the starts of consecutive rows.
+    ///
+
+    struct grey_view {
+        const std::uint8_t* pixels;
+        int width;
+        int height;
+        std::ptrdiff_t stride;
+    };
+
+    ///
+    /// Computes the DCT-based perceptual hash of the greyscale image \p image, reducing it to the
+    /// 32x32 input of the DCT as specified by \p variant, which must not be
+    /// \ref phash_variant::difference.
+    ///
+
+    std::uint64_t dct_hash(const grey_view& image, phash_variant variant);
+
+    ///
+    /// Computes the DCT-based perceptual hash of the decoded image \p image. Colour images are
+    /// hashed on their luma channel; however, <tt>ph_dct_imagehash()</tt> hashes the raw
+    /// intensities of images it loads with a single channel (which differ slightly from the luma
+    /// of the same pixels), so to reproduce its output, \p single_channel should be \c true
+    /// exactly when the file that \p image was decoded from would have been loaded by that
+    /// function as a single-channel image.
+    ///
+
+    std::uint64_t dct_hash(const QImage& image, bool single_channel, phash_variant variant);
+
+    ///
+    /// Computes the difference hash ("dHash") of the greyscale image \p image: the image is
+    /// averaged down to 9x8 cells, and each bit of the hash records whether a cell is darker than
+    /// its right-hand neighbour. This costs next to nothing beyond decoding the image, which need
+    /// only be decoded at a small fraction of its size.
+    ///
+
+    std::uint64_t difference_hash(const grey_view& image);
+
+    ///
+    /// Computes the difference hash of the decoded image \p image, from the same channel as
+    /// dct_hash() would for \p single_channel.
+    ///
+
+    std::uint64_t difference_hash(const QImage& image, bool single_channel);
+
+    ///
+    /// Computes the number of bits in which the perceptual hashes \p lhs and \p rhs differ, which
+    /// is smaller the more visually similar the images they were computed from are.
+    ///
+
+    inline int hamming_distance(const std::uint64_t lhs, const std::uint64_t rhs) noexcept {
+        return static_cast<int>(std::bitset<64>{lhs ^ rhs}.count());
+    }
+
+    ///
+    /// Compares \p query against each of the \p count (at most 64) hashes starting at \p hashes,
+    /// returning a mask in which bit \c i is set if <tt>hashes[i]</tt> is within \p threshold of
+    /// \p query. Blocks of hashes are compared at once using AVX-512 (with VPOPCNTQ) or AVX2 where
+    /// the compiler is permitted to emit these, and one at a time otherwise.
+    ///
+
+    std::uint64_t match_mask(
+        std::uint64_t query, const std::uint64_t* hashes, std::size_t count, int threshold);
+
+    ///
+    /// Calls \p callback with the index of each of the \p count contiguous hashes starting at
+    /// \p hashes that is within \p threshold of \p query, in ascending order of index. This is the
+    /// exhaustive counterpart to a \ref phash_index lookup, and runs at close to memory bandwidth.
+    ///
+
+    template <typename Callback>
+    void for_each_match(
+        const std::uint64_t query, const std::uint64_t* const hashes, const std::size_t count,
+        const int threshold, Callback&& callback) {
+
+        constexpr auto block_size = std::size_t{64};
+        for (auto base = std::size_t{0}; base < count; base += block_size) {
+
+            const auto block_count = (count - base < block_size) ? count - base : block_size;
+            auto mask = match_mask(query, hashes + base, block_count, threshold);
+
+            for (; mask != 0; mask &= mask - 1) {
+                callback(base + static_cast<std::size_t>(__builtin_ctzll(mask)));
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,68 @@
+#include "phash_index.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace myriad {
+
+    phash_index::phash_index(const int threshold)
+      : m_threshold{std::clamp(threshold, 0, 64)},
+        m_radius{m_threshold / chunk_count} {
+
+        constexpr auto bucket_count = std::size_t{1} << chunk_bits;
+        for (auto& buckets : m_buckets) {
+            buckets.resize(bucket_count);
+        }
+
+        // The probe masks are all the chunk values with no more than m_radius bits set, in
+        // ascending order of that number, so that exact chunk matches are examined first.
+
+        for (auto mask = 0; mask <= std::numeric_limits<std::uint16_t>::max(); ++mask) {
+            if (hamming_distance(mask, 0) <= m_radius) {
+                m_probe_masks.push_back(static_cast<std::uint16_t>(mask));
+            }
+        }
+
+        std::stable_sort(std::begin(m_probe_masks), std::end(m_probe_masks),
+            [](const std::uint16_t lhs, const std::uint16_t rhs) {
+                return hamming_distance(lhs, 0) < hamming_distance(rhs, 0);
+            });
+    }
+
+    void phash_index::insert(const std::uint64_t hash, const std::size_t id) {
+        for (auto index = 0; index < chunk_count; ++index) {
+            auto& target = m_buckets[index][chunk(hash, index)];
+            target.hashes.push_back(hash);
+            target.ids.push_back(id);
+        }
+    }
+
+    std::size_t phash_index::probe_count(const int threshold) {
+
+        // The number of chunk values within the search radius of any given value is the sum of
+        // the binomial coefficients C(chunk_bits, k) for k up to that radius.
+
+        const auto radius = std::clamp(threshold, 0, 64) / chunk_count;
+
+        auto result = std::size_t{0};
+        auto coefficient = std::size_t{1};
+        for (auto k = 0; k <= radius; ++k) {
+            result += coefficient;
+            coefficient = coefficient * (chunk_bits - k) / (k + 1);
+        }
+
+        return chunk_count * result;
+    }
+
+    bool phash_index::found_before(
+        const std::uint64_t lhs, const std::uint64_t rhs, const int index) const {
+
+        for (auto earlier = 0; earlier < index; ++earlier) {
+            if (hamming_distance(chunk(lhs, earlier), chunk(rhs, earlier)) <= m_radius) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
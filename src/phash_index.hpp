@@ -0,0 +1,110 @@
+#ifndef MYRIAD_PHASH_INDEX_HPP
+#define MYRIAD_PHASH_INDEX_HPP
+
+#include "phash.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// An index over 64-bit perceptual hashes that finds all indexed hashes within a fixed Hamming
+    /// distance of a query hash without comparing the query against every indexed hash. This uses
+    /// multi-index hashing: each hash is split into four 16-bit chunks, and by the pigeonhole
+    /// principle, two hashes within distance \c t of each other must have at least one pair of
+    /// corresponding chunks within distance <tt>t / 4</tt>. Each chunk position therefore has its
+    /// own table of buckets keyed by chunk value, and a query need only examine the buckets whose
+    /// keys are within <tt>t / 4</tt> of its own chunks. This is very effective for the small
+    /// thresholds used to identify near-duplicate images, but degrades towards a linear scan as
+    /// the threshold grows.
+    ///
+    /// Each indexed hash is associated with an arbitrary \c std::size_t identifier supplied by
+    /// the calling code. Buckets store hashes and identifiers in separate contiguous arrays, so
+    /// that each bucket probed is scanned with the batched kernel behind for_each_match().
+    ///
+
+    class phash_index {
+    public:
+
+        explicit phash_index(int threshold);
+
+        ///
+        /// Calculates the number of buckets examined by each call to find() for an index with
+        /// the given \p threshold. Each bucket holds around <tt>1 / 65536</tt> of the indexed
+        /// hashes, so this may be used to estimate whether an index will be quicker to use than
+        /// an exhaustive comparison.
+        ///
+
+        static std::size_t probe_count(int threshold);
+
+        ///
+        /// Calls \p callback with the identifier of every indexed hash within the threshold
+        /// distance of \p hash, exactly once each and in an unspecified order.
+        ///
+
+        template <typename Callback>
+        void find(std::uint64_t hash, Callback&& callback) const;
+
+        void insert(std::uint64_t hash, std::size_t id);
+
+        int threshold() const {
+            return m_threshold;
+        }
+
+    private:
+
+        static constexpr auto chunk_count = 4;
+        static constexpr auto chunk_bits = 16;
+
+        struct bucket {
+            std::vector<std::uint64_t> hashes;
+            std::vector<std::size_t> ids;
+        };
+
+        static std::uint16_t chunk(const std::uint64_t hash, const int index) {
+            return static_cast<std::uint16_t>(hash >> (index * chunk_bits));
+        }
+
+        ///
+        /// Determines whether a match between \p lhs and \p rhs would already have been found when
+        /// probing a chunk position before \p index; every match is reported only from the first
+        /// chunk position at which it can be found, so that it is reported exactly once.
+        ///
+
+        bool found_before(std::uint64_t lhs, std::uint64_t rhs, int index) const;
+
+        int m_threshold;
+        int m_radius;
+
+        std::vector<std::uint16_t> m_probe_masks;
+        std::array<std::vector<bucket>, chunk_count> m_buckets;
+    };
+
+    template <typename Callback>
+    void phash_index::find(const std::uint64_t hash, Callback&& callback) const {
+
+        for (auto index = 0; index < chunk_count; ++index) {
+
+            const auto& buckets = m_buckets[index];
+            const auto key = chunk(hash, index);
+
+            for (const auto mask : m_probe_masks) {
+
+                const auto& probed = buckets[key ^ mask];
+                const auto& hashes = probed.hashes;
+
+                for_each_match(hash, hashes.data(), hashes.size(), m_threshold,
+                    [this, &callback, &probed, &hashes, hash, index](const std::size_t offset) {
+                        if (!found_before(hashes[offset], hash, index)) {
+                            callback(probed.ids[offset]);
+                        }
+                    });
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,373 @@
+#include "read_ahead.hpp"
+#include "parallel.hpp"
+
+#include <QDateTime>
+#include <QFile>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(MYRIAD_HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+namespace myriad {
+
+    namespace {
+
+        ///
+        /// Converts the modification time in \p status to a \c QDateTime, to the millisecond, as
+        /// \c QFileInfo::lastModified() does, so that the two may be compared.
+        ///
+
+        QDateTime modified_time(const struct stat& status) {
+            return QDateTime::fromMSecsSinceEpoch(std::int64_t{status.st_mtim.tv_sec} * 1000
+                + status.st_mtim.tv_nsec / 1'000'000);
+        }
+    }
+
+#if defined(MYRIAD_HAVE_LIBURING)
+
+    struct read_ahead::ring {
+        io_uring queue;
+        std::size_t depth;
+    };
+
+#endif
+
+    read_ahead::read_ahead(
+        const QStringList& paths, const std::vector<int>& indices, const qint64 max_bytes,
+        const int max_reads)
+      : m_remaining{indices.size()}, m_max_bytes{std::max(max_bytes, qint64{1})} {
+
+        struct placement {
+            dev_t device;
+            ino_t inode;
+        };
+
+        // The sizes of the files are needed to keep to the budget, and their devices and inodes
+        // to order the reads. Their metadata will usually still be cached, from when they were
+        // looked up in the hash cache, so examining them costs little even on slow storage.
+
+        const auto count = indices.size();
+        auto requests = std::vector<request>(count);
+        auto placements = std::vector<placement>(count);
+        auto directories = std::vector<QString>(count);
+
+        parallel_for(count, max_reads,
+            [&paths, &indices, &requests, &placements, &directories](const std::size_t position) {
+
+                const auto& path = paths[indices[position]];
+                requests[position] = request{indices[position], path, 0};
+                directories[position] = path.left(path.lastIndexOf(QChar{'/'}));
+
+                struct stat status;
+                if (::stat(QFile::encodeName(path).constData(), &status) == 0) {
+                    requests[position].size = status.st_size;
+                    placements[position] = placement{status.st_dev, status.st_ino};
+                }
+            });
+
+        auto order = std::vector<std::size_t>(count);
+        std::iota(std::begin(order), std::end(order), std::size_t{0});
+        std::sort(std::begin(order), std::end(order),
+            [&placements, &directories](const std::size_t lhs, const std::size_t rhs) {
+                return std::tie(placements[lhs].device, directories[lhs], placements[lhs].inode)
+                    < std::tie(placements[rhs].device, directories[rhs], placements[rhs].inode);
+            });
+
+        m_requests.reserve(count);
+        for (const auto position : order) {
+            m_requests.push_back(std::move(requests[position]));
+        }
+
+        const auto reader_count = std::max(max_reads, 1);
+
+#if defined(MYRIAD_HAVE_LIBURING)
+
+        // io_uring may be unavailable even where liburing is, as in containers whose seccomp
+        // policy forbids it, in which case the threads are used instead.
+
+        auto uring = std::make_unique<ring>();
+        uring->depth = gsl::narrow_cast<std::size_t>(reader_count);
+        if (io_uring_queue_init(gsl::narrow_cast<unsigned>(reader_count), &uring->queue, 0) == 0) {
+            m_threads.emplace_back([this, uring = std::move(uring)] { read_files(*uring); });
+            return;
+        }
+
+#endif
+
+        for (auto i = 0; i < reader_count; ++i) {
+            m_threads.emplace_back([this] { read_files(); });
+        }
+    }
+
+    read_ahead::~read_ahead() {
+
+        close();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void read_ahead::close() {
+
+        {
+            const auto lock = std::lock_guard<std::mutex>{m_mutex};
+            m_closed = true;
+            m_ready.clear();
+        }
+
+        m_ready_changed.notify_all();
+        m_budget_changed.notify_all();
+    }
+
+    std::optional<read_ahead::file_data> read_ahead::pop() {
+
+        auto lock = std::unique_lock<std::mutex>{m_mutex};
+        m_ready_changed.wait(lock, [this] {
+            return m_closed || m_remaining == 0 || !m_ready.empty();
+        });
+
+        if (m_ready.empty()) {
+            return std::nullopt;
+        }
+
+        auto [result, size] = std::move(m_ready.front());
+        m_ready.pop_front();
+        m_bytes_in_flight -= size;
+
+        // Once the last file has been collected, other callers have nothing left to wait for.
+
+        const auto finished = (--m_remaining == 0);
+
+        lock.unlock();
+        m_budget_changed.notify_all();
+        if (finished) {
+            m_ready_changed.notify_all();
+        }
+
+        return std::move(result);
+    }
+
+    std::optional<read_ahead::request> read_ahead::claim(const bool wait) {
+
+        auto lock = std::unique_lock<std::mutex>{m_mutex};
+
+        const auto available = [this] {
+            return m_closed || m_next == m_requests.size() || m_bytes_in_flight == 0
+                || m_bytes_in_flight + m_requests[m_next].size <= m_max_bytes;
+        };
+
+        if (wait) {
+            m_budget_changed.wait(lock, available);
+        } else if (!available()) {
+            return std::nullopt;
+        }
+
+        if (m_closed || m_next == m_requests.size()) {
+            return std::nullopt;
+        }
+
+        const auto& result = m_requests[m_next++];
+        m_bytes_in_flight += result.size;
+        return result;
+    }
+
+    void read_ahead::deliver(
+        const request& item, std::optional<QByteArray> data, const QDateTime& last_modified) {
+
+        {
+            const auto lock = std::lock_guard<std::mutex>{m_mutex};
+            if (m_closed) {
+                return;
+            }
+
+            m_ready.emplace_back(file_data{item.index, std::move(data), last_modified}, item.size);
+        }
+
+        m_ready_changed.notify_one();
+    }
+
+    void read_ahead::read_files() {
+
+        while (const auto item = claim(true)) {
+
+            auto data = std::optional<QByteArray>{};
+            auto last_modified = QDateTime{};
+
+            QFile file{item->path};
+            struct stat status;
+            if (file.open(QIODevice::ReadOnly) && ::fstat(file.handle(), &status) == 0) {
+                last_modified = modified_time(status);
+                auto contents = file.readAll();
+                if (file.error() == QFileDevice::NoError) {
+                    data = std::move(contents);
+                }
+            }
+
+            deliver(*item, std::move(data), last_modified);
+        }
+    }
+
+#if defined(MYRIAD_HAVE_LIBURING)
+
+    void read_ahead::read_files(ring& uring) {
+
+        struct pending_read {
+            request item;
+            int fd;
+            QDateTime last_modified;
+            QByteArray data;
+            int done;
+        };
+
+        // The buffers of reads in flight must outlive the ring, which completes or cancels them
+        // as it is torn down.
+
+        auto reads = std::vector<std::optional<pending_read>>(uring.depth);
+        const auto exit_ring = gsl::finally([&uring] { io_uring_queue_exit(&uring.queue); });
+
+        auto free_slots = std::vector<std::size_t>{};
+        for (auto slot = uring.depth; slot > 0; --slot) {
+            free_slots.push_back(slot - 1);
+        }
+
+        const auto submit = [&uring, &reads](const std::size_t slot) {
+
+            auto& read = *reads[slot];
+            const auto entry = io_uring_get_sqe(&uring.queue);
+
+            io_uring_prep_read(entry, read.fd, read.data.data() + read.done,
+                gsl::narrow_cast<unsigned>(read.data.size() - read.done),
+                gsl::narrow_cast<std::uint64_t>(read.done));
+            io_uring_sqe_set_data(entry, reinterpret_cast<void*>(std::uintptr_t{slot}));
+        };
+
+        // A read is only complete if it filled the buffer and the file is still the size and age
+        // it was when opened; a file that grew while being read would otherwise be handed over
+        // truncated, and hashed (and cached) as such.
+
+        const auto finish = [this, &reads, &free_slots](const std::size_t slot) {
+
+            auto& read = *reads[slot];
+
+            struct stat status;
+            const auto complete = read.done == read.data.size()
+                && ::fstat(read.fd, &status) == 0 && status.st_size == read.done
+                && modified_time(status) == read.last_modified;
+
+            ::close(read.fd);
+
+            deliver(read.item, complete
+                ? std::optional<QByteArray>{std::move(read.data)}
+                : std::nullopt, read.last_modified);
+
+            reads[slot].reset();
+            free_slots.push_back(slot);
+        };
+
+        for (;;) {
+
+            // Files are opened on this thread, since opening only touches their metadata, which
+            // the constructor will usually have brought into memory. Reads are then started for
+            // as many files as the budget allows, waiting for it only if none are in flight. A
+            // file whose size has changed since the constructor examined it is handed over unread
+            // (to be read by the caller, as the threads would read it), since its buffer would be
+            // the wrong size.
+
+            while (!free_slots.empty()) {
+
+                const auto item = claim(free_slots.size() == uring.depth);
+                if (!item) {
+                    break;
+                }
+
+                const auto fd = (item->size > 0 && item->size <= std::numeric_limits<int>::max())
+                    ? ::open(QFile::encodeName(item->path).constData(), O_RDONLY | O_CLOEXEC)
+                    : -1;
+
+                struct stat status;
+                if (fd < 0 || ::fstat(fd, &status) != 0 || status.st_size != item->size) {
+                    if (fd >= 0) {
+                        ::close(fd);
+                    }
+
+                    deliver(*item, std::nullopt, QDateTime{});
+                    continue;
+                }
+
+                const auto slot = free_slots.back();
+                free_slots.pop_back();
+
+                reads[slot].emplace(pending_read{
+                    *item, fd, modified_time(status),
+                    QByteArray{gsl::narrow_cast<int>(item->size), Qt::Uninitialized}, 0});
+
+                submit(slot);
+            }
+
+            if (free_slots.size() == uring.depth) {
+                return;
+            }
+
+            const auto status = io_uring_submit_and_wait(&uring.queue, 1);
+            if (status < 0 && status != -EINTR) {
+
+                // The ring can no longer be used, so the files being read are handed over
+                // unread, their buffers being kept until the ring is torn down, and the rest are
+                // read on this thread instead.
+
+                for (auto& read : reads) {
+                    if (read) {
+                        ::close(read->fd);
+                        deliver(read->item, std::nullopt, QDateTime{});
+                    }
+                }
+
+                read_files();
+                return;
+            }
+
+            auto completion = static_cast<io_uring_cqe*>(nullptr);
+            if (io_uring_peek_cqe(&uring.queue, &completion) != 0) {
+                continue;
+            }
+
+            // Every completion available is handled before more reads are started. A short read
+            // (of a large file, or one on a network filesystem) is resumed where it stopped; a
+            // failed one, or one cut short by the file shrinking, is handed over incomplete.
+
+            do {
+                const auto slot = gsl::narrow_cast<std::size_t>(
+                    reinterpret_cast<std::uintptr_t>(io_uring_cqe_get_data(completion)));
+                const auto result = completion->res;
+                io_uring_cqe_seen(&uring.queue, completion);
+
+                auto& read = *reads[slot];
+                if (result > 0) {
+                    read.done += result;
+                }
+
+                if (result > 0 && read.done < read.data.size()) {
+                    submit(slot);
+                } else {
+                    finish(slot);
+                }
+            } while (io_uring_peek_cqe(&uring.queue, &completion) == 0);
+        }
+    }
+
+#endif
+}
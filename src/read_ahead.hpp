@@ -0,0 +1,130 @@
+#ifndef MYRIAD_READ_AHEAD_HPP
+#define MYRIAD_READ_AHEAD_HPP
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// A stage of the hashing pipeline that reads whole files into memory ahead of the threads
+    /// that decode them, so that on slow storage (spinning disks and network filesystems, where
+    /// a read may take far longer than a decode) the decoding threads find files already read
+    /// rather than each waiting on the disk in turn. Files are read in an order chosen for
+    /// locality, grouped by filesystem and directory and ordered by inode number within each
+    /// directory, which on most filesystems approximates their order on disk; they are handed
+    /// out in the order their reads complete.
+    ///
+    /// Where Myriad was built with liburing and the kernel permits it, reads are submitted
+    /// through a single io_uring, keeping up to the given number of them outstanding from one
+    /// thread; otherwise, that number of threads each read a file at a time. Either way, the
+    /// total size of the files being read and waiting to be collected is kept within a budget,
+    /// beyond which no more reads are started until files are collected (although a single file
+    /// larger than the budget is still read on its own).
+    ///
+
+    class read_ahead {
+    public:
+
+        ///
+        /// The contents of a file that has been read, identified by its \c index in the list of
+        /// paths given to the constructor, and the time it was last modified, as found once it
+        /// had been opened but before it was read. If the file could not be read in full, or
+        /// changed size while it was being read, \c data is empty, and the caller should read it
+        /// itself (and so discover the error, or read the whole of the file as it now is).
+        ///
+
+        struct file_data {
+            int index;
+            std::optional<QByteArray> data;
+            QDateTime last_modified;
+        };
+
+        ///
+        /// Starts reading the files at the indices \p indices of \p paths, keeping up to
+        /// \p max_reads reads outstanding and no more than \p max_bytes bytes read or being read
+        /// but not yet collected by pop(). The files are first examined, to find their sizes and
+        /// placement on disk, on \p max_reads threads.
+        ///
+
+        explicit read_ahead(
+            const QStringList& paths, const std::vector<int>& indices, qint64 max_bytes,
+            int max_reads);
+
+        read_ahead(const read_ahead&) = delete;
+        read_ahead& operator=(const read_ahead&) = delete;
+
+        ///
+        /// Stops reading, as close() does, and waits for the reads in progress to finish.
+        ///
+
+        ~read_ahead();
+
+        ///
+        /// Stops reading, discarding files that have been read but not collected, and wakes all
+        /// threads blocked in calls to pop().
+        ///
+
+        void close();
+
+        ///
+        /// Removes and returns a file that has been read, blocking until one is available.
+        /// Returns an empty \c std::optional once every file has been returned, or the stage has
+        /// been closed.
+        ///
+
+        std::optional<file_data> pop();
+
+    private:
+
+        struct request {
+            int index;
+            QString path;
+            qint64 size;
+        };
+
+        struct ring;
+
+        ///
+        /// Claims the next file to read, reserving its size from the budget. If \p wait is
+        /// \c true, this blocks until the budget allows the file to be read; otherwise, it
+        /// returns an empty \c std::optional straight away if it doesn't. An empty
+        /// \c std::optional is also returned once every file has been claimed, or the stage has
+        /// been closed.
+        ///
+
+        std::optional<request> claim(bool wait);
+
+        void deliver(
+            const request& item, std::optional<QByteArray> data, const QDateTime& last_modified);
+        void read_files();
+        void read_files(ring& uring);
+
+        std::mutex m_mutex;
+        std::condition_variable m_ready_changed;
+        std::condition_variable m_budget_changed;
+
+        std::vector<request> m_requests;
+        std::deque<std::pair<file_data, qint64>> m_ready;
+        std::size_t m_next = 0;
+        std::size_t m_remaining = 0;
+        qint64 m_max_bytes;
+        qint64 m_bytes_in_flight = 0;
+        bool m_closed = false;
+
+        std::vector<std::thread> m_threads;
+    };
+}
+
+#endif
@@ -0,0 +1,261 @@
+#include "shard_file.hpp"
+#include "binary_io.hpp"
+#include "exception.hpp"
+
+#include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+
+#include "gsl/gsl"
+
+#include <array>
+#include <limits>
+#include <utility>
+
+namespace myriad {
+
+    namespace {
+
+        using file_magic = std::array<char, 8>;
+
+        constexpr auto path_list_magic = file_magic{'M', 'Y', 'R', 'P', 'A', 'T', 'H', 'S'};
+        constexpr auto shard_magic = file_magic{'M', 'Y', 'R', 'S', 'H', 'A', 'R', 'D'};
+        constexpr auto candidate_magic = file_magic{'M', 'Y', 'R', 'C', 'A', 'N', 'D', 'S'};
+        constexpr auto format_version = std::uint32_t{2};
+
+        struct file_header {
+            file_magic magic;
+            std::uint32_t version;
+            std::uint32_t reserved;
+            std::uint64_t count;
+            std::uint64_t extra_count;
+        };
+
+        ///
+        /// The attributes of an image in a shard file other than its perceptual hash, which is
+        /// stored separately. The UTF-16 text of the images' paths follows all of these records.
+        /// The size and modification time are those the worker found before reading the file, so
+        /// that the entry the merging process adds to the cache is keyed as it would have been
+        /// had that process hashed the image itself.
+        ///
+
+        struct shard_record {
+            std::uint64_t checksum;
+            std::uint64_t file_size;
+            std::int64_t modified;
+            std::int32_t width;
+            std::int32_t height;
+            std::uint32_t path_length;
+            std::uint8_t format;
+            std::uint8_t cached;
+            std::array<std::uint8_t, 2> reserved;
+        };
+
+        struct candidate_record {
+            std::uint32_t lhs;
+            std::uint32_t rhs;
+        };
+
+        constexpr auto unknown_time = std::numeric_limits<std::int64_t>::min();
+
+        std::int64_t time_value(const QDateTime& time) {
+            return time.isValid() ? time.toMSecsSinceEpoch() : unknown_time;
+        }
+
+        QDateTime time_of(const std::int64_t value) {
+            return (value == unknown_time) ? QDateTime{} : QDateTime::fromMSecsSinceEpoch(value);
+        }
+
+        void open_for_reading(QFile& file) {
+            if (!file.open(QIODevice::ReadOnly)) {
+                throw file_io_error{file.fileName()};
+            }
+        }
+
+        ///
+        /// Reads the header of \p file, checking that it begins with \p magic and is of the
+        /// current version.
+        ///
+
+        file_header read_header(QFileDevice& file, const file_magic& magic) {
+
+            const auto result = read_value<file_header>(file);
+            if (result.magic != magic || result.version != format_version) {
+                throw file_io_error{file.fileName()};
+            }
+
+            return result;
+        }
+
+        ///
+        /// Writes a file at the filesystem path \p path by calling \p write with it, replacing
+        /// any existing file only once every write has succeeded.
+        ///
+
+        template <typename Func>
+        void save_file(const QString& path, Func&& write) {
+
+            QSaveFile file{path};
+            if (!file.open(QIODevice::WriteOnly)) {
+                throw file_io_error{path};
+            }
+
+            write(file);
+
+            if (!file.commit()) {
+                throw file_io_error{path};
+            }
+        }
+
+        void write_strings(QFileDevice& file, const QStringList& values) {
+            for (const auto& value : values) {
+                write_value(file, gsl::narrow_cast<std::uint32_t>(value.size()));
+                write_utf16(file, value);
+            }
+        }
+
+        void read_strings(QFileDevice& file, const std::uint64_t count, QStringList& values) {
+            for (auto index = std::uint64_t{0}; index < count; ++index) {
+                values.push_back(read_utf16(file, read_value<std::uint32_t>(file)));
+            }
+        }
+    }
+
+    void write_path_list(const QString& path, const QStringList& paths) {
+        save_file(path, [&paths](QFileDevice& file) {
+            const auto count = gsl::narrow_cast<std::uint64_t>(paths.size());
+            write_value(file, file_header{path_list_magic, format_version, 0, count, 0});
+            write_strings(file, paths);
+        });
+    }
+
+    QStringList read_path_list(const QString& path) {
+
+        QFile file{path};
+        open_for_reading(file);
+
+        const auto header = read_header(file, path_list_magic);
+        auto result = QStringList{};
+        read_strings(file, header.count, result);
+        return result;
+    }
+
+    void write_shard(
+        const QString& path, const std::vector<shard_image>& images,
+        const QStringList& failed_paths) {
+
+        save_file(path, [&images, &failed_paths](QFileDevice& file) {
+
+            write_value(file, file_header{shard_magic, format_version, 0, images.size(),
+                gsl::narrow_cast<std::uint64_t>(failed_paths.size())});
+
+            for (const auto& image : images) {
+                write_value(file, image.info.phash());
+            }
+
+            auto paths = QStringList{};
+            for (const auto& image : images) {
+
+                const auto& info = image.info;
+                const auto image_path = info.path();
+
+                write_value(file, shard_record{
+                    info.checksum(), info.file_size(), time_value(info.last_modified()),
+                    info.width(), info.height(),
+                    gsl::narrow_cast<std::uint32_t>(image_path.size()),
+                    static_cast<std::uint8_t>(info.format()), image.cached, {}});
+
+                paths.push_back(image_path);
+            }
+
+            for (const auto& image_path : paths) {
+                write_utf16(file, image_path);
+            }
+
+            write_strings(file, failed_paths);
+        });
+    }
+
+    void read_shard(
+        const QString& path, image_set& images, std::vector<image_set::handle>& items,
+        std::vector<image_info>& uncached, QStringList& failed_paths) {
+
+        QFile file{path};
+        open_for_reading(file);
+
+        const auto header = read_header(file, shard_magic);
+        const auto count = gsl::narrow_cast<std::size_t>(header.count);
+
+        auto hashes = std::vector<std::uint64_t>(count);
+        for (auto& hash : hashes) {
+            hash = read_value<std::uint64_t>(file);
+        }
+
+        auto records = std::vector<shard_record>(count);
+        for (auto& record : records) {
+            record = read_value<shard_record>(file);
+        }
+
+        for (auto index = std::size_t{0}; index < count; ++index) {
+
+            const auto& record = records[index];
+            const auto image_path = read_utf16(file, record.path_length);
+
+            auto info = image_info{
+                image_path, record.file_size, time_of(record.modified), record.width,
+                record.height, static_cast<image_format>(record.format), record.checksum,
+                hashes[index]};
+
+            const auto [item, inserted] = images.insert(info);
+            items.push_back(item);
+            if (inserted && !record.cached) {
+                uncached.push_back(std::move(info));
+            }
+        }
+
+        read_strings(file, header.extra_count, failed_paths);
+    }
+
+    std::vector<std::uint64_t> read_shard_hashes(const QString& path) {
+
+        QFile file{path};
+        open_for_reading(file);
+
+        const auto header = read_header(file, shard_magic);
+        auto result = std::vector<std::uint64_t>(gsl::narrow_cast<std::size_t>(header.count));
+
+        const auto size = gsl::narrow_cast<qint64>(result.size() * sizeof(std::uint64_t));
+        if (file.read(reinterpret_cast<char*>(result.data()), size) != size) {
+            throw file_io_error{path};
+        }
+
+        return result;
+    }
+
+    void write_candidates(const QString& path, const candidate_list& candidates) {
+        save_file(path, [&candidates](QFileDevice& file) {
+
+            const auto count = std::uint64_t{candidates.size()};
+            write_value(file, file_header{candidate_magic, format_version, 0, count, 0});
+
+            for (const auto& [lhs, rhs] : candidates) {
+                write_value(file, candidate_record{
+                    gsl::narrow_cast<std::uint32_t>(lhs), gsl::narrow_cast<std::uint32_t>(rhs)});
+            }
+        });
+    }
+
+    void read_candidates(
+        const QString& path, const std::size_t lhs_offset, const std::size_t rhs_offset,
+        candidate_list& candidates) {
+
+        QFile file{path};
+        open_for_reading(file);
+
+        const auto header = read_header(file, candidate_magic);
+        for (auto index = std::uint64_t{0}; index < header.count; ++index) {
+            const auto record = read_value<candidate_record>(file);
+            candidates.emplace_back(lhs_offset + record.lhs, rhs_offset + record.rhs);
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef MYRIAD_SHARD_FILE_HPP
+#define MYRIAD_SHARD_FILE_HPP
+
+#include "image_info.hpp"
+#include "image_set.hpp"
+#include "pairer.hpp"
+
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// The files by which the processes of a sharded merge pass work and results between each
+    /// other. A collection is divided into shards, each of which is hashed by a separate worker
+    /// process, which writes a shard file; candidate duplicates are then found by other workers
+    /// within each shard, and between each pair of shards, from the perceptual hashes in the
+    /// shard files, each writing a candidate file. The images of a shard are identified by their
+    /// indices within its file, so the shard files can be combined simply by numbering their
+    /// images one after another, and the candidate files by offsetting the indices they hold
+    /// accordingly.
+    ///
+    /// A shard file begins with the perceptual hashes of its images, so that a worker searching
+    /// for candidates reads only those. The files are native-endian, since their only purpose is
+    /// to pass data between processes on the same machine.
+    ///
+
+    ///
+    /// Writes \p paths to a file at the filesystem path \p path, for a worker to read with
+    /// read_path_list().
+    /// \throws file_io_error if the file could not be written.
+    ///
+
+    void write_path_list(const QString& path, const QStringList& paths);
+    QStringList read_path_list(const QString& path);
+
+    ///
+    /// An image read from a shard file, together with whether its attributes were found in the
+    /// collection's \ref hash_cache (and so need not be added to it).
+    ///
+
+    struct shard_image {
+        image_info info;
+        bool cached;
+    };
+
+    ///
+    /// Writes a shard file at the filesystem path \p path holding \p images, in order, and the
+    /// paths of images in the shard that could not be read, \p failed_paths.
+    /// \throws file_io_error if the file could not be written.
+    ///
+
+    void write_shard(
+        const QString& path, const std::vector<shard_image>& images,
+        const QStringList& failed_paths);
+
+    ///
+    /// Reads the shard file at the filesystem path \p path, adding its images to \p images in
+    /// order and appending their handles to \p items, appending those added whose attributes
+    /// were not cached to \p uncached (with the metadata their worker found, to be added to the
+    /// cache), and appending the paths of the images that could not be read to \p failed_paths.
+    /// \throws file_io_error if the file could not be read or is not a shard file.
+    ///
+
+    void read_shard(
+        const QString& path, image_set& images, std::vector<image_set::handle>& items,
+        std::vector<image_info>& uncached, QStringList& failed_paths);
+
+    ///
+    /// Reads only the perceptual hashes of the images in the shard file at the filesystem path
+    /// \p path.
+    /// \throws file_io_error if the file could not be read or is not a shard file.
+    ///
+
+    std::vector<std::uint64_t> read_shard_hashes(const QString& path);
+
+    void write_candidates(const QString& path, const candidate_list& candidates);
+
+    ///
+    /// Reads the candidate file at the filesystem path \p path, appending each of its pairs of
+    /// indices to \p candidates after adding \p lhs_offset to the first and \p rhs_offset to the
+    /// second.
+    /// \throws file_io_error if the file could not be read or is not a candidate file.
+    ///
+
+    void read_candidates(
+        const QString& path, std::size_t lhs_offset, std::size_t rhs_offset,
+        candidate_list& candidates);
+}
+
+#endif
@@ -0,0 +1,213 @@
+#include "shard_worker.hpp"
+#include "exception.hpp"
+#include "hash_cache.hpp"
+#include "identical_files.hpp"
+#include "image_info.hpp"
+#include "pairer.hpp"
+#include "parallel.hpp"
+#include "shard_file.hpp"
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
+
+#include "gsl/gsl"
+
+#include <algorithm>
+#include <cstdio>
+#include <optional>
+#include <vector>
+
+namespace myriad {
+
+    namespace {
+
+        const auto hash_task = QStringLiteral("hash");
+        const auto pair_task = QStringLiteral("pair");
+
+        ///
+        /// Hashes the images at \p paths on \p worker_count threads, as engine::hash_images()
+        /// does, but without ever modifying \p cache, and writes them as a shard file to
+        /// \p output_path.
+        ///
+
+        void hash_shard(
+            const QStringList& paths, hash_cache& cache, const phash_variant variant,
+            const int worker_count, const QString& output_path) {
+
+            const auto path_count = gsl::narrow_cast<std::size_t>(paths.size());
+            auto results = std::vector<std::optional<shard_image>>(path_count);
+            auto sizes = std::vector<qint64>(path_count);
+            auto modified = std::vector<QDateTime>(path_count);
+
+            parallel_for(path_count, worker_count,
+                [&paths, &cache, &results, &sizes, &modified](const std::size_t index) {
+
+                    const auto file_info = QFileInfo{paths[gsl::narrow_cast<int>(index)]};
+                    if (auto info = cache.find(file_info)) {
+                        results[index].emplace(shard_image{std::move(*info), true});
+                    } else {
+                        sizes[index] = file_info.size();
+                        modified[index] = file_info.lastModified();
+                    }
+                });
+
+            // Only one of a set of byte-identical files is decoded; the others are given its
+            // attributes afterwards.
+
+            const auto originals = find_identical_files(paths, sizes, worker_count);
+
+            parallel_for(path_count, worker_count,
+                [&paths, &results, &originals, variant](const std::size_t index) {
+
+                    const auto position = gsl::narrow_cast<int>(index);
+                    if (results[index] || originals[index] != position) {
+                        return;
+                    }
+
+                    try {
+                        results[index].emplace(
+                            shard_image{image_info{QFileInfo{paths[position]}, variant}, false});
+                    } catch (const file_io_error&) {
+                    }
+                });
+
+            auto images = std::vector<shard_image>{};
+            auto failed_paths = QStringList{};
+
+            for (auto index = 0; index < paths.size(); ++index) {
+
+                const auto& source = results[gsl::narrow_cast<std::size_t>(originals[index])];
+                if (!source) {
+                    failed_paths.push_back(paths[index]);
+                } else if (originals[index] == index) {
+                    images.push_back(*source);
+                } else {
+                    const auto& original = source->info;
+                    images.push_back(shard_image{image_info{
+                        QFileInfo{paths[index]}.absoluteFilePath(), original.file_size(),
+                        modified[gsl::narrow_cast<std::size_t>(index)], original.width(),
+                        original.height(), original.format(), original.checksum(),
+                        original.phash()}, false});
+                }
+            }
+
+            write_shard(output_path, images, failed_paths);
+        }
+    }
+
+    QStringList shard_hash_arguments(
+        const QString& paths_path, const QString& cache_path, const phash_variant variant,
+        const int worker_count, const QString& output_path) {
+
+        auto result = QStringList{
+            QStringLiteral("--shard-worker"), QStringLiteral("--task"), hash_task,
+            QStringLiteral("--input"), paths_path, QStringLiteral("--cache"), cache_path,
+            QStringLiteral("--threads"), QString::number(worker_count),
+            QStringLiteral("--output"), output_path};
+
+        if (variant == phash_variant::area) {
+            result.push_back(QStringLiteral("--fast-hash"));
+        }
+
+        return result;
+    }
+
+    QStringList shard_pair_arguments(
+        const QString& lhs_path, const QString& rhs_path, const int threshold,
+        const int worker_count, const QString& output_path) {
+
+        auto result = QStringList{
+            QStringLiteral("--shard-worker"), QStringLiteral("--task"), pair_task,
+            QStringLiteral("--input"), lhs_path,
+            QStringLiteral("--threshold"), QString::number(threshold),
+            QStringLiteral("--threads"), QString::number(worker_count),
+            QStringLiteral("--output"), output_path};
+
+        if (!rhs_path.isEmpty()) {
+            result.append({QStringLiteral("--input"), rhs_path});
+        }
+
+        return result;
+    }
+
+    int run_shard_worker(int argc, char** argv) {
+
+        QCoreApplication app{argc, argv};
+
+        auto parser = QCommandLineParser{};
+        parser.setApplicationDescription(QStringLiteral(
+            "Performs one task of a sharded merge on behalf of another Myriad process."));
+
+        const auto worker_option = QCommandLineOption{QStringLiteral("shard-worker"),
+            QStringLiteral("Run as a worker process of a sharded merge.")};
+
+        const auto task_option = QCommandLineOption{QStringLiteral("task"),
+            QStringLiteral("The task to perform: 'hash' or 'pair'."), QStringLiteral("task")};
+
+        const auto input_option = QCommandLineOption{QStringLiteral("input"),
+            QStringLiteral("A path list to hash, or one or two shard files to pair."),
+            QStringLiteral("file")};
+
+        const auto cache_option = QCommandLineOption{QStringLiteral("cache"),
+            QStringLiteral("The hash cache to look images up in."), QStringLiteral("file")};
+
+        const auto threshold_option = QCommandLineOption{QStringLiteral("threshold"),
+            QStringLiteral("The greatest distance between the hashes of duplicates."),
+            QStringLiteral("distance"), QStringLiteral("8")};
+
+        const auto threads_option = QCommandLineOption{QStringLiteral("threads"),
+            QStringLiteral("The number of threads to use."), QStringLiteral("count"),
+            QStringLiteral("1")};
+
+        const auto fast_hash_option = QCommandLineOption{QStringLiteral("fast-hash"),
+            QStringLiteral("Compute the area variant of the perceptual hash.")};
+
+        const auto output_option = QCommandLineOption{QStringLiteral("output"),
+            QStringLiteral("The file to write the result to."), QStringLiteral("file")};
+
+        parser.addOptions({worker_option, task_option, input_option, cache_option,
+            threshold_option, threads_option, fast_hash_option, output_option});
+        parser.process(app);
+
+        const auto task = parser.value(task_option);
+        const auto inputs = parser.values(input_option);
+        const auto output_path = parser.value(output_option);
+        const auto worker_count = std::max(parser.value(threads_option).toInt(), 1);
+
+        try {
+            if (task == hash_task && inputs.size() == 1 && !output_path.isEmpty()) {
+
+                const auto variant = parser.isSet(fast_hash_option)
+                    ? phash_variant::area
+                    : phash_variant::compatible;
+
+                hash_cache cache{parser.value(cache_option), variant};
+                hash_shard(read_path_list(inputs[0]), cache, variant, worker_count, output_path);
+                return 0;
+            }
+
+            if (task == pair_task && (inputs.size() == 1 || inputs.size() == 2)
+                && !output_path.isEmpty()) {
+
+                const auto threshold = parser.value(threshold_option).toInt();
+                const auto lhs_hashes = read_shard_hashes(inputs[0]);
+
+                write_candidates(output_path, (inputs.size() == 1)
+                    ? find_pairs_within(lhs_hashes, threshold, worker_count)
+                    : find_pairs_between(
+                        lhs_hashes, read_shard_hashes(inputs[1]), threshold, worker_count));
+
+                return 0;
+            }
+        } catch (const file_io_error& error) {
+            std::fprintf(stderr, "Could not use the file %s\n", error.what());
+            return 1;
+        }
+
+        std::fprintf(stderr, "Invalid shard worker arguments\n");
+        return 2;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef MYRIAD_SHARD_WORKER_HPP
+#define MYRIAD_SHARD_WORKER_HPP
+
+#include "phash.hpp"
+
+#include <QString>
+#include <QStringList>
+
+namespace myriad {
+
+    ///
+    /// Gets the arguments with which to run Myriad as a worker process that hashes the images
+    /// whose paths are listed in the file at \p paths_path (as written by write_path_list()) on
+    /// \p worker_count threads, writing the results as a shard file to \p output_path. Hashes
+    /// of the \p variant are looked up in the \ref hash_cache at \p cache_path, which the worker
+    /// only reads, leaving the images it had to hash to be added by the process that runs it.
+    ///
+
+    QStringList shard_hash_arguments(
+        const QString& paths_path, const QString& cache_path, phash_variant variant,
+        int worker_count, const QString& output_path);
+
+    ///
+    /// Gets the arguments with which to run Myriad as a worker process that finds the candidate
+    /// duplicates, within \p threshold of each other, among the images of the shard file at
+    /// \p lhs_path, or if \p rhs_path is not empty, between those images and the images of the
+    /// shard file at \p rhs_path, searching on \p worker_count threads and writing the pairs
+    /// found as a candidate file to \p output_path.
+    ///
+
+    QStringList shard_pair_arguments(
+        const QString& lhs_path, const QString& rhs_path, int threshold, int worker_count,
+        const QString& output_path);
+
+    ///
+    /// Runs Myriad as a worker process of a sharded merge, performing the single task described
+    /// by the command line given by \p argc and \p argv, as built by shard_hash_arguments() or
+    /// shard_pair_arguments(), and returns the process exit status: zero if the output file was
+    /// written, and non-zero otherwise. Only a \c QCoreApplication is constructed, and nothing
+    /// is written to the standard output; the output file is only replaced once complete, so a
+    /// worker that fails or is killed never leaves a partial result behind.
+    ///
+
+    int run_shard_worker(int argc, char** argv);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "spill_file.hpp"
+#include "binary_io.hpp"
+#include "exception.hpp"
+
+#include <QDateTime>
+#include <QDir>
+
+#include "gsl/gsl"
+
+namespace myriad {
+
+    namespace {
+
+        void open_temporary(QTemporaryFile& file, const QString& dir_path) {
+            file.setFileTemplate(QDir{dir_path}.filePath(QStringLiteral("myriad-spill-XXXXXX")));
+            if (!file.open()) {
+                throw file_io_error{file.fileTemplate()};
+            }
+        }
+    }
+
+    ///
+    /// The fixed-size part of an image's record, which is followed in the file by the UTF-16
+    /// text of its path. The records are native-endian, since they never outlive the process.
+    ///
+
+    struct image_spill::record {
+        std::uint64_t phash;
+        std::uint64_t checksum;
+        std::uint64_t file_size;
+        std::int32_t width;
+        std::int32_t height;
+        std::uint32_t path_length;
+        std::uint32_t format;
+    };
+
+    path_spill::path_spill(const QString& dir_path) {
+        open_temporary(m_file, dir_path);
+    }
+
+    void path_spill::append(const QString& path) {
+        write_value(m_file, gsl::narrow_cast<std::uint32_t>(path.size()));
+        write_utf16(m_file, path);
+        ++m_count;
+    }
+
+    QStringList path_spill::read(const int max_count) {
+
+        if (!m_reading) {
+            if (!m_file.flush() || !m_file.seek(0)) {
+                throw file_io_error{m_file.fileName()};
+            }
+
+            m_reading = true;
+        }
+
+        auto result = QStringList{};
+        while (result.size() < max_count && !m_file.atEnd()) {
+            result.push_back(read_utf16(m_file, read_value<std::uint32_t>(m_file)));
+        }
+
+        return result;
+    }
+
+    image_spill::image_spill(const QString& dir_path) {
+        open_temporary(m_file, dir_path);
+    }
+
+    void image_spill::append(const image_set& set) {
+
+        if (!m_file.seek(m_end)) {
+            throw file_io_error{m_file.fileName()};
+        }
+
+        for (const auto item : set.handles()) {
+
+            const auto info = set.info(item);
+            const auto path = info.path();
+
+            write_value(m_file, record{
+                info.phash(), info.checksum(), info.file_size(), info.width(), info.height(),
+                gsl::narrow_cast<std::uint32_t>(path.size()),
+                static_cast<std::uint32_t>(info.format())});
+
+            write_utf16(m_file, path);
+
+            m_hashes.push_back(info.phash());
+            m_offsets.push_back(m_end);
+            m_end += gsl::narrow_cast<qint64>(sizeof(record) + path.size() * sizeof(char16_t));
+        }
+    }
+
+    image_set image_spill::load(const std::vector<std::size_t>& ids) {
+
+        if (!m_file.flush()) {
+            throw file_io_error{m_file.fileName()};
+        }
+
+        auto result = image_set{};
+        auto position = qint64{-1};
+
+        for (const auto id : ids) {
+
+            // Seeking discards the file's read buffer, so it is avoided when the next record
+            // follows directly on from the last.
+
+            if (m_offsets[id] != position && !m_file.seek(m_offsets[id])) {
+                throw file_io_error{m_file.fileName()};
+            }
+
+            const auto rec = read_value<record>(m_file);
+            const auto path = read_utf16(m_file, rec.path_length);
+
+            result.insert(image_info{
+                path, rec.file_size, QDateTime{}, rec.width, rec.height,
+                static_cast<image_format>(rec.format), rec.checksum, rec.phash});
+
+            position = m_offsets[id]
+                + gsl::narrow_cast<qint64>(sizeof(record) + rec.path_length * sizeof(char16_t));
+        }
+
+        return result;
+    }
+}
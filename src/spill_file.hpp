@@ -0,0 +1,121 @@
+#ifndef MYRIAD_SPILL_FILE_HPP
+#define MYRIAD_SPILL_FILE_HPP
+
+#include "image_info.hpp"
+#include "image_set.hpp"
+
+#include <QString>
+#include <QStringList>
+#include <QTemporaryFile>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace myriad {
+
+    ///
+    /// A list of filesystem paths kept in a temporary file rather than in memory, so that the
+    /// paths found by scanning a very large collection need not all be held at once. Paths are
+    /// appended, then read back in order, a batch at a time. The file is deleted when the list is
+    /// destroyed.
+    ///
+
+    class path_spill {
+    public:
+
+        ///
+        /// Creates an empty list backed by a new temporary file in the directory at the filesystem
+        /// path \p dir_path.
+        /// \throws file_io_error if the file could not be created.
+        ///
+
+        explicit path_spill(const QString& dir_path);
+
+        path_spill(const path_spill&) = delete;
+        path_spill& operator=(const path_spill&) = delete;
+
+        ///
+        /// Appends \p path to the list. Must not be called once read() has been.
+        /// \throws file_io_error if the file could not be written.
+        ///
+
+        void append(const QString& path);
+
+        ///
+        /// Reads up to \p max_count paths following those already read, returning an empty list
+        /// once every path has been read.
+        /// \throws file_io_error if the file could not be read.
+        ///
+
+        QStringList read(int max_count);
+
+        int size() const {
+            return m_count;
+        }
+
+    private:
+        QTemporaryFile m_file;
+        int m_count = 0;
+        bool m_reading = false;
+    };
+
+    ///
+    /// A set of images whose records are kept in a temporary file rather than in memory, leaving
+    /// only the perceptual hash and file offset of each resident: 16 bytes per image, where an
+    /// \ref image_set needs several times that. Candidate duplicates can be found from the hashes
+    /// alone, so that only the records of the few images that have duplicates need ever be read
+    /// back. Images are identified by their indices in the order they were appended, which is
+    /// also the order of their records in the file, so reading a list of images in index order
+    /// reads the file sequentially. The file is deleted when the set is destroyed.
+    ///
+
+    class image_spill {
+    public:
+
+        ///
+        /// Creates an empty set backed by a new temporary file in the directory at the filesystem
+        /// path \p dir_path.
+        /// \throws file_io_error if the file could not be created.
+        ///
+
+        explicit image_spill(const QString& dir_path);
+
+        image_spill(const image_spill&) = delete;
+        image_spill& operator=(const image_spill&) = delete;
+
+        ///
+        /// Appends every image in \p set to the file, in an unspecified order.
+        /// \throws file_io_error if the file could not be written.
+        ///
+
+        void append(const image_set& set);
+
+        ///
+        /// Reads the records of the images with the indices \p ids (which should be in ascending
+        /// order) back into a new \ref image_set.
+        /// \throws file_io_error if the file could not be read.
+        ///
+
+        image_set load(const std::vector<std::size_t>& ids);
+
+        const std::vector<std::uint64_t>& hashes() const {
+            return m_hashes;
+        }
+
+        std::size_t size() const {
+            return m_hashes.size();
+        }
+
+    private:
+
+        struct record;
+
+        QTemporaryFile m_file;
+        std::vector<std::uint64_t> m_hashes;
+        std::vector<qint64> m_offsets;
+        qint64 m_end = 0;
+    };
+}
+
+#endif
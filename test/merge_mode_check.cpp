@@ -0,0 +1,176 @@
+#include "corpus.hpp"
+#include "exception.hpp"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+
+#include <array>
+#include <cstdio>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Checks that sharded and external merges report the same outcome as a phased merge, by running
+// the myriad executable given as the only argument in batch mode over a small synthetic corpus
+// written by write_corpus(): with --shards, with --memory-limit (which holds the collection in a
+// spill file) and with neither, comparing the groups and actions of the other reports with those
+// of the last. The original of each group of near-duplicates is moved out of the collection to
+// serve as an input, so that both the deduplication of the collection and the merging of the
+// inputs into it are exercised.
+//
+// The worker processes of the sharded merge are local processes, started by the executable
+// itself. The runs share a cache directory of their own, so the sharded merge (which runs first)
+// hashes every image in its workers, and the later merges find the hashes they computed in the
+// cache.
+
+using namespace myriad;
+
+namespace {
+
+    constexpr auto group_count = 2;
+    constexpr auto shard_count = 3;
+    constexpr auto variant_count = std::size_t{4};
+
+    ///
+    /// Runs \p program in batch mode with \p arguments and the environment \p environment,
+    /// writing its report to the filesystem path \p report_path, and returns the report, or an
+    /// empty \c std::optional if the program failed.
+    ///
+
+    std::optional<QJsonObject> run_batch(
+        const QString& program, const QStringList& arguments,
+        const QProcessEnvironment& environment, const QString& report_path) {
+
+        QProcess process;
+        process.setProcessEnvironment(environment);
+        process.setProcessChannelMode(QProcess::ForwardedChannels);
+        process.start(program,
+            QStringList{QStringLiteral("--batch"), QStringLiteral("--report"), report_path}
+                + arguments);
+
+        if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit
+            || process.exitCode() != 0) {
+
+            std::fprintf(stderr, "myriad %s failed\n", qPrintable(arguments.join(QChar{' '})));
+            return std::nullopt;
+        }
+
+        QFile file{report_path};
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::fprintf(stderr, "Could not read the report %s\n", qPrintable(report_path));
+            return std::nullopt;
+        }
+
+        return QJsonDocument::fromJson(file.readAll()).object();
+    }
+}
+
+int main(int argc, char** argv) {
+
+    QCoreApplication app{argc, argv};
+
+    if (argc != 2) {
+        std::fprintf(stderr, "Usage: %s <myriad executable>\n", argv[0]);
+        return 2;
+    }
+
+    const auto program = QString::fromLocal8Bit(argv[1]);
+
+    auto temp_dir = QTemporaryDir{};
+    if (!temp_dir.isValid()) {
+        std::fprintf(stderr, "Could not create a temporary directory\n");
+        return 1;
+    }
+
+    const auto collection_path = temp_dir.filePath(QStringLiteral("collection"));
+    const auto inputs_path = temp_dir.filePath(QStringLiteral("inputs"));
+    if (!QDir{}.mkpath(collection_path) || !QDir{}.mkpath(inputs_path)) {
+        std::fprintf(stderr, "Could not create the corpus directories\n");
+        return 1;
+    }
+
+    auto corpus = std::vector<corpus_file>{};
+    try {
+        corpus = write_corpus(collection_path, group_count);
+    } catch (const file_io_error& error) {
+        std::fprintf(stderr, "Could not write %s\n", error.what());
+        return 1;
+    }
+
+    const auto inputs_dir = QDir{inputs_path};
+    for (auto index = std::size_t{0}; index < corpus.size(); index += variant_count) {
+        const auto& path = corpus[index].path;
+        if (!QFile::rename(path, inputs_dir.filePath(QFileInfo{path}.fileName()))) {
+            std::fprintf(stderr, "Could not move %s\n", qPrintable(path));
+            return 1;
+        }
+    }
+
+    auto environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(
+        QStringLiteral("XDG_CACHE_HOME"), temp_dir.filePath(QStringLiteral("cache")));
+
+    const auto arguments = QStringList{
+        QStringLiteral("--collection"), collection_path, QStringLiteral("--keep"),
+        QStringLiteral("resolution"), inputs_path};
+
+    const auto sharded = run_batch(program,
+        QStringList{QStringLiteral("--shards"), QString::number(shard_count)} + arguments,
+        environment, temp_dir.filePath(QStringLiteral("sharded.json")));
+
+    const auto external = run_batch(program,
+        QStringList{QStringLiteral("--memory-limit"), QStringLiteral("1")} + arguments,
+        environment, temp_dir.filePath(QStringLiteral("external.json")));
+
+    const auto phased = run_batch(
+        program, arguments, environment, temp_dir.filePath(QStringLiteral("phased.json")));
+
+    if (!sharded || !external || !phased) {
+        return 1;
+    }
+
+    // Paths are reported in full, and are the same in every run, so the reports can be compared
+    // directly.
+
+    auto result = 0;
+    const auto others = std::array<std::pair<const char*, const QJsonObject*>, 2>{{
+        {"sharded", &*sharded}, {"external", &*external}}};
+
+    for (const auto& [mode, report] : others) {
+        for (const auto key : std::array<const char*, 3>{{"groups", "actions", "unreadable"}}) {
+            const auto name = QString::fromLatin1(key);
+            if (report->value(name) != phased->value(name)) {
+                std::fprintf(stderr, "The %s of the %s and phased merges differ\n", key, mode);
+                result = 1;
+            }
+        }
+    }
+
+    if (phased->value(QStringLiteral("groups")).toArray().isEmpty()) {
+        std::fprintf(stderr, "No duplicates were found\n");
+        result = 1;
+    }
+
+    if (result != 0) {
+        temp_dir.setAutoRemove(false);
+        std::fprintf(
+            stderr, "The corpus and reports were kept in %s\n", qPrintable(temp_dir.path()));
+        return result;
+    }
+
+    std::printf("The merges of %zu images reported the same %d groups\n", corpus.size(),
+        phased->value(QStringLiteral("groups")).toArray().size());
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "exception.hpp"
+#include "hash.hpp"
+#include "image_info.hpp"
+#include "image_set.hpp"
+#include "spill_file.hpp"
+
+#include <QDateTime>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// Checks that the images appended to an image_spill are read back by load() with every attribute
+// an image_set keeps, however the ids asked for are ordered. Two sets of synthetic images are
+// appended, with a load in between, so that appending after reading is exercised too; the ids
+// are then loaded shuffled, and in descending order, as well as in the ascending order the
+// external merge uses.
+
+using namespace myriad;
+
+namespace {
+
+    constexpr auto image_count = 1000;
+
+    ///
+    /// Constructs a set of \p count images under the filesystem path \p prefix, with attributes
+    /// that differ from image to image.
+    ///
+
+    image_set synthetic_set(const QString& prefix, const int count, std::mt19937_64& random) {
+
+        constexpr auto formats = std::size_t{5};
+
+        auto result = image_set{};
+        for (auto index = 0; index < count; ++index) {
+            const auto path = prefix + QString::number(index) + QStringLiteral(".jpg");
+            result.insert(image_info{
+                path, std::uint64_t{7} * index + 1, QDateTime{}, 1 + index % 640,
+                1 + index % 480, static_cast<image_format>(index % formats), stable_hash(path),
+                random()});
+        }
+
+        return result;
+    }
+
+    ///
+    /// Checks that every image of \p loaded is in \p expected with the same attributes, and that
+    /// they are the images of \p spill with the ids \p ids (loaded in the order \p order),
+    /// reporting the first problem found.
+    ///
+
+    bool check_load(
+        const image_set& expected, const image_spill& spill, const std::vector<std::size_t>& ids,
+        const image_set& loaded, const char* order) {
+
+        if (loaded.size() != ids.size()) {
+            std::fprintf(stderr, "Loading %zu ids in %s order gave %zu images\n", ids.size(),
+                order, loaded.size());
+            return false;
+        }
+
+        auto loaded_hashes = std::vector<std::uint64_t>{};
+        for (const auto item : loaded.handles()) {
+
+            const auto actual = loaded.info(item);
+            const auto match = expected.find(actual.path());
+            if (!match) {
+                std::fprintf(stderr, "%s was loaded in %s order, but never appended\n",
+                    qPrintable(actual.path()), order);
+                return false;
+            }
+
+            const auto original = expected.info(*match);
+            if (actual.file_size() != original.file_size() || actual.width() != original.width()
+                || actual.height() != original.height() || actual.format() != original.format()
+                || actual.checksum() != original.checksum() || actual.phash() != original.phash()) {
+
+                std::fprintf(stderr, "%s was loaded in %s order with different attributes\n",
+                    qPrintable(actual.path()), order);
+                return false;
+            }
+
+            loaded_hashes.push_back(actual.phash());
+        }
+
+        auto spilled_hashes = std::vector<std::uint64_t>{};
+        for (const auto id : ids) {
+            spilled_hashes.push_back(spill.hashes()[id]);
+        }
+
+        std::sort(std::begin(loaded_hashes), std::end(loaded_hashes));
+        std::sort(std::begin(spilled_hashes), std::end(spilled_hashes));
+        if (loaded_hashes != spilled_hashes) {
+            std::fprintf(stderr, "The images loaded in %s order aren't those asked for\n", order);
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main() {
+
+    auto temp_dir = QTemporaryDir{};
+    if (!temp_dir.isValid()) {
+        std::fprintf(stderr, "Could not create a temporary directory\n");
+        return 1;
+    }
+
+    auto random = std::mt19937_64{42};
+    const auto first = synthetic_set(QStringLiteral("/spill/first/"), image_count, random);
+    const auto second = synthetic_set(QStringLiteral("/spill/second/"), image_count, random);
+
+    auto expected = image_set{};
+    for (const auto* set : {&first, &second}) {
+        for (const auto item : set->handles()) {
+            expected.insert(set->info(item));
+        }
+    }
+
+    try {
+        auto spill = image_spill{temp_dir.path()};
+        spill.append(first);
+
+        auto first_ids = std::vector<std::size_t>(first.size());
+        std::iota(std::begin(first_ids), std::end(first_ids), std::size_t{0});
+        if (!check_load(expected, spill, first_ids, spill.load(first_ids), "ascending")) {
+            return 1;
+        }
+
+        spill.append(second);
+        if (spill.size() != expected.size()) {
+            std::fprintf(stderr, "%zu images were appended, but the spill holds %zu\n",
+                expected.size(), spill.size());
+            return 1;
+        }
+
+        auto ids = std::vector<std::size_t>(spill.size());
+        std::iota(std::begin(ids), std::end(ids), std::size_t{0});
+        if (!check_load(expected, spill, ids, spill.load(ids), "ascending")) {
+            return 1;
+        }
+
+        std::shuffle(std::begin(ids), std::end(ids), random);
+        ids.resize(ids.size() / 2);
+        if (!check_load(expected, spill, ids, spill.load(ids), "shuffled")) {
+            return 1;
+        }
+
+        std::sort(std::begin(ids), std::end(ids), std::greater<>{});
+        if (!check_load(expected, spill, ids, spill.load(ids), "descending")) {
+            return 1;
+        }
+    } catch (const file_io_error& error) {
+        std::fprintf(stderr, "Could not use the spill file %s\n", error.what());
+        return 1;
+    }
+
+    std::printf("%zu images were read back from the spill file intact\n", expected.size());
+    return 0;
+}